@@ -38,6 +38,7 @@ Authors:
 #include "commands.h"
 #include "lengths.h"
 #include "vertical.h"
+#include "hash.h"
 #include "auxfile.h"
 #include "acronyms.h"
 #include "biblio.h"
@@ -119,9 +120,9 @@ void UsePackageAcronym(char *options)
         diagnostics(WARNING,"acronym package with option%c %s",
                     strHasChar(options,',') ? 's' : ' ',
                     options);
-        for (opt=strtok(acroOptions,",");
+        for (opt=my_strtok(acroOptions,",");
              NULL != opt;
-             opt=strtok(NULL,",")) {
+             opt=my_strtok(NULL,",")) {
             if (streq(opt,"printonlyused")) {
                 acroPrintOnlyUsed = TRUE;
             } else if (streq(opt,"withpage")) {
@@ -136,7 +137,7 @@ void UsePackageAcronym(char *options)
 
 /* TODO: implement longest acronym hint */
 
-static int inAcroEnvironment = FALSE;
+static THREAD_LOCAL int inAcroEnvironment = FALSE;
 void CmdBeginAcronym(int code)
 {
     /*  diagnostics(5,"CmdBeginAcronym(0x%04x) ON = 0x%04x",code,ON); */
@@ -167,31 +168,37 @@ typedef struct _acroEntry {
     int printable;
 } acroEntry;
 
-static acroEntry *acroTable = NULL;
-static int        acroNum = 0;
-int               acroPrintOnlyUsed = FALSE;
-int               acroPrintWithPage = FALSE;
+static THREAD_LOCAL acroEntry *acroTable = NULL;
+static THREAD_LOCAL int        acroNum = 0;
+static THREAD_LOCAL int        acroReserved = 0;
+static THREAD_LOCAL hashTable *acroIndex = NULL;    /* acDef -> position + 1 */
+static THREAD_LOCAL hashStats  acroStats = { "acronyms" };
+THREAD_LOCAL int               acroPrintOnlyUsed = FALSE;
+THREAD_LOCAL int               acroPrintWithPage = FALSE;
 
 /*
  * acronym table handling routines:
  *
  * search an entry in the table...
- * linear search, OK not completely efficient, but portable
+ * the index holds the position of each acronym, not a pointer,
+ * because the table moves when it grows
  *
  */
 static acroEntry *searchEntry(char *acDef)
 {
-    int i;
+    acroEntry *result = NULL;
+    size_t i;
+    double start;
  
     if (acDef != NULL) {
-        for (i = 0; i<acroNum; i++) {
-            if (0 == strcmp(acDef,acroTable[i].acDef)) {
-                return &acroTable[i];
-            }
-        }
+        start = hashStatsStart();
+        i = (size_t) hashFind(acroIndex, acDef);
+        if (i > 0)
+            result = &acroTable[i-1];
+        hashStatsCount(&acroStats, result, start);
         /*      diagnostics(WARNING,"Undefined acronym '%s'",acDef); */
     }
-    return NULL;
+    return result;
 }
 
 
@@ -269,19 +276,26 @@ static char* regularPlural(char *singular)
 static acroEntry *createEntry(char *acDef) {
     acroEntry *result = searchEntry(acDef);
     if (NULL == result) {
-        void *ptr;
-        ptr = (void *) acroTable;
-        ptr = realloc(ptr,(++acroNum)*sizeof(acroEntry));
-        acroTable = (acroEntry *) ptr;
-        if (NULL != acroTable) {
-            result = &acroTable[acroNum-1];
-            result->acDef         = acDef;
-            result->acShort       = NULL;
-            result->acLong        = NULL;
-            result->acShortPlural = NULL;
-            result->acLongPlural  = NULL;
-            result->used          = FALSE;
-            result->printable     = FALSE;
+        if (acroNum == acroReserved) {
+            int reserve = (acroReserved) ? 2 * acroReserved : 16;
+            void *ptr = realloc(acroTable, reserve*sizeof(acroEntry));
+            if (NULL == ptr)
+                return NULL;
+            acroTable = (acroEntry *) ptr;
+            acroReserved = reserve;
+        }
+        result = &acroTable[acroNum++];
+        result->acDef         = acDef;
+        result->acShort       = NULL;
+        result->acLong        = NULL;
+        result->acShortPlural = NULL;
+        result->acLongPlural  = NULL;
+        result->used          = FALSE;
+        result->printable     = FALSE;
+        if (NULL != acDef) {
+            if (NULL == acroIndex)
+                acroIndex = hashNew(64);
+            hashInsert(acroIndex, acDef, (void *) (size_t) acroNum);
         }
     }
     return result;
@@ -525,6 +539,30 @@ void CmdAcResetAll(int code)
         acroTable[i].used = FALSE;
 }
 
+/*  forget all acronyms and package options     */
+/*     before the next document.  The strings   */
+/*     may be shared between entries, so only   */
+/*     the table itself is released.            */
+
+void ResetAcronyms(void)
+{
+    free(acroTable);
+    acroTable = NULL;
+    acroNum = 0;
+    acroReserved = 0;
+    hashFree(acroIndex, NULL);
+    acroIndex = NULL;
+    hashStatsReset(&acroStats);
+    acroPrintOnlyUsed = FALSE;
+    acroPrintWithPage = FALSE;
+    inAcroEnvironment = FALSE;
+}
+
+void ReportAcronymStats(void)
+{
+    hashStatsReport(&acroStats, acroNum);
+}
+
 /*  \acroextra                                  */
 /*    push the contents for further conversion  */
 
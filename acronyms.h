@@ -23,8 +23,8 @@ enum {
     ACRONYM_USED   = 0x400
 };
 
-extern int acroPrintWithPage;
-extern int acroPrintOnlyUsed;
+extern THREAD_LOCAL int acroPrintWithPage;
+extern THREAD_LOCAL int acroPrintOnlyUsed;
 extern char *acronymAux[];
 
 void UsePackageAcronym(char *options);
@@ -33,6 +33,8 @@ void CmdAcrodef(int code);
 void CmdAcroExtra(int code);
 void CmdAc(int code);
 void CmdAcResetAll(int code);
+void ResetAcronyms(void);
+void ReportAcronymStats(void);
 void CmdAcUsed(int code);
 void CmdAC(int code);
 
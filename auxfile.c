@@ -32,6 +32,10 @@
 #include "parser.h"
 #include "convert.h"
 #include "auxfile.h"
+#include "labels.h"
+#include "biblio.h"
+#include "commands.h"
+#include "acronyms.h"
 
 /* List of commands to look for when parsing the aux file */
 /* TODO: put all commands in a CommandArray and create    */
@@ -109,7 +113,23 @@ static void FilterAuxFile(FILE *auxFile) {
     }
 }
 
-static int alreadyLoaded = FALSE;
+static THREAD_LOCAL int alreadyLoaded = FALSE;
+
+void ResetAuxFile(void)
+{
+    /* the next document reads its own .aux file */
+    alreadyLoaded = FALSE;
+    ResetLabels();
+    ResetBiblio();
+    ResetAcronyms();
+}
+
+void ReportAuxStats(void)
+{
+    ReportLabelStats();
+    ReportBiblioStats();
+    ReportAcronymStats();
+}
 
 void LoadAuxFile(void)
 {
@@ -119,6 +139,8 @@ void LoadAuxFile(void)
         return;
     alreadyLoaded = TRUE;
     /* ------------------------ */
+    if (g_aux_name == NULL)     /* LaTeX from stdin or l2r_convert() */
+        return;
     auxFile =  my_fopen(g_aux_name,"rb");
     if (NULL == auxFile) {
         diagnostics(WARNING, "%s not found.  Run LaTeX to create it.",g_aux_name);
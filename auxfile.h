@@ -8,4 +8,6 @@
  */
 
 void LoadAuxFile(void);
+void ResetAuxFile(void);
+void ReportAuxStats(void);
 #endif
@@ -32,6 +32,7 @@ Authors:
 #include "utils.h"
 #include "parser.h"
 #include "auxfile.h"
+#include "hash.h"
 #include "biblio.h"
 
 /*
@@ -39,23 +40,37 @@ Authors:
  * A try at unifying the citation infrastructure
  * *********************************************
  */
-static biblioElem *biblioTable = NULL;
-static int         biblioCount = 0;
+static THREAD_LOCAL biblioElem *biblioTable = NULL;
+static THREAD_LOCAL int         biblioCount = 0;
+static THREAD_LOCAL int         biblioReserved = 0;
+static THREAD_LOCAL hashTable  *biblioIndex = NULL;    /* key -> position + 1 */
+static THREAD_LOCAL hashStats   biblioStats = { "citations" };
 
 static biblioElem *newBiblio(char *newKey)
 {
-    biblioElem *result =
-        (biblioElem *)realloc(biblioTable,
-                              sizeof(biblioElem) * (biblioCount+1));
+    biblioElem *result = biblioTable;
+
+    if (biblioCount == biblioReserved) {
+        int reserve = (biblioReserved) ? 2 * biblioReserved : 16;
+        result = (biblioElem *)realloc(biblioTable, sizeof(biblioElem) * reserve);
+        if (NULL != result) {
+            biblioTable = result;
+            biblioReserved = reserve;
+        }
+    }
     
     if (NULL != result) {
-        biblioTable = result;
-        result = &result[biblioCount++];
+        result = &biblioTable[biblioCount++];
         result->biblioKey  = newKey;
         result->biblioN    = NULL;
         result->biblioFull = NULL;
         result->biblioAbbr = NULL;
         result->biblioYear = NULL;
+
+        /* like the linear search this replaced, the first entry wins */
+        if (NULL == biblioIndex)
+            biblioIndex = hashNew(64);
+        hashAdd(biblioIndex, newKey, (void *) (size_t) biblioCount);
     }
     return result;
 }
@@ -80,14 +95,18 @@ static void printTable(void)
 
 biblioElem *getBiblio(char *key)
 {
-    int i;
+    biblioElem *result = NULL;
+    size_t      i;
+    double      start;
+
     LoadAuxFile();      /* load auxfile if not already loaded */
-    for (i=0; i< biblioCount; i++) {
-        if (streq(biblioTable[i].biblioKey,key)) {
-            return &biblioTable[i];
-        }
-    }
-    return NULL;
+
+    start = hashStatsStart();
+    i = (size_t) hashFind(biblioIndex, key);
+    if (i > 0)
+        result = &biblioTable[i-1];
+    hashStatsCount(&biblioStats, result, start);
+    return result;
 }
 
 /* for normal bibliographic references: */
@@ -156,6 +175,34 @@ biblioElem *newNatBibCite(char *cite,char *full,char* abbr,char *year,char *n)
     return newCite;
 }
 
+/* forget all citations read from the .aux file */
+
+void ResetBiblio(void)
+{
+    int i;
+
+    for (i=0; i< biblioCount; i++) {
+        biblioElem *p = &biblioTable[i];
+        safe_free(p->biblioKey);
+        safe_free(p->biblioN);
+        safe_free(p->biblioFull);
+        safe_free(p->biblioAbbr);
+        safe_free(p->biblioYear);
+    }
+    free(biblioTable);
+    biblioTable = NULL;
+    biblioCount = 0;
+    biblioReserved = 0;
+    hashFree(biblioIndex, NULL);
+    biblioIndex = NULL;
+    hashStatsReset(&biblioStats);
+}
+
+void ReportBiblioStats(void)
+{
+    hashStatsReport(&biblioStats, biblioCount);
+}
+
 /*
  * Interface to the AUX file parser
  */
@@ -22,6 +22,8 @@ biblioElem *newNatBibCite(char *cite,char *full,char* abbr,char *year,char *n);
 
 char *getBiblioRef(char *key);
 char *getBiblioFirst(char *key);
+void ResetBiblio(void);
+void ReportBiblioStats(void);
 void CmdBibCite(int code);
 void CmdAuxHarvardCite(int code);
 #endif
@@ -43,15 +43,26 @@ Authors:
 #include "funct1.h"
 #include "cfg.h"
 #include "utils.h"
+#include "hash.h"
+
+#ifdef UNIX
+#define HAS_CFG_CACHE
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 typedef struct ConfigInfoT {
     char *filename;
     ConfigEntryT **config_info;
     int config_info_size;
     int remove_leading_backslash;
+    char *map;                  /* cache file holding the strings, or NULL */
+    size_t map_length;
 } ConfigInfoT;
 
-static ConfigInfoT configinfo[] = {
+static THREAD_LOCAL ConfigInfoT configinfo[] = {
     {"direct.cfg", NULL, 0, FALSE},
     {"fonts.cfg", NULL, 0, FALSE},
     {"ignore.cfg", NULL, 0, FALSE},
@@ -62,8 +73,28 @@ static ConfigInfoT configinfo[] = {
 #define CONFIG_SIZE 5
 #define BUFFER_INCREMENT 1024
 
+/* every language table read so far, the first one is english.cfg from
+   ReadCfg(); a later document switching language reuses these tables */
+#define MAX_LANGUAGES 32
+
+typedef struct {
+    char *filename;
+    ConfigEntryT **config_info;
+    int config_info_size;
+    char *map;
+    size_t map_length;
+} LanguageInfoT;
+
+static THREAD_LOCAL LanguageInfoT languages[MAX_LANGUAGES];
+static THREAD_LOCAL int n_languages = 0;
+
 char *ReadUptoMatch(FILE * infile, const char *scanchars);
 
+static THREAD_LOCAL char *opened_cfg_name = NULL;    /* full name of the last file open_cfg() found */
+
+static THREAD_LOCAL char *buffer = NULL;    /* line returned by ReadUptoMatch() */
+static THREAD_LOCAL int bufsize = 0;
+
 /****************************************************************************
  * purpose:  compare-function for bsearch
  * params:   el1, el2: Config Entries to be compared
@@ -100,7 +131,11 @@ static FILE *try_path(const char *path, const char *cfg_file)
     diagnostics(2, "trying to open '%s'", both);
 
     fp = fopen(both, "rb");
-    free(both);
+    if (fp) {
+        free(opened_cfg_name);
+        opened_cfg_name = both;
+    } else
+        free(both);
     return fp;
 }
 
@@ -277,6 +312,248 @@ static int read_cfg(FILE * cfgfile, ConfigEntryT *** pointer_array, int do_remov
     return bufindex;
 }
 
+/****************************************************************************
+ * The sorted table built from a .cfg file may be saved in a cache directory,
+ * named by the environment variable RTFCACHE, and mapped back into memory
+ * the next time.  A cache file is used only while the full name, size and
+ * modification time of the .cfg file it was built from are unchanged.
+ *
+ * Layout: cfgCacheHeader, the NUL-terminated name of the .cfg file, one
+ * cfgCacheEntry per entry in sorted order, then the text of the entries.
+ ****************************************************************************/
+
+#define CFG_CACHE_MAGIC "l2rcfg1"
+
+typedef struct {
+    char magic[8];
+    long mtime;
+    long size;
+    long name_length;
+    long entries;
+    long text_length;
+} cfgCacheHeader;
+
+typedef struct {
+    long original_id;
+    long tex;                   /* offsets into the text */
+    long rtf;
+} cfgCacheEntry;
+
+#ifdef HAS_CFG_CACHE
+static char *CfgCacheName(const char *cfg_name)
+
+/****************************************************************************
+ * purpose:  returns the name of the cache file for cfg_name or NULL when
+ *           caching is not enabled
+ ****************************************************************************/
+{
+    char *dir = getenv("RTFCACHE");
+    const char *base = strrchr(cfg_name, PATHSEP);
+    char *name;
+    size_t n;
+
+    if (dir == NULL || *dir == '\0')
+        return NULL;
+
+    base = base ? base + 1 : cfg_name;
+    n = strlen(dir) + strlen(base) + 32;
+    name = (char *) malloc(n);
+    if (name == NULL)
+        return NULL;
+
+    snprintf(name, n, "%s%s%s.%08lx.cache", dir,
+      (dir[strlen(dir) - 1] == PATHSEP) ? "" : "/", base, hashString(cfg_name) & 0xffffffffUL);
+    return name;
+}
+
+static int LoadCfgCache(int which, const char *cfg_name, FILE *cfgfile)
+
+/****************************************************************************
+ * purpose:  fill configinfo[which] from a valid cache of cfg_name
+ * returns:  TRUE on success, FALSE when the file must be read instead
+ ****************************************************************************/
+{
+    struct stat sb;
+    cfgCacheHeader *h;
+    cfgCacheEntry *e;
+    ConfigEntryT *entries, **pointers;
+    char *cache_name, *map, *text;
+    size_t length;
+    long i;
+    FILE *fp;
+
+    cache_name = CfgCacheName(cfg_name);
+    if (cache_name == NULL)
+        return FALSE;
+
+    fp = fopen(cache_name, "rb");
+    if (fp == NULL) {
+        free(cache_name);
+        return FALSE;
+    }
+
+    map = NULL;
+    length = 0;
+    if (fstat(fileno(fp), &sb) == 0 && sb.st_size >= (off_t) sizeof(cfgCacheHeader)) {
+        length = (size_t) sb.st_size;
+        map = (char *) mmap(NULL, length, PROT_READ, MAP_PRIVATE, fileno(fp), 0);
+        if (map == (char *) MAP_FAILED)
+            map = NULL;
+    }
+    fclose(fp);
+    free(cache_name);
+    if (map == NULL)
+        return FALSE;
+
+    /* check that the cache belongs to the .cfg file as it is now, and that
+       a truncated or damaged cache cannot point outside the map */
+    h = (cfgCacheHeader *) map;
+    if (fstat(fileno(cfgfile), &sb) != 0 ||
+      strncmp(h->magic, CFG_CACHE_MAGIC, 8) != 0 ||
+      h->mtime != (long) sb.st_mtime || h->size != (long) sb.st_size ||
+      h->name_length != (long) strlen(cfg_name) ||
+      h->entries < 0 || (size_t) h->entries > length / sizeof(cfgCacheEntry) ||
+      h->text_length < 0 || (size_t) h->text_length > length ||
+      length != sizeof(cfgCacheHeader) + h->name_length + 1 + h->entries * sizeof(cfgCacheEntry) + h->text_length ||
+      strcmp(map + sizeof(cfgCacheHeader), cfg_name) != 0) {
+        munmap(map, length);
+        return FALSE;
+    }
+
+    e = (cfgCacheEntry *) (map + sizeof(cfgCacheHeader) + h->name_length + 1);
+    text = (char *) (e + h->entries);
+
+    /* every string then ends inside the text */
+    if (h->entries > 0 && text[h->text_length - 1] != '\0') {
+        munmap(map, length);
+        return FALSE;
+    }
+    for (i = 0; i < h->entries; i++) {
+        if (e[i].tex < 0 || e[i].tex >= h->text_length || e[i].rtf < 0 || e[i].rtf >= h->text_length) {
+            munmap(map, length);
+            return FALSE;
+        }
+    }
+
+    /* malloc'ed like the arrays built by read_cfg() */
+    entries = (ConfigEntryT *) malloc((h->entries + 1) * sizeof(ConfigEntryT));
+    pointers = (ConfigEntryT **) malloc((h->entries + 1) * sizeof(ConfigEntryT *));
+    if (entries == NULL || pointers == NULL)
+        diagnostics(ERROR, "Cannot allocate memory for pointer list");
+
+    for (i = 0; i < h->entries; i++) {
+        entries[i].TexCommand = text + e[i].tex;
+        entries[i].RtfCommand = text + e[i].rtf;
+        entries[i].original_id = (int) e[i].original_id;
+        pointers[i] = &entries[i];
+    }
+
+    pointers[0] = entries;      /* even for an empty table, so FreeCfg() finds it */
+    configinfo[which].config_info = pointers;
+    configinfo[which].config_info_size = (int) h->entries;
+    configinfo[which].map = map;
+    configinfo[which].map_length = length;
+    diagnostics(3, "using cached table for %s", cfg_name);
+    return TRUE;
+}
+
+static void SaveCfgCache(int which, const char *cfg_name, FILE *cfgfile)
+
+/****************************************************************************
+ * purpose:  write the table just read from cfg_name to its cache file.
+ *           The file is written under a temporary name and then renamed
+ *           so that other processes never see half a cache.
+ ****************************************************************************/
+{
+    struct stat sb;
+    cfgCacheHeader h;
+    cfgCacheEntry e;
+    ConfigEntryT **p = configinfo[which].config_info;
+    char *cache_name, *tmp_name;
+    long i, offset;
+    FILE *fp;
+
+    cache_name = CfgCacheName(cfg_name);
+    if (cache_name == NULL || fstat(fileno(cfgfile), &sb) != 0) {
+        free(cache_name);
+        return;
+    }
+
+    tmp_name = (char *) malloc(strlen(cache_name) + 48);
+    if (tmp_name == NULL) {
+        free(cache_name);
+        return;
+    }
+    /* configinfo is per thread, its address tells the threads apart */
+    sprintf(tmp_name, "%s.%ld.%lx", cache_name, (long) getpid(), (unsigned long) configinfo);
+
+    memset(&h, 0, sizeof(h));
+    strncpy(h.magic, CFG_CACHE_MAGIC, 8);
+    h.mtime = (long) sb.st_mtime;
+    h.size = (long) sb.st_size;
+    h.name_length = (long) strlen(cfg_name);
+    h.entries = configinfo[which].config_info_size;
+    h.text_length = 0;
+    for (i = 0; i < h.entries; i++)
+        h.text_length += strlen(p[i]->TexCommand) + strlen(p[i]->RtfCommand) + 2;
+
+    fp = fopen(tmp_name, "wb");
+    if (fp) {
+        fwrite(&h, sizeof(h), 1, fp);
+        fwrite(cfg_name, h.name_length + 1, 1, fp);
+
+        offset = 0;
+        for (i = 0; i < h.entries; i++) {
+            e.original_id = p[i]->original_id;
+            e.tex = offset;
+            offset += strlen(p[i]->TexCommand) + 1;
+            e.rtf = offset;
+            offset += strlen(p[i]->RtfCommand) + 1;
+            fwrite(&e, sizeof(e), 1, fp);
+        }
+
+        for (i = 0; i < h.entries; i++) {
+            fwrite(p[i]->TexCommand, strlen(p[i]->TexCommand) + 1, 1, fp);
+            fwrite(p[i]->RtfCommand, strlen(p[i]->RtfCommand) + 1, 1, fp);
+        }
+
+        if (fclose(fp) == 0 && rename(tmp_name, cache_name) == 0)
+            diagnostics(3, "saved cached table for %s in %s", cfg_name, cache_name);
+        else {
+            diagnostics(WARNING, "Could not write cache file '%s'", cache_name);
+            remove(tmp_name);
+        }
+    }
+
+    free(tmp_name);
+    free(cache_name);
+}
+#endif
+
+static void LoadCfg(int which, FILE *fp)
+
+/****************************************************************************
+ * purpose: fill configinfo[which] from the opened .cfg file, going through
+ *          the cache when RTFCACHE is set
+ ****************************************************************************/
+{
+    configinfo[which].map = NULL;
+    configinfo[which].map_length = 0;
+
+#ifdef HAS_CFG_CACHE
+    if (opened_cfg_name && LoadCfgCache(which, opened_cfg_name, fp))
+        return;
+#endif
+
+    configinfo[which].config_info_size = read_cfg(fp, &(configinfo[which].config_info),
+      configinfo[which].remove_leading_backslash);
+
+#ifdef HAS_CFG_CACHE
+    if (opened_cfg_name)
+        SaveCfgCache(which, opened_cfg_name, fp);
+#endif
+}
+
 void ReadCfg(void)
 
 /****************************************************************************
@@ -292,13 +569,81 @@ void ReadCfg(void)
         fname = configinfo[i].filename;
         fp = (FILE *) open_cfg(fname, TRUE);
 
-        configinfo[i].config_info_size = read_cfg(fp, &(configinfo[i].config_info)
-          , configinfo[i].remove_leading_backslash);
+        LoadCfg(i, fp);
         (void) fclose(fp);
         
          diagnostics(2, "read %d entries for file %s", configinfo[i].config_info_size, fname);
        
     }
+
+    languages[0].filename = configinfo[LANGUAGE_A].filename;
+    languages[0].config_info = configinfo[LANGUAGE_A].config_info;
+    languages[0].config_info_size = configinfo[LANGUAGE_A].config_info_size;
+    languages[0].map = configinfo[LANGUAGE_A].map;
+    languages[0].map_length = configinfo[LANGUAGE_A].map_length;
+    n_languages = 1;
+}
+
+static void FreeCfgTable(ConfigEntryT **table, int size, char *map, size_t map_length)
+
+/****************************************************************************
+ * purpose: release a table built by read_cfg() or LoadCfgCache()
+ ****************************************************************************/
+{
+    int i;
+
+    if (table == NULL)
+        return;
+
+    if (map) {
+        free(table[0]);         /* all the entries, their strings are in the map */
+#ifdef HAS_CFG_CACHE
+        munmap(map, map_length);
+#endif
+    } else {
+        for (i = 0; i < size; i++) {
+            free((char *) table[i]->TexCommand);    /* RtfCommand is part of it */
+            free(table[i]);
+        }
+    }
+    free(table);
+}
+
+void FreeCfg(void)
+
+/****************************************************************************
+ * purpose: release the tables read by ReadCfg() and ReadLanguage(), after
+ *          which ReadCfg() has to be called again
+ ****************************************************************************/
+{
+    int i, j;
+
+    for (i = 0; i < CONFIG_SIZE; i++) {
+        /* the language table is usually one of languages[] as well */
+        for (j = 0; i == LANGUAGE_A && j < n_languages; j++)
+            if (languages[j].config_info == configinfo[i].config_info)
+                break;
+        if (i != LANGUAGE_A || j == n_languages)
+            FreeCfgTable(configinfo[i].config_info, configinfo[i].config_info_size,
+                         configinfo[i].map, configinfo[i].map_length);
+        configinfo[i].config_info = NULL;
+        configinfo[i].config_info_size = 0;
+        configinfo[i].map = NULL;
+    }
+
+    for (i = 0; i < n_languages; i++) {
+        FreeCfgTable(languages[i].config_info, languages[i].config_info_size,
+                     languages[i].map, languages[i].map_length);
+        if (i > 0)
+            free(languages[i].filename);
+    }
+    n_languages = 0;
+
+    safe_free(opened_cfg_name);
+    opened_cfg_name = NULL;
+    safe_free(buffer);
+    buffer = NULL;
+    bufsize = 0;
 }
 
 ConfigEntryT **SearchCfgEntry(const char *theTexCommand, int WhichCfg)
@@ -427,18 +772,54 @@ void ReadLanguage(char *lang)
 {
     FILE *fp;
     char *langfn;
+    int i;
 
 	if (lang == NULL) return;
     langfn = strdup_together(lang, ".cfg");
 
-    fp = (FILE *) open_cfg(langfn, TRUE);
-    free(langfn);
-    if (fp == NULL) return;
+    for (i = 0; i < n_languages; i++) {
+        if (strcmp(languages[i].filename, langfn) == 0) {
+            configinfo[LANGUAGE_A].config_info = languages[i].config_info;
+            configinfo[LANGUAGE_A].config_info_size = languages[i].config_info_size;
+            configinfo[LANGUAGE_A].map = languages[i].map;
+            configinfo[LANGUAGE_A].map_length = languages[i].map_length;
+            free(langfn);
+            return;
+        }
+    }
 
-    configinfo[LANGUAGE_A].config_info_size
-      = read_cfg(fp, &(configinfo[LANGUAGE_A].config_info), configinfo[LANGUAGE_A].remove_leading_backslash);
+    fp = (FILE *) open_cfg(langfn, TRUE);
+    if (fp == NULL) {
+        free(langfn);
+        return;
+    }
 
+    configinfo[LANGUAGE_A].config_info = NULL;
+    LoadCfg(LANGUAGE_A, fp);
     (void) fclose(fp);
+
+    if (n_languages < MAX_LANGUAGES) {
+        languages[n_languages].filename = langfn;
+        languages[n_languages].config_info = configinfo[LANGUAGE_A].config_info;
+        languages[n_languages].config_info_size = configinfo[LANGUAGE_A].config_info_size;
+        languages[n_languages].map = configinfo[LANGUAGE_A].map;
+        languages[n_languages].map_length = configinfo[LANGUAGE_A].map_length;
+        n_languages++;
+    } else
+        free(langfn);
+}
+
+/****************************************************************************
+ purpose : go back to the english names read by ReadCfg()
+ ****************************************************************************/
+void ResetLanguage(void)
+{
+    if (n_languages == 0)
+        return;
+    configinfo[LANGUAGE_A].config_info = languages[0].config_info;
+    configinfo[LANGUAGE_A].config_info_size = languages[0].config_info_size;
+    configinfo[LANGUAGE_A].map = languages[0].map;
+    configinfo[LANGUAGE_A].map_length = languages[0].map_length;
 }
 
 /****************************************************************************
@@ -463,9 +844,6 @@ char *GetBabelName(char *name)
 }
 
 
-static char *buffer = NULL;
-static int bufsize = 0;
-
 #define CR (char) 0x0d
 #define LF (char) 0x0a
 
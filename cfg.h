@@ -32,10 +32,12 @@ typedef struct ConfigEntryT
 } ConfigEntryT;
 
 void ReadLanguage(char *lang);
+void ResetLanguage(void);
 void ConvertBabelName(char *name);
 char *GetBabelName(char *name);
 
 void            ReadCfg (void);
+void            FreeCfg (void);
 ConfigEntryT  **SearchCfgEntry(const char *theTexCommand, int WhichCfg);
 char           *SearchCfgRtf(const char *theCommand, int WhichArray);
 ConfigEntryT  **SearchCfgEntryByID(const int id, int WhichCfg);
@@ -64,6 +64,14 @@ void CmdUnicodeChar(int code)
     if (getTexMode() == MODE_VERTICAL)
         changeTexMode(MODE_HORIZONTAL);
     
+    /* \uN is limited to 16 bits, larger code points need a surrogate pair */
+    if (code > 0xFFFF && code <= 0x10FFFF) {
+        code -= 0x10000;
+        CmdUnicodeChar(0xD800 + (code >> 10));
+        CmdUnicodeChar(0xDC00 + (code & 0x3FF));
+        return;
+    }
+
     thechar = code;
     a = thechar >> 8;
     b = thechar - a * 256;
@@ -0,0 +1,29 @@
+/* cli.c - the latex2rtf command
+
+Copyright (C) 2014 The Free Software Foundation
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+This file is available from http://sourceforge.net/projects/latex2rtf/
+
+    Everything but main() is in libl2r, see latex2rtf.h
+*/
+
+#include "latex2rtf.h"
+
+int main(int argc, char **argv)
+{
+    return l2r_main(argc, argv);
+}
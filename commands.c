@@ -49,13 +49,15 @@ Authors:
 #include "labels.h"
 #include "acronyms.h"
 #include "biblio.h"
+#include "hash.h"
 
-static int iEnvCount = 0;               /* number of current environments */
-static CommandArray *Environments[100]; /* call chain for current environments */
-static int g_par_indent_array[100];
-static int g_left_indent_array[100];
-static int g_right_indent_array[100];
-static char g_align_array[100];
+static THREAD_LOCAL int iEnvCount = 0;               /* number of current environments */
+static THREAD_LOCAL CommandArray *Environments[100]; /* call chain for current environments */
+static THREAD_LOCAL hashTable *EnvIndex[100];        /* command index for each environment */
+static THREAD_LOCAL int g_par_indent_array[100];
+static THREAD_LOCAL int g_left_indent_array[100];
+static THREAD_LOCAL int g_right_indent_array[100];
+static THREAD_LOCAL char g_align_array[100];
 
 static CommandArray commands[] = {
     {"begin", CmdBeginEnd, CMD_BEGIN},
@@ -1121,56 +1123,193 @@ static void WriteEnvironmentStack(void)
 }
 #endif
 
-int CallCommandFunc(char *cCommand)
+static THREAD_LOCAL struct {
+    CommandArray *code;
+    hashTable *index;
+} known[50];
+static THREAD_LOCAL int n_known = 0;
+
+/****************************************************************************
+purpose: returns the hash index for a CommandArray.  The index is built
+         the first time an array is pushed and kept for the whole run.
+         Only the first entry of a duplicated command name is indexed so
+         that lookups find the same entry that a linear scan would.
+ ****************************************************************************/
+static hashTable *CommandIndex(CommandArray *code)
+{
+    int i, n;
+
+    for (i = 0; i < n_known; i++) {
+        if (known[i].code == code)
+            return known[i].index;
+    }
+
+    if (n_known == 50)
+        diagnostics(ERROR, "too many command tables in CommandIndex");
+
+    for (n = 0; strcmp(code[n].cmd_name, "") != 0; n++);
+
+    known[n_known].code = code;
+    known[n_known].index = hashNew(2 * n);
+    for (i = 0; i < n; i++)
+        hashAdd(known[n_known].index, code[i].cmd_name, &code[i]);
+
+    diagnostics(5, "CommandIndex built for %d commands", n);
+    return known[n_known++].index;
+}
+
+static THREAD_LOCAL hashTable *ResolveCache = NULL;  /* command name -> ResolvedCommand */
+static THREAD_LOCAL int ResolveGeneration = 1;
+
+void InvalidateCommandCache(void)
+
+/****************************************************************************
+purpose: forget all cached command resolutions.  Must be called whenever
+         an environment is pushed or popped or when a macro or \newif
+         condition is defined because any of these can change which
+         tier handles a command name.
+ ****************************************************************************/
+{
+    ResolveGeneration++;
+}
+
+void FreeCommandIndexes(void)
+
+/****************************************************************************
+purpose: release the command indexes and the resolution cache of this
+         thread; both are rebuilt on demand
+ ****************************************************************************/
+{
+    int i;
+
+    for (i = 0; i < n_known; i++)
+        hashFree(known[i].index, NULL);
+    n_known = 0;
+
+    hashFree(ResolveCache, free);
+    ResolveCache = NULL;
+}
+
+static void ResolveUncached(char *cCommand, ResolvedCommand *r)
+
+/****************************************************************************
+purpose: walk the lookup chain used by TranslateCommand without calling
+         anything: user macros, the CommandArrays of the active environments
+         (innermost first), direct.cfg, ignore.cfg and \newif conditions.
+ ****************************************************************************/
+{
+    char TexCommand[MAXCOMMANDLEN + 1];
+    int iEnv;
+    CommandArray *cmd;
+
+    r->tier = TIER_UNKNOWN;
+    r->definition = -1;
+    r->env = -1;
+    r->cmd = NULL;
+    r->rtf = NULL;
+
+    r->definition = existsDefinition(cCommand);
+    if (r->definition > -1) {
+        r->tier = TIER_MACRO;
+        return;
+    }
+
+    /* search backwards through chain of environments*/
+    for (iEnv = iEnvCount - 1; iEnv >= 0; iEnv--) {
+        cmd = (CommandArray *) hashFind(EnvIndex[iEnv], cCommand);
+        if (cmd == NULL)
+            continue;
+
+        /* a NULL function hides the command from the remaining tables */
+        if (cmd->func != NULL) {
+            r->tier = TIER_TABLE;
+            r->env = iEnv;
+            r->cmd = cmd;
+            return;
+        }
+        break;
+    }
+
+    snprintf(TexCommand, MAXCOMMANDLEN + 1, "\\%s", cCommand);
+
+    r->rtf = SearchCfgRtf(TexCommand, DIRECT_A);
+    if (r->rtf) {
+        r->tier = TIER_DIRECT;
+        return;
+    }
+
+    r->rtf = SearchCfgRtf(TexCommand, IGNORE_A);
+    if (r->rtf) {
+        r->tier = TIER_IGNORE;
+        return;
+    }
+
+    if (existsCondition(cCommand))
+        r->tier = TIER_CONDITION;
+}
+
+ResolvedCommand *ResolveCommand(char *cCommand)
+
+/****************************************************************************
+purpose: find out which tier of the lookup chain handles cCommand.
+         Results are cached by name so that a repeated command costs
+         a single hash lookup and no allocation.
+ ****************************************************************************/
+{
+    ResolvedCommand *r;
+
+    if (ResolveCache == NULL)
+        ResolveCache = hashNew(512);
+
+    r = (ResolvedCommand *) hashFind(ResolveCache, cCommand);
+    if (r == NULL) {
+        r = (ResolvedCommand *) malloc(sizeof(ResolvedCommand));
+        if (r == NULL)
+            diagnostics(ERROR, "Cannot allocate resolution for '\\%s'", cCommand);
+        r->generation = 0;
+        hashInsert(ResolveCache, cCommand, r);
+    }
+
+    if (r->generation != ResolveGeneration) {
+        ResolveUncached(cCommand, r);
+        r->generation = ResolveGeneration;
+    }
+
+    return r;
+}
+
+int CallCommandFunc(char *cCommand, ResolvedCommand *r)
 
 /****************************************************************************
 purpose: Tries to call the command-function for the commandname
-params:  string with command name
+params:  cCommand - string with command name
+         r - the resolution of cCommand as returned by ResolveCommand
 returns: success or failure
 globals: command-functions have side effects or recursive calls
  ****************************************************************************/
 {
-    int iCommand, iEnv,user_def_index;
     char *macro_string;
+    CommandArray *cmd = r->cmd;
 
     diagnostics(4, "CallCommandFunc seeking <%s> (%d environments to look through)", cCommand, iEnvCount);
 
-    user_def_index = existsDefinition(cCommand);
-    if (user_def_index > -1) {
-        macro_string = expandDefinition(user_def_index);
+    if (r->tier == TIER_MACRO) {
+        macro_string = expandDefinition(r->definition);
         diagnostics(5, "CallCommandFunc <%s> expanded to <%s>", cCommand, macro_string);
-        ConvertString(macro_string);
-        free(macro_string);
+        ConvertOwnedString(macro_string);
         return TRUE;
     }
 
-    /* search backwards through chain of environments*/
-    for (iEnv = iEnvCount - 1; iEnv >= 0; iEnv--) {
-    
-        /* test every command in the current enviroment */
-        iCommand = 0;
-        while (strcmp(Environments[iEnv][iCommand].cmd_name, "") != 0) {
-
-            /*
-            if (iCommand<3)
-                diagnostics(1,"CallCommandFunc (%d,%3d) Trying %s",iEnv,iCommand,Environments[iEnv][iCommand].cmd_name);
-            */
-        
-            if (strcmp(Environments[iEnv][iCommand].cmd_name, cCommand) == 0) {
-                if (Environments[iEnv][iCommand].func == NULL)
-                    return FALSE;
-                if (*Environments[iEnv][iCommand].func == CmdIgnoreParameter) {
-                    diagnostics(2, "Unknown command '\\%s'", cCommand);
-                }
-
-                diagnostics(5, "CallCommandFunc Found '%s' iEnvCommand=%d number=%d", Environments[iEnv][iCommand].cmd_name, iEnv, iCommand);
-                (*Environments[iEnv][iCommand].func) ((Environments[iEnv][iCommand].param));
-                return TRUE;    /* Command Function found */
-            }
-            ++iCommand;
-        }
+    if (r->tier != TIER_TABLE)
+        return FALSE;
+
+    if (*cmd->func == CmdIgnoreParameter) {
+        diagnostics(2, "Unknown command '\\%s'", cCommand);
     }
-    return FALSE;
+
+    diagnostics(5, "CallCommandFunc Found '%s' iEnvCommand=%d number=%d", cmd->cmd_name, r->env, (int) (cmd - Environments[r->env]));
+    (*cmd->func) (cmd->param);
+    return TRUE;    /* Command Function found */
 }
 
 
@@ -1319,7 +1458,9 @@ globals: changes Environment - array of active environments
             diagnostics(ERROR, "assertion failed at function PushEnvironment");
     }
      
+    EnvIndex[iEnvCount] = CommandIndex(Environments[iEnvCount]);
     iEnvCount++;
+    InvalidateCommandCache();
     diag = EnvironmentNameByNumber(iEnvCount-1);
     diagnostics(4, "\\begin{%s} [%d]", diag, iEnvCount-1);
     free(diag);
@@ -1327,6 +1468,20 @@ globals: changes Environment - array of active environments
 /*    WriteEnvironmentStack();*/
 }
 
+/****************************************************************************
+purpose: removes all environments without restoring any settings, used
+         before the next document is converted
+ ****************************************************************************/
+void ResetEnvironments(void)
+{
+    while (iEnvCount > 0) {
+        --iEnvCount;
+        Environments[iEnvCount] = NULL;
+        EnvIndex[iEnvCount] = NULL;
+    }
+    InvalidateCommandCache();
+}
+
 /****************************************************************************
 purpose: removes the environment-commands list added by last PushEnvironment;
 globals: changes Environment - array of active environments
@@ -1342,6 +1497,8 @@ void PopEnvironment(void)
     /* always pop the current environment */
     --iEnvCount;
     Environments[iEnvCount] = NULL;
+    EnvIndex[iEnvCount] = NULL;
+    InvalidateCommandCache();
     
     setLength("parindent", g_par_indent_array[iEnvCount]);
     setLeftMarginIndent(g_left_indent_array[iEnvCount]);
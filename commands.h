@@ -34,7 +34,7 @@
 
 void PushEnvironment(int code);
 void PopEnvironment(void);
-int CallCommandFunc(char *cCommand);
+void ResetEnvironments(void);
 void CallParamFunc(char *cCommand, int AddParam);
 int  CurrentEnvironmentCount(void);
 
@@ -50,4 +50,26 @@ typedef struct commandtag {
     int param;                  /* used in various ways */
 } CommandArray;
 
+/* which part of TranslateCommand's lookup chain handles a command */
+#define TIER_UNKNOWN    0
+#define TIER_MACRO      1       /* \newcommand and friends */
+#define TIER_TABLE      2       /* CommandArray of an active environment */
+#define TIER_DIRECT     3       /* direct.cfg */
+#define TIER_IGNORE     4       /* ignore.cfg */
+#define TIER_CONDITION  5       /* \newif conditions */
+
+typedef struct {
+    int generation;             /* stale when != current cache generation */
+    int tier;
+    int definition;             /* index of macro for TIER_MACRO */
+    int env;                    /* environment level for TIER_TABLE */
+    CommandArray *cmd;          /* entry for TIER_TABLE */
+    char *rtf;                  /* cfg entry for TIER_DIRECT and TIER_IGNORE */
+} ResolvedCommand;
+
+ResolvedCommand *ResolveCommand(char *cCommand);
+int  CallCommandFunc(char *cCommand, ResolvedCommand *r);
+void InvalidateCommandCache(void);
+void FreeCommandIndexes(void);
+
 #endif
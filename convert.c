@@ -44,7 +44,7 @@ This file is available from http://sourceforge.net/projects/latex2rtf/
 #include "vertical.h"
 #include "fields.h"
 
-static int ret = 0;
+static THREAD_LOCAL int ret = 0;
 
 static void TranslateCommand(void);
 
@@ -70,6 +70,26 @@ void ConvertString(const char *string)
     }
 }
 
+void ConvertOwnedString(char *string)
+
+/******************************************************************************
+     purpose : like ConvertString() for a malloc'ed string, which is converted
+               without being copied and is freed afterwards
+ ******************************************************************************/
+{
+    if (string == NULL)
+        return;
+
+    PushOwnedSource(string);
+    diagnostics(5, "Entering Convert() from ConvertOwnedString()");
+
+    while (StillSource())
+        Convert();
+
+    PopSource();
+    diagnostics(5, "Exiting Convert() from ConvertOwnedString()");
+}
+
 void ConvertAllttString(char *s)
 
 /******************************************************************************
@@ -142,37 +162,11 @@ purpose: converts inputfile and writes result to outputfile
             diagnostics(6, "Current character is '%c' mode = %d ret = %d level = %d", cThis, getTexMode(), ret,
               RecursionLevel);
 
-        /* preliminary support for utf8 sequences.  Thanks to CSH */
-        if ((cThis & 0x8000) && (CurrentFontEncoding() == ENCODING_UTF8)) {
-            uint8_t byte;
-            uint16_t len, value, i;
-
-            /* Get the number of bytes in the sequence        */
-            /* Must use an unsigned character for comparisons */
-            byte = cThis;
-            len = 0;
-            value = 0;
-            if (byte >= 0xF0) { 
-                len = 3; 
-                value = byte & ~0xF0; 
-            } 
-            else if (byte >= 0xE0) { 
-                len = 2; 
-                value = byte & ~0xE0; 
-            }       
-            else if (byte >= 0xC0) { 
-                len = 1; 
-                value = byte & ~0xC0; 
-            }
-            
-            /* reassemble the character */
-            for ( i=0; i<len; i++) {
-                byte = getTexChar() & ~0xC0;
-                value = (value << 6) + byte;
-            }
-            
-            diagnostics(4,"(flag = 0x%X) char value = 0X%04X or %u (%u bytes)", (unsigned char) cThis, value, value, len);
-            CmdUnicodeChar(value);
+        if ((unsigned char) cThis >= 0x80 && CurrentFontEncoding() == ENCODING_UTF8) {
+            long code = getUtf8Char((unsigned char) cThis);
+
+            diagnostics(4, "UTF-8 character U+%04lX", code);
+            CmdUnicodeChar((int) code);
         }                       
         else
 
@@ -515,9 +509,19 @@ purpose: converts inputfile and writes result to outputfile
                     if (getTexMode()==MODE_VERTICAL) 
                         changeTexMode(MODE_HORIZONTAL);
                         
-                    if (CurrentFontEncoding() != ENCODING_OT2)
-                        fprintRTF("%c", cThis);
-                    else
+                    if (CurrentFontEncoding() != ENCODING_OT2) {
+                        /* copy the rest of an ordinary word in one go */
+                        char word[256];
+
+                        word[0] = cThis;
+                        count = getPlainTexRun(word + 1, 254);
+                        word[count + 1] = '\0';
+                        putRtfStr(word);
+                        if (count > 0) {
+                            cThis = word[count];
+                            g_tab_counter += count;
+                        }
+                    } else
                         CmdOT2Transliteration(cThis);
                 }
                 break;
@@ -541,6 +545,7 @@ returns: success or not
     char cCommand[MAXCOMMANDLEN];
     int i, mode, height;
     int cThis,cNext;
+    ResolvedCommand *r;
 
     cThis = getTexChar();
     mode = getTexMode();
@@ -809,7 +814,9 @@ returns: success or not
         PushBrace();
     }
 
-    if (CallCommandFunc(cCommand)) {    /* call handling function for command */
+    r = ResolveCommand(cCommand);
+
+    if (CallCommandFunc(cCommand, r)) {    /* call handling function for command */
         if (strcmp(cCommand, "end") == 0) {
             diagnostics(4, "before PopBrace()");
             ret = RecursionLevel - PopBrace();
@@ -819,14 +826,18 @@ returns: success or not
         return;
     }
 
-    if (TryDirectConvert(cCommand))
-        return;
-
-    if (TryVariableIgnore(cCommand))
-        return;
-
-    if (TryConditionSet(cCommand))
-        return;
+    switch (r->tier) {
+        case TIER_DIRECT:
+            DirectConvert(cCommand, r->rtf);
+            return;
+        case TIER_IGNORE:
+            VariableIgnore(cCommand, r->rtf);
+            return;
+        case TIER_CONDITION:
+            if (TryConditionSet(cCommand))
+                return;
+            break;
+    }
 
     diagnostics(WARNING, "Unknown command '\\%s'", cCommand);
 }
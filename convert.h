@@ -1,4 +1,5 @@
 void ConvertString(const char *string);
+void ConvertOwnedString(char *string);
 void ConvertAllttString(char *s);
 void Convert(void);
 
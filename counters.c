@@ -33,9 +33,9 @@ typedef struct {
     int number;
 } counter_type;
 
-counter_type Counters[MAX_COUNTERS];
+THREAD_LOCAL counter_type Counters[MAX_COUNTERS];
 
-static int iCounterCount = 0;
+static THREAD_LOCAL int iCounterCount = 0;
 
 static int existsCounter(char *s)
 
@@ -139,3 +139,91 @@ void zeroKeyCounters(char *key)
             Counters[i].number = 0;
     }
 }
+
+void resetCounters(void)
+
+/**************************************************************************
+     purpose: removes all counters
+**************************************************************************/
+{
+    int i;
+
+    for (i = 0; i < iCounterCount; i++)
+        free(Counters[i].name);
+    iCounterCount = 0;
+}
+
+char *saveCounters(void)
+
+/**************************************************************************
+     purpose: returns all counters as "value name" lines in the order
+              they were created, suitable for restoreCounters()
+**************************************************************************/
+{
+    int i;
+    size_t n = 1;
+    char *s, *t;
+
+    for (i = 0; i < iCounterCount; i++)
+        n += strlen(Counters[i].name) + 16;
+
+    s = (char *) malloc(n);
+    if (s == NULL)
+        diagnostics(ERROR, "Cannot allocate memory to save counters");
+
+    t = s;
+    *t = '\0';
+    for (i = 0; i < iCounterCount; i++) {
+        sprintf(t, "%d %s\n", Counters[i].number, Counters[i].name);
+        t += strlen(t);
+    }
+    return s;
+}
+
+void restoreCounters(char *s)
+
+/**************************************************************************
+     purpose: replaces all counters by those returned from saveCounters()
+**************************************************************************/
+{
+    int n;
+    char *eol;
+
+    resetCounters();
+
+    while (s && *s) {
+        eol = strchr(s, '\n');
+        if (eol == NULL)
+            break;
+        *eol = '\0';
+        n = atoi(s);
+        s = strchr(s, ' ');
+        if (s)
+            newCounter(s + 1, n);
+        *eol = '\n';
+        s = eol + 1;
+    }
+}
+
+void mergeCounters(char *s)
+
+/**************************************************************************
+     purpose: adds the counters from saveCounters() that do not exist yet
+**************************************************************************/
+{
+    int n;
+    char *eol, *name;
+
+    while (s && *s) {
+        eol = strchr(s, '\n');
+        if (eol == NULL)
+            break;
+        *eol = '\0';
+        n = atoi(s);
+        name = strchr(s, ' ');
+        if (name && existsCounter(name + 1) < 0)
+            newCounter(name + 1, n);
+        *eol = '\n';
+        s = eol + 1;
+    }
+}
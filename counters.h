@@ -2,4 +2,7 @@ void setCounter(char * s, int d);
 int getCounter(char * s);
 void incrementCounter(char * s);
 void zeroKeyCounters(char *key);
-
+void resetCounters(void);
+char *saveCounters(void);
+void restoreCounters(char *s);
+void mergeCounters(char *s);
@@ -32,19 +32,34 @@ This file is available from http://sourceforge.net/projects/latex2rtf/
 #include "cfg.h"
 #include "counters.h"
 #include "funct1.h"
+#include "commands.h"
+#include "preparse.h"
+#include "hash.h"
 
 #define MAX_DEFINITIONS 2000
 #define MAX_ENVIRONMENTS 200
 #define MAX_THEOREMS 200
 
+typedef struct {
+    int length;             /* characters of literal text in the piece */
+    int param;              /* followed by this argument, ## or nothing */
+} macroPiece;
+
+typedef struct {
+    char *text;             /* literal text of all the pieces, in order */
+    int pieces;
+    macroPiece *piece;
+} macroBody;
+
 typedef struct {
     char *name;
     char *opt_param;
     char *def;
+    macroBody *body;        /* def, compiled by compileMacro() */
     int params;
 } definition_type;
 
-definition_type Definitions[MAX_DEFINITIONS];
+THREAD_LOCAL definition_type Definitions[MAX_DEFINITIONS];
 
 typedef struct {
     char *name;
@@ -53,10 +68,11 @@ typedef struct {
     char *endname;
     char *begdef;
     char *enddef;
+    macroBody *begbody;
     int params;
 } environment_type;
 
-environment_type NewEnvironments[MAX_ENVIRONMENTS];
+THREAD_LOCAL environment_type NewEnvironments[MAX_ENVIRONMENTS];
 
 typedef struct {
     char *name;
@@ -65,11 +81,17 @@ typedef struct {
     char *within;
 } theorem_type;
 
-theorem_type NewTheorems[MAX_THEOREMS];
+THREAD_LOCAL theorem_type NewTheorems[MAX_THEOREMS];
+
+static THREAD_LOCAL int iDefinitionCount = 0;
+static THREAD_LOCAL int iDefinitionChanges = 0;
+static THREAD_LOCAL int iNewEnvironmentCount = 0;
+static THREAD_LOCAL int iNewTheoremCount = 0;
 
-static int iDefinitionCount = 0;
-static int iNewEnvironmentCount = 0;
-static int iNewTheoremCount = 0;
+/* name -> entry of the arrays above, only the first entry for a name is indexed */
+static THREAD_LOCAL hashTable *DefinitionIndex = NULL;
+static THREAD_LOCAL hashTable *EnvironmentIndex = NULL;
+static THREAD_LOCAL hashTable *TheoremIndex = NULL;
 
 static int strequal(char *a, char *b)
 {
@@ -113,18 +135,156 @@ int i=0;
 }
 */
 
-#define POUND_POUND 9997
+#define NO_PARAM    -1       /* # followed by a character below '1' is dropped */
+#define POUND_POUND 9997     /* ## stands for a single # */
+#define BAD_PARAM   9998     /* #n with n larger than the number of parameters */
+
+static macroBody *compileMacro(const char *macro, int params)
+
+/**************************************************************************
+     purpose: splits a macro body into literal pieces, each followed by a
+              parameter slot, so that expandmacro() need not parse it again.
+              \csname and \endcsname are removed here once and for all.
+              Bodies of macros without parameters are kept as they are.
+**************************************************************************/
+{
+    macroBody *m;
+    macroPiece *p;
+    char *cs, *r, *w;
+    int n;
+
+    m = (macroBody *) malloc(sizeof(macroBody));
+    if (m == NULL || (m->text = strdup(macro)) == NULL)
+        diagnostics(ERROR, "Cannot allocate memory for macro <%s>", macro);
+
+    if (params > 0) {
+        /* convert "\csname " but leave inital backslash */
+        while ((cs = strstr(m->text, "\\csname ")) != NULL)
+            my_strcpy(cs+1, cs + strlen("\\csname "));
+        while ((cs = strstr(m->text, "\\csname")) != NULL)
+            my_strcpy(cs+1, cs + strlen("\\csname"));
+
+        /* remove "\endcsname" */
+        while ((cs = strstr(m->text, "\\endcsname ")) != NULL)
+            my_strcpy(cs, cs + strlen("\\endcsname "));
+        while ((cs = strstr(m->text, "\\endcsname")) != NULL)
+            my_strcpy(cs, cs + strlen("\\endcsname"));
+    }
+
+    n = 1;
+    for (r = m->text; params > 0 && *r; r++)
+        if (*r == '#')
+            n++;
+
+    m->piece = (macroPiece *) malloc(n * sizeof(macroPiece));
+    if (m->piece == NULL)
+        diagnostics(ERROR, "Cannot allocate memory for macro <%s>", macro);
+
+    /* the literal text is packed in place, dropping the #n markers */
+    m->pieces = 0;
+    r = w = m->text;
+    do {
+        p = &m->piece[m->pieces++];
+        p->length = 0;
+        p->param = NO_PARAM;
+
+        while (*r && (*r != '#' || params <= 0)) {
+            *w++ = *r++;
+            p->length++;
+        }
+
+        if (*r == '#') {
+            r++;
+            if (*r == '#')
+                p->param = POUND_POUND;
+            else if (*r >= '1' && *r - '1' < params)
+                p->param = *r - '1';
+            else if (*r >= '1')
+                p->param = BAD_PARAM;
+            if (*r)
+                r++;
+        }
+    } while (*r);
+    *w = '\0';
+
+    return m;
+}
+
+static void freeMacro(macroBody *m)
+{
+    if (m == NULL)
+        return;
+    free(m->text);
+    free(m->piece);
+    free(m);
+}
+
+static size_t fillMacro(macroBody *m, char **args, char *out, const char *macro)
+
+/**************************************************************************
+     purpose: writes the expansion of m with the arguments args to out,
+              or, when out is NULL, only counts the characters needed
+**************************************************************************/
+{
+    size_t len = 0, n;
+    const char *text = m->text;
+    char last = '\0';
+    int i;
+
+    for (i = 0; i < m->pieces; i++) {
+        macroPiece *p = &m->piece[i];
+
+        if (p->length) {
+            if (out)
+                memcpy(out + len, text, p->length);
+            len += p->length;
+            text += p->length;
+            last = text[-1];
+        }
+
+        if (p->param == POUND_POUND) {
+            if (out)
+                out[len] = '#';
+            len++;
+            last = '#';
+
+        } else if (p->param == BAD_PARAM) {
+            if (out)
+                diagnostics(WARNING, "expandmacro: confusing definition in macro=<%s>", macro);
+
+        } else if (p->param != NO_PARAM) {
+
+            /* begin with a space if the last character was a character */
+            if (isalpha((unsigned char) last)) {
+                if (out)
+                    out[len] = ' ';
+                len++;
+                last = ' ';
+            }
+
+            n = strlen(args[p->param]);
+            if (out)
+                memcpy(out + len, args[p->param], n);
+            len += n;
+            if (n)
+                last = args[p->param][n - 1];
+        }
+    }
+
+    if (out)
+        out[len] = '\0';
+    return len;
+}
 
-static char *expandmacro(char *macro, char *opt_param, int params)
+static char *expandmacro(macroBody *m, char *macro, char *opt_param, int params)
 
 /**************************************************************************
-     purpose: retrieves and expands a defined macro 
-              care is taken to avoid buffer overruns
+     purpose: retrieves and expands a defined macro into a string of
+              exactly the right size
 **************************************************************************/
 {
-    int i = 0, param;
-    char *args[9], *dmacro, *macro_piece, *next_piece, *expanded, *buffer=NULL, *cs;
-    int buff_size = 512;   /* extra slop for macro expansion */
+    int i = 0;
+    char *args[9], *expanded;
 
     diagnostics(5, "expandmacro...");
     diagnostics(5, "expandmacro: contents '%s'", macro);
@@ -138,143 +298,29 @@ static char *expandmacro(char *macro, char *opt_param, int params)
         args[0] = getBracketParam();
         if (!args[0])
             args[0] = strdup(opt_param);
-        buff_size += (int) strlen(args[0]);
         i = 1;
     }
 
     for (; i < params; i++) {
         args[i] = getBraceRawParam();
-        buff_size += strlen(args[i]);
         diagnostics(5, "Macro #%d --> '%s'", i + 1, args[i]);
     }
 
-    dmacro = strdup(macro);
-    macro_piece = dmacro;
-    buff_size += (int) strlen(macro_piece);
-
-    diagnostics(5, "expandmacro: buff_size = %d\n", buff_size);
-    if(buff_size > 0)
-        buffer = (char*) calloc(sizeof(char) * buff_size, sizeof(char));
-    
-    expanded = buffer;
-
-    /* convert "\csname " but leave inital backslash */
-    while ((cs = strstr(dmacro, "\\csname ")) != NULL)
-        my_strcpy(cs+1, cs + strlen("\\csname "));
-    while ((cs = strstr(dmacro, "\\csname")) != NULL)
-        my_strcpy(cs+1, cs + strlen("\\csname"));
-
-    /* remove "\endcsname" */
-    while ((cs = strstr(dmacro, "\\endcsname ")) != NULL)
-        my_strcpy(cs, cs + strlen("\\endcsname "));
-    while ((cs = strstr(dmacro, "\\endcsname")) != NULL)
-        my_strcpy(cs, cs + strlen("\\endcsname"));
-
-    diagnostics(5, "expandmacro: after removing cs crap '%s'", macro_piece);
-
-    /* do not use strtok because it may be used elsewhere */
-    while (macro_piece && *macro_piece) {
-
-        param = -1;
-
-        next_piece = strchr(macro_piece, '#');
-        if (next_piece) {
-            *next_piece = '\0';        /* later we'll copy macro up to this point */
-            next_piece++;
-            
-            /* the only characters that should follow # are '1'-'9' and '#' */
-            
-            if (*next_piece == '#')
-                param = POUND_POUND;    /* just a flag for below */
-            else
-                param = *next_piece - '1';
-            
-            next_piece++;
-        }
-
-        diagnostics(5, "expandmacro: next section of macro before '#' is '%s'", macro_piece);
-       
-        /* copy unchanged part of macro into expanded */
-        strcpy(expanded, macro_piece);
-        expanded += strlen(macro_piece);
-
-        diagnostics(5, "expandmacro: before appending next piece '%s'", buffer);
-                
-        if (param > -1) {
-            if (param == POUND_POUND) {
-                diagnostics(5, "expandmacro: found ##, appending # to expanded macro");
-                if (expanded+1 < buffer+buff_size) {
-                    *expanded='#';
-                    expanded++;
-                } else 
-                    diagnostics(WARNING, "insufficient buffer to expand macro <%s>", macro);
-
-            } else if (param < params) {
-                diagnostics(5, "expandmacro: found #%d appending '%s'", param+1, args[param]);
-                if (expanded+strlen(args[param])+1 <buffer+buff_size) {
-                    
-                    /* begin with a space if the last character was a character */
-                    char c = *(expanded-1);
-                    if (isalpha(c)) {
-                        *expanded=' ';
-                        expanded++;
-                    }
-                    
-                    strcpy(expanded, args[param]);
-                    expanded += strlen(args[param]);
-                } else 
-                    diagnostics(WARNING, "expandmacro: insufficient buffer to expand macro <%s>", macro);
-
-            } else
-                diagnostics(WARNING, "expandmacro: confusing definition in macro=<%s>", macro);
-        }
-
-        macro_piece = next_piece;
-    }
+    expanded = (char *) malloc(fillMacro(m, args, NULL, macro) + 1);
+    if (expanded == NULL)
+        diagnostics(ERROR, "Cannot allocate memory to expand macro <%s>", macro);
+    fillMacro(m, args, expanded, macro);
 
-    expanded = strdup(buffer);
-    
     for (i = 0; i < params; i++) {
         if (args[i])
             free(args[i]);
     }
     
-    if (dmacro)
-        free(dmacro);
-
-    if (buffer)
-        free(buffer);
-
     diagnostics(4, "expandmacro: result is '%s'", expanded);
     
     return expanded;
 }
 
-int maybeDefinition(char *s, size_t n)
-
-/**************************************************************************
-     purpose: checks to see if a named TeX definition possibly exists
-     returns: the array index of the named TeX definition
-**************************************************************************/
-{
-    int i;
-
-    if (n == 0)
-        return TRUE;
-
-    for (i = 0; i < iDefinitionCount; i++) {
-        /*
-        char *ss = my_strndup(s,strlen(Definitions[i].name));
-        diagnostics(WARNING, "def seeking=<%s>, i=%d, current=<%s>", ss, i, Definitions[i].name);
-        free(ss);
-        */
-        if (strncmp(s, Definitions[i].name, n) == 0)
-            return TRUE;
-    }
-
-    return FALSE;
-}
-
 int existsDefinition(char *s)
 
 /**************************************************************************
@@ -282,28 +328,12 @@ int existsDefinition(char *s)
      returns: the array index of the named TeX definition
 **************************************************************************/
 {
-    int i;
+    definition_type *d = (definition_type *) hashFind(DefinitionIndex, s);
 
-    for (i = 0; i < iDefinitionCount; i++) {
-    /*
-        char *tt = my_strndup(s,strlen(Definitions[i].name));
-        diagnostics(WARNING, "def text has=<%s>, i=%d, trying=<%s>", tt, i, Definitions[i].name);
-        free(tt);
-    */
-        if (strcmp(s, Definitions[i].name) == 0) {
-    /*
-            char *ss = my_strndup(s,strlen(Definitions[i].name));
-            diagnostics(WARNING, "def text has=<%s>, i=%d, matched=<%s>", ss, i, Definitions[i].name);
-            free(ss);
-    */
-            break;
-        }
-    }
-
-    if (i == iDefinitionCount)
+    if (d == NULL)
         return -1;
     else
-        return i;
+        return d - Definitions;
 }
 
 void newDefinition(char *name, char *opt_param, char *def, int params)
@@ -358,7 +388,16 @@ void newDefinition(char *name, char *opt_param, char *def, int params)
         diagnostics(ERROR, "\nCannot allocate def for definition \\%s\n", name);
     }
 
+    Definitions[iDefinitionCount].body = compileMacro(def, params);
+
+    if (DefinitionIndex == NULL)
+        DefinitionIndex = hashNew(256);
+    hashAdd(DefinitionIndex, name, &Definitions[iDefinitionCount]);
+
     iDefinitionCount++;
+    iDefinitionChanges++;
+    addPreParseDefinition(name);
+    InvalidateCommandCache();
     diagnostics(3, "Successfully added macro #%d", iDefinitionCount);
 }
 
@@ -396,9 +435,23 @@ void renewDefinition(char *name, char *opt_param, char *def, int params)
             diagnostics(WARNING, "\nCannot allocate def for definition \\%s\n", name);
             exit(1);
         }
+        freeMacro(Definitions[i].body);
+        Definitions[i].body = compileMacro(def, params);
+        iDefinitionChanges++;
+        InvalidateCommandCache();
     }
 }
 
+int definitionChanges(void)
+
+/**************************************************************************
+     purpose: returns a number that changes whenever a definition is
+              added or changed
+**************************************************************************/
+{
+    return iDefinitionChanges;
+}
+
 char *expandDefinition(int thedef)
 
 /**************************************************************************
@@ -415,7 +468,8 @@ char *expandDefinition(int thedef)
     diagnostics(5, "expandDefinition def      =<%s>", Definitions[thedef].def);
     diagnostics(5, "expandDefinition params   =<%d>", Definitions[thedef].params);
 
-    return expandmacro(Definitions[thedef].def, Definitions[thedef].opt_param, Definitions[thedef].params);
+    return expandmacro(Definitions[thedef].body, Definitions[thedef].def,
+      Definitions[thedef].opt_param, Definitions[thedef].params);
 }
 
 int existsEnvironment(char *s)
@@ -425,67 +479,13 @@ int existsEnvironment(char *s)
      returns: the array index of the \newenvironment
 **************************************************************************/
 {
-    int i = 0;
-
-    while (i < iNewEnvironmentCount && !strequal(s, NewEnvironments[i].name)) {
-        diagnostics(6, "existsEnv seeking=<%s>, i=%d, current=<%s>", s, i, NewEnvironments[i].name);
-        i++;
-    }
+    environment_type *e = (environment_type *) hashFind(EnvironmentIndex, s);
 
-    if (i == iNewEnvironmentCount)
+    if (e == NULL)
         return -1;
-    else {
-        diagnostics(4, "user env found=<%s>, i=%d, current=<%s>", s, i, NewEnvironments[i].name);
-        return i;
-    }
-}
-
-int maybeEnvironment(char *s, size_t n)
-
-/**************************************************************************
-     purpose: checks to see if a named TeX environment possibly exists
-     returns: the array index of the named TeX definition
-**************************************************************************/
-{
-    int i;
-
-    if (n == 0)
-        return TRUE;
-
-    for (i = 0; i < iNewEnvironmentCount; i++) {
-    
-        if (0) {
-        char *ss = my_strndup(s,n);
-        diagnostics(2, "trying env seeking=<%s>, i=%d, current=<%s>", ss, i, NewEnvironments[i].endname);
-        free(ss);
-        }
-        
-        if (strncmp(s, NewEnvironments[i].begname, n) == 0) {
-            if (0) {
-            char *ss = my_strndup(s,n);
-            diagnostics(2, "possible env seeking=<%s>, i=%d, current=<%s>", ss, i, NewEnvironments[i].begname);
-            free(ss);
-            }
-            return TRUE;
-        }
 
-    
-        if (strncmp(s, NewEnvironments[i].endname, n) == 0) {
-            if (0) {
-            char *ss = my_strndup(s,n);
-            diagnostics(2, "possible env seeking=<%s>, i=%d, current=<%s>", ss, i, NewEnvironments[i].endname);
-            free(ss);
-            }
-            return TRUE;
-        }
-    }
-
-    if (0) {
-    char *ss = my_strndup(s,n);
-    diagnostics(2, "failed all env seeking=<%s>", ss);
-    free(ss);
-    }
-    return FALSE;
+    diagnostics(4, "user env found=<%s>, i=%d", s, (int) (e - NewEnvironments));
+    return e - NewEnvironments;
 }
 
 void newEnvironment(char *name, char *opt_param, char *begdef, char *enddef, int params)
@@ -505,6 +505,7 @@ void newEnvironment(char *name, char *opt_param, char *begdef, char *enddef, int
     NewEnvironments[iNewEnvironmentCount].endname = strdup_together("\\end{", name);
     NewEnvironments[iNewEnvironmentCount].begdef = strdup(begdef);
     NewEnvironments[iNewEnvironmentCount].enddef = strdup(enddef);
+    NewEnvironments[iNewEnvironmentCount].begbody = compileMacro(begdef, params);
     NewEnvironments[iNewEnvironmentCount].params = params;
 
     if (opt_param) {
@@ -525,7 +526,12 @@ void newEnvironment(char *name, char *opt_param, char *begdef, char *enddef, int
         diagnostics(ERROR, "Cannot allocate memory for \\newenvironment{%s}", name);
     }
 
+    if (EnvironmentIndex == NULL)
+        EnvironmentIndex = hashNew(64);
+    hashAdd(EnvironmentIndex, name, &NewEnvironments[iNewEnvironmentCount]);
+
     iNewEnvironmentCount++;
+    addPreParseEnvironment(name);
 }
 
 void renewEnvironment(char *name, char *opt_param, char *begdef, char *enddef, int params)
@@ -545,8 +551,6 @@ void renewEnvironment(char *name, char *opt_param, char *begdef, char *enddef, i
     } else {
         free(NewEnvironments[i].begdef);
         free(NewEnvironments[i].enddef);
-        free(NewEnvironments[i].begname);
-        free(NewEnvironments[i].endname);
         if (NewEnvironments[i].opt_param)
             free(NewEnvironments[i].opt_param);
         if (opt_param) {
@@ -560,6 +564,8 @@ void renewEnvironment(char *name, char *opt_param, char *begdef, char *enddef, i
         NewEnvironments[i].params = params;
         NewEnvironments[i].begdef = strdup(begdef);
         NewEnvironments[i].enddef = strdup(enddef);
+        freeMacro(NewEnvironments[i].begbody);
+        NewEnvironments[i].begbody = compileMacro(begdef, params);
         if (NewEnvironments[i].begdef == NULL || NewEnvironments[i].enddef == NULL) {
             diagnostics(ERROR, "Cannot allocate memory for \\renewenvironment{%s}", name);
         }
@@ -580,14 +586,14 @@ char *expandEnvironment(int thedef, int code)
     if (code == CMD_BEGIN) {
 
         diagnostics(3, "\\begin{%s} <%s>", NewEnvironments[thedef].name, NewEnvironments[thedef].begdef);
-        s= expandmacro(NewEnvironments[thedef].begdef,
+        s= expandmacro(NewEnvironments[thedef].begbody, NewEnvironments[thedef].begdef,
           NewEnvironments[thedef].opt_param, NewEnvironments[thedef].params);
         t = strdup_together("{",s);
 
     } else {
 
         diagnostics(3, "\\end{%s} <%s>", NewEnvironments[thedef].name, NewEnvironments[thedef].enddef);
-        s = expandmacro(NewEnvironments[thedef].enddef, NULL, 0);
+        s = strdup(NewEnvironments[thedef].enddef);
         t = strdup_together(s,"}");
     }
 
@@ -622,6 +628,10 @@ void newTheorem(char *name, char *caption, char *numbered_like, char *within)
 
     setCounter(NewTheorems[iNewTheoremCount].numbered_like, 0);
 
+    if (TheoremIndex == NULL)
+        TheoremIndex = hashNew(64);
+    hashAdd(TheoremIndex, name, &NewTheorems[iNewTheoremCount]);
+
     iNewTheoremCount++;
 }
 
@@ -632,17 +642,12 @@ int existsTheorem(char *s)
      returns: the array index of the \newtheorem
 **************************************************************************/
 {
-    int i = 0;
-
-    while (i < iNewTheoremCount && !strequal(s, NewTheorems[i].name)) {
-        diagnostics(6, "seeking=<%s>, i=%d, current=<%s>", s, i, NewTheorems[i].name);
-        i++;
-    }
+    theorem_type *t = (theorem_type *) hashFind(TheoremIndex, s);
 
-    if (i == iNewTheoremCount)
+    if (t == NULL)
         return -1;
     else
-        return i;
+        return t - NewTheorems;
 }
 
 char *expandTheorem(int i, char *option)
@@ -677,6 +682,68 @@ char *expandTheorem(int i, char *option)
     return strdup(s);
 }
 
+void ResetDefinitions(void)
+
+/**************************************************************************
+     purpose: forgets all \newcommand, \newenvironment and \newtheorem
+              definitions so that the next document starts without them
+**************************************************************************/
+{
+    int i;
+
+    for (i = 0; i < iDefinitionCount; i++) {
+        free(Definitions[i].name);
+        safe_free(Definitions[i].opt_param);
+        free(Definitions[i].def);
+        freeMacro(Definitions[i].body);
+    }
+
+    for (i = 0; i < iNewEnvironmentCount; i++) {
+        free(NewEnvironments[i].name);
+        safe_free(NewEnvironments[i].opt_param);
+        free(NewEnvironments[i].begname);
+        free(NewEnvironments[i].endname);
+        free(NewEnvironments[i].begdef);
+        free(NewEnvironments[i].enddef);
+        freeMacro(NewEnvironments[i].begbody);
+    }
+
+    for (i = 0; i < iNewTheoremCount; i++) {
+        free(NewTheorems[i].name);
+        free(NewTheorems[i].caption);
+        free(NewTheorems[i].numbered_like);
+        safe_free(NewTheorems[i].within);
+    }
+
+    iDefinitionCount = 0;
+    iNewEnvironmentCount = 0;
+    iNewTheoremCount = 0;
+    iDefinitionChanges++;
+
+    if (DefinitionIndex)
+        hashClear(DefinitionIndex, NULL);
+    if (EnvironmentIndex)
+        hashClear(EnvironmentIndex, NULL);
+    if (TheoremIndex)
+        hashClear(TheoremIndex, NULL);
+
+    InvalidateCommandCache();
+}
+
+void FreeDefinitions(void)
+
+/**************************************************************************
+     purpose: like ResetDefinitions() but also releases the indexes
+**************************************************************************/
+{
+    ResetDefinitions();
+
+    hashFree(DefinitionIndex, NULL);
+    hashFree(EnvironmentIndex, NULL);
+    hashFree(TheoremIndex, NULL);
+    DefinitionIndex = EnvironmentIndex = TheoremIndex = NULL;
+}
+
 void resetTheoremCounter(char *unit)
 
 /**************************************************************************
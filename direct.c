@@ -70,32 +70,30 @@ void WriteCFGFontNumber(char **cfg_stream)
     free(font_name);
 }
 
-int TryDirectConvert(char *command)
+void DirectConvert(const char *command, const char *RtfCommand)
 /******************************************************************************
-  purpose: uses data from direct.cfg to try and immediately convert some
-           LaTeX commands into RTF commands.  
+  purpose: uses data from direct.cfg to immediately convert some
+           LaTeX commands into RTF commands.  RtfCommand is the
+           direct.cfg entry for \command.
  ******************************************************************************/
 {
-    char *buffpoint, *RtfCommand, *TexCommand;
+    char *buffpoint = (char *) RtfCommand;
 
-    TexCommand = strdup_together("\\", command);
-    RtfCommand = SearchCfgRtf(TexCommand, DIRECT_A);
-    if (RtfCommand == NULL) {
-        free(TexCommand);
-        return FALSE;
+    diagnostics(4, "Directly converting \\%s to %s", command, RtfCommand);
+
+    /* most entries name no font and can be written in one go */
+    if (strchr(buffpoint, '*') == NULL) {
+        putRtfStr(buffpoint);
+        return;
     }
-    
-    buffpoint = RtfCommand;
-    diagnostics(4, "Directly converting %s to %s", TexCommand, RtfCommand);
+
     while (buffpoint[0] != '\0') {
         if (buffpoint[0] == '*')
             WriteCFGFontNumber(&buffpoint);
         else
-            fprintRTF("%c", *buffpoint);
+            putRtfChar(*buffpoint);
 
         ++buffpoint;
 
     }
-    free(TexCommand);
-    return TRUE;
 }
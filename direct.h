@@ -1,2 +1,2 @@
-int TryDirectConvert(char *command);
+void DirectConvert(const char *command, const char *RtfCommand);
 void WriteCFGFontNumber(char **cfg_stream);
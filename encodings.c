@@ -275,62 +275,174 @@ void CmdChar(int code)
 }
 
 
+long getUtf8Char(unsigned char lead)
+
+/******************************************************************************
+ purpose: decodes the UTF-8 sequence that starts with lead, reading the
+          continuation bytes with getTexChar().  Returns the code point or,
+          after a warning, U+FFFD for a malformed sequence.
+ ******************************************************************************/
+{
+    int i, len;
+    long code, smallest;
+    unsigned char byte;
+
+    if (lead >= 0xC2 && lead <= 0xDF) {
+        len = 1;
+        code = lead & 0x1F;
+        smallest = 0x80;
+    } else if (lead >= 0xE0 && lead <= 0xEF) {
+        len = 2;
+        code = lead & 0x0F;
+        smallest = 0x800;
+    } else if (lead >= 0xF0 && lead <= 0xF4) {
+        len = 3;
+        code = lead & 0x07;
+        smallest = 0x10000;
+    } else {
+        diagnostics(WARNING, "Invalid UTF-8 byte 0x%02X", (unsigned int) lead);
+        return 0xFFFD;
+    }
+
+    for (i = 0; i < len; i++) {
+        byte = (unsigned char) getTexChar();
+        if ((byte & 0xC0) != 0x80) {
+            ungetTexChar((char) byte);
+            diagnostics(WARNING, "Incomplete UTF-8 sequence starting with byte 0x%02X", (unsigned int) lead);
+            return 0xFFFD;
+        }
+        code = (code << 6) | (byte & 0x3F);
+    }
+
+    /* overlong forms, UTF-16 surrogates and values beyond unicode */
+    if (code < smallest || code > 0x10FFFF || (code >= 0xD800 && code <= 0xDFFF)) {
+        diagnostics(WARNING, "Invalid UTF-8 sequence for U+%04lX", code);
+        return 0xFFFD;
+    }
+
+    return code;
+}
+
+typedef char rtfEscape[12];         /* e.g. \u-1234? or \'A9 */
+
+static THREAD_LOCAL rtfEscape *escape_table[ENCODING_UTF8 + 1];
+static THREAD_LOCAL int last_encoding = -1;     /* cached by WriteEightBitChar() */
+static THREAD_LOCAL rtfEscape *escapes = NULL;
+
+static int *UnicodeTable(int encoding)
+
+/******************************************************************************
+ purpose: returns the table mapping the upper half of an 8-bit encoding to
+          unicode or NULL if characters in that encoding are not written
+ ******************************************************************************/
+{
+    switch (encoding) {
+        case ENCODING_1251:           return cp1251Unicode;
+        case ENCODING_APPLE:          return appleUnicode;
+        case ENCODING_437:            return cp437Unicode;
+        case ENCODING_850:            return cp850Unicode;
+        case ENCODING_852:            return cp852Unicode;
+        case ENCODING_855:            return cp855Unicode;
+        case ENCODING_865:            return cp865Unicode;
+        case ENCODING_866:            return cp866Unicode;
+        case ENCODING_1250:           return cp1250Unicode;
+        case ENCODING_1252:           return cp1252Unicode;
+        case ENCODING_LATIN_2:        return latin2Unicode;
+        case ENCODING_LATIN_3:        return latin3Unicode;
+        case ENCODING_LATIN_4:        return latin4Unicode;
+        case ENCODING_LATIN_5:        return latin5Unicode;
+        case ENCODING_LATIN_9:        return latin9Unicode;
+        case ENCODING_LATIN_10:       return latin10Unicode;
+        case ENCODING_NEXT:           return nextUnicode;
+        case ENCODING_KOI8_R:         return koi8rUnicode;
+        case ENCODING_KOI8_U:         return koi8uUnicode;
+        case ENCODING_DEC:            return decmultiUnicode;
+        case ENCODING_APPLE_CE:       return appleCEUnicode;
+        case ENCODING_APPLE_CYRILLIC: return appleCyrrilicUnicode;
+    }
+    return NULL;
+}
+
+static rtfEscape *EscapeTable(int encoding)
+
+/******************************************************************************
+ purpose: returns the RTF for the characters 128-255 in an encoding.  The
+          table is built the first time the encoding is used; the strings
+          match what CmdUnicodeChar() would write.  Returns NULL for the
+          encodings whose 8-bit characters are dropped.
+ ******************************************************************************/
+{
+    int i, code, *unicode;
+    rtfEscape *t;
+
+    if (encoding < 0 || encoding > ENCODING_UTF8)
+        return NULL;
+
+    if (escape_table[encoding])
+        return escape_table[encoding];
+
+    unicode = UnicodeTable(encoding);
+    if (unicode == NULL && encoding != ENCODING_RAW)
+        return NULL;
+
+    t = (rtfEscape *) malloc(128 * sizeof(rtfEscape));
+    if (t == NULL)
+        diagnostics(ERROR, "Cannot allocate escapes for encoding %d", encoding);
+
+    for (i = 0; i < 128; i++) {
+        if (unicode == NULL) {
+            sprintf(t[i], "\\'%2X", i + 128);
+            continue;
+        }
+        code = unicode[i] & 0xFFFF;
+        if (code >= 32768)
+            code -= 65536;
+        sprintf(t[i], "\\u%d?", code);
+    }
+
+    escape_table[encoding] = t;
+    return t;
+}
+
+void FreeEncodings(void)
+
+/******************************************************************************
+ purpose: release the escape tables built by EscapeTable()
+ ******************************************************************************/
+{
+    int i;
+
+    for (i = 0; i <= ENCODING_UTF8; i++) {
+        free(escape_table[i]);
+        escape_table[i] = NULL;
+    }
+    last_encoding = -1;
+    escapes = NULL;
+}
+
 void WriteEightBitChar(unsigned char cThis, FILE *f)
 {
-    int eightbit_index;
+    int encoding;
 
     if ( cThis <= 127) {
         fputc(cThis, f);
         return;
     }
 
-    eightbit_index = cThis - 128;
-    diagnostics(6, "  WriteEightBitChar '%c' char=%3d index=%d encoding=%2d", cThis, (unsigned int) cThis, eightbit_index, CurrentFontEncoding());
-
-    if (CurrentFontEncoding() == ENCODING_RAW)
-        fprintRTF("\\'%2X", (unsigned char) cThis);
-    else if (CurrentFontEncoding() == ENCODING_1251)
-        CmdUnicodeChar(cp1251Unicode[eightbit_index]);
-    else if (CurrentFontEncoding() == ENCODING_APPLE)
-        CmdUnicodeChar(appleUnicode[eightbit_index]);
-    else if (CurrentFontEncoding() == ENCODING_437)
-        CmdUnicodeChar(cp437Unicode[eightbit_index]);
-    else if (CurrentFontEncoding() == ENCODING_850)
-        CmdUnicodeChar(cp850Unicode[eightbit_index]);
-    else if (CurrentFontEncoding() == ENCODING_852)
-        CmdUnicodeChar(cp852Unicode[eightbit_index]);
-    else if (CurrentFontEncoding() == ENCODING_855)
-        CmdUnicodeChar(cp855Unicode[eightbit_index]);
-    else if (CurrentFontEncoding() == ENCODING_865)
-        CmdUnicodeChar(cp865Unicode[eightbit_index]);
-    else if (CurrentFontEncoding() == ENCODING_866)
-        CmdUnicodeChar(cp866Unicode[eightbit_index]);
-    else if (CurrentFontEncoding() == ENCODING_1250)
-        CmdUnicodeChar(cp1250Unicode[eightbit_index]);
-    else if (CurrentFontEncoding() == ENCODING_1252)
-        CmdUnicodeChar(cp1252Unicode[eightbit_index]);
-    else if (CurrentFontEncoding() == ENCODING_LATIN_2)
-        CmdUnicodeChar(latin2Unicode[eightbit_index]);
-    else if (CurrentFontEncoding() == ENCODING_LATIN_3)
-        CmdUnicodeChar(latin3Unicode[eightbit_index]);
-    else if (CurrentFontEncoding() == ENCODING_LATIN_4)
-        CmdUnicodeChar(latin4Unicode[eightbit_index]);
-    else if (CurrentFontEncoding() == ENCODING_LATIN_5)
-        CmdUnicodeChar(latin5Unicode[eightbit_index]);
-    else if (CurrentFontEncoding() == ENCODING_LATIN_9)
-        CmdUnicodeChar(latin9Unicode[eightbit_index]);
-    else if (CurrentFontEncoding() == ENCODING_LATIN_10)
-        CmdUnicodeChar(latin10Unicode[eightbit_index]);
-    else if (CurrentFontEncoding() == ENCODING_NEXT)
-        CmdUnicodeChar(nextUnicode[eightbit_index]);
-    else if (CurrentFontEncoding() == ENCODING_KOI8_R)
-        CmdUnicodeChar(koi8rUnicode[eightbit_index]);
-    else if (CurrentFontEncoding() == ENCODING_KOI8_U)
-        CmdUnicodeChar(koi8uUnicode[eightbit_index]);
-    else if (CurrentFontEncoding() == ENCODING_DEC)
-        CmdUnicodeChar(decmultiUnicode[eightbit_index]);
-    else if (CurrentFontEncoding() == ENCODING_APPLE_CE)
-        CmdUnicodeChar(appleCEUnicode[eightbit_index]);
-    else if (CurrentFontEncoding() == ENCODING_APPLE_CYRILLIC)
-        CmdUnicodeChar(appleCyrrilicUnicode[eightbit_index]);
+    encoding = CurrentFontEncoding();
+    diagnostics(6, "  WriteEightBitChar '%c' char=%3d index=%d encoding=%2d", cThis, (unsigned int) cThis, cThis - 128, encoding);
+
+    /* the encoding rarely changes, so the table is only looked up again when it does */
+    if (encoding != last_encoding) {
+        escapes = EscapeTable(encoding);
+        last_encoding = encoding;
+    }
+
+    if (escapes == NULL)
+        return;
+
+    if (encoding != ENCODING_RAW && getTexMode() == MODE_VERTICAL)
+        changeTexMode(MODE_HORIZONTAL);
+
+    putRtfRaw(escapes[cThis - 128]);
 }
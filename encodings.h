@@ -39,5 +39,7 @@ enum {
 void CmdOT2Transliteration(int cThis);
 void CmdChar(int code);
 void WriteEightBitChar(unsigned char cThis, FILE *f);
+void FreeEncodings(void);
+long getUtf8Char(unsigned char lead);
 
 #endif
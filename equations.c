@@ -47,10 +47,10 @@ Authors:
 #include "vertical.h"
 #include "fields.h"
 
-int g_equation_column = 1;
-int g_amsmath_package = FALSE;
-int g_multiline_equation_type = 0;
-int g_current_eqn_needs_EQ = 0;
+THREAD_LOCAL int g_equation_column = 1;
+THREAD_LOCAL int g_amsmath_package = FALSE;
+THREAD_LOCAL int g_multiline_equation_type = 0;
+THREAD_LOCAL int g_current_eqn_needs_EQ = 0;
 
 int script_shift(void)
 {
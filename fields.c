@@ -30,21 +30,21 @@ Authors:
 
 #define FIELD_MAX_DEPTH 20
 
-int g_equation_field_EQ_in_effect = 0;
+THREAD_LOCAL int g_equation_field_EQ_in_effect = 0;
 
-int g_fields_use_EQ       = 1;
-int g_fields_use_REF      = 1;
-int g_fields_use_SYMBOL   = 1;
-int g_fields_use_PAGE     = 1;
-int g_fields_use_PAGE_REF = 1;
-int g_fields_use_COMMENT  = 1;
+THREAD_LOCAL int g_fields_use_EQ       = 1;
+THREAD_LOCAL int g_fields_use_REF      = 1;
+THREAD_LOCAL int g_fields_use_SYMBOL   = 1;
+THREAD_LOCAL int g_fields_use_PAGE     = 1;
+THREAD_LOCAL int g_fields_use_PAGE_REF = 1;
+THREAD_LOCAL int g_fields_use_COMMENT  = 1;
 
-int g_fields_allowed      = 1;
+THREAD_LOCAL int g_fields_allowed      = 1;
 
-char g_field_separator  = ',';
+THREAD_LOCAL char g_field_separator  = ',';
 
-int  g_field_depth = -1;
-int  g_field[FIELD_MAX_DEPTH];
+THREAD_LOCAL int  g_field_depth = -1;
+THREAD_LOCAL int  g_field[FIELD_MAX_DEPTH];
 
 /* OK there are a bunch of possible states
 
@@ -165,6 +165,21 @@ void endAllFields(void)
         endCurrentField();
 }
 
+void ResetFields(void)
+
+/******************************************************************************
+  purpose: close no fields but forget any that were left open and go back
+           to the default field settings before the next document
+ ******************************************************************************/
+{
+    g_field_depth = -1;
+    g_equation_field_EQ_in_effect = 0;
+    g_fields_allowed = 1;
+    g_fields_use_EQ = 1;
+    g_fields_use_REF = 1;
+    g_field_separator = ',';
+}
+
 void fprintfRTF_field_separator(void)
 {
     fprintRTF("%c", g_field_separator);
@@ -8,6 +8,7 @@
 void startField(int type);
 void endCurrentField(void);
 void endAllFields(void);
+void ResetFields(void);
 
 void fprintfRTF_field_separator(void);
 void set_field_separator(char c);
@@ -98,8 +98,8 @@ typedef struct RtfFontInfoType {
 } RtfFontInfoType;
 
 #define MAX_FONT_INFO_DEPTH 301
-static RtfFontInfoType RtfFontInfo[MAX_FONT_INFO_DEPTH];
-static int FontInfoDepth = 0;
+static THREAD_LOCAL RtfFontInfoType RtfFontInfo[MAX_FONT_INFO_DEPTH];
+static THREAD_LOCAL int FontInfoDepth = 0;
 
 /****************************************************************************
  *   purpose: returns the RTF font number from an RTF font name
@@ -153,6 +153,51 @@ int TexFontNumber(const char *Fname)
     return number;
 }
 
+/******************************************************************************
+  purpose: record a change of the current font.  Code that writes font
+           changes with putRtfRaw() must keep RtfFontInfo in step with these
+ ******************************************************************************/
+void SetCurrentFontFamily(int family)
+{
+    RtfFontInfo[FontInfoDepth].family = family;
+}
+
+void SetCurrentFontShape(int shape)
+{
+    RtfFontInfo[FontInfoDepth].shape = shape;
+}
+
+void SetCurrentFontSeries(int series)
+{
+    RtfFontInfo[FontInfoDepth].series = series;
+}
+
+void SetCurrentFontSize(int size)
+{
+    RtfFontInfo[FontInfoDepth].size = size;
+}
+
+static int UprightShape(void)
+
+/* \i0 and \scaps0 select a different upright shape in math mode */
+{
+    int mode = getTexMode();
+
+    if (mode == MODE_MATH || mode == MODE_DISPLAYMATH)
+        return F_SHAPE_MATH_UPRIGHT;
+    return F_SHAPE_UPRIGHT;
+}
+
+static void WriteFontNumber(const char *control, int n)
+
+/* writes e.g. \f3 or \fs24 followed by a space without any font tracking */
+{
+    char buffer[40];
+
+    snprintf(buffer, 40, "%s%d ", control, n);
+    putRtfRaw(buffer);
+}
+
 void CmdFontFamily(int code)
 
 /******************************************************************************
@@ -223,7 +268,8 @@ void CmdFontFamily(int code)
         case F_FAMILY_SANSSERIF_3:
         case F_FAMILY_TYPEWRITER_3:
         case F_FAMILY_CALLIGRAPHIC_3:
-            fprintRTF("\\f%d ", num);
+            WriteFontNumber("\\f", num);
+            SetCurrentFontFamily(num);
             break;
 
         case F_FAMILY_ROMAN_1:
@@ -232,14 +278,20 @@ void CmdFontFamily(int code)
         case F_FAMILY_ROMAN_4:
         case F_FAMILY_SANSSERIF_4:
         case F_FAMILY_TYPEWRITER_4:
-            fprintRTF("\\i0\\scaps0\\b0\\f%d ", num);
+            putRtfRaw("\\i0\\scaps0\\b0");
+            WriteFontNumber("\\f", num);
+            SetCurrentFontShape(UprightShape());
+            SetCurrentFontSeries(F_SERIES_MEDIUM);
+            SetCurrentFontFamily(num);
             break;
 
         case F_FAMILY_ROMAN_2:
         case F_FAMILY_SANSSERIF_2:
         case F_FAMILY_TYPEWRITER_2:
         case F_FAMILY_CALLIGRAPHIC_2:
-            fprintRTF("{\\f%d ", num);
+            fprintRTF("{");
+            WriteFontNumber("\\f", num);
+            SetCurrentFontFamily(num);
             s = getBraceParam();
             ConvertString(s);
             free(s);
@@ -281,54 +333,73 @@ void CmdFontShape(int code)
 
         case F_SHAPE_UPRIGHT:
         case F_SHAPE_UPRIGHT_3:
-            fprintRTF("\\i0\\scaps0 ");
+            putRtfRaw("\\i0\\scaps0 ");
+            SetCurrentFontShape(UprightShape());
             break;
 
         case F_SHAPE_UPRIGHT_1:
-            fprintRTF("\\i0\\scaps0\\b0 ");
+            putRtfRaw("\\i0\\scaps0\\b0 ");
+            SetCurrentFontShape(UprightShape());
+            SetCurrentFontSeries(F_SERIES_MEDIUM);
             break;
 
         case F_SHAPE_UPRIGHT_2:
-            fprintRTF("{\\i0\\b0\\scaps0 ");
+            fprintRTF("{");
+            putRtfRaw("\\i0\\b0\\scaps0 ");
+            SetCurrentFontShape(UprightShape());
+            SetCurrentFontSeries(F_SERIES_MEDIUM);
             break;
 
         case F_SHAPE_SLANTED:
         case F_SHAPE_ITALIC:
-            fprintRTF("\\scaps0\\i ");
+            putRtfRaw("\\scaps0\\i ");
+            SetCurrentFontShape(F_SHAPE_ITALIC);
             break;
 
         case F_SHAPE_SLANTED_1:
         case F_SHAPE_ITALIC_1:
-            fprintRTF("\\scaps0\\b0\\i ");
+            putRtfRaw("\\scaps0\\b0\\i ");
+            SetCurrentFontShape(F_SHAPE_ITALIC);
+            SetCurrentFontSeries(F_SERIES_MEDIUM);
             break;
 
         case F_SHAPE_SLANTED_2:
         case F_SHAPE_ITALIC_2:
-            fprintRTF("{\\i ");
+            fprintRTF("{");
+            putRtfRaw("\\i ");
+            SetCurrentFontShape(F_SHAPE_ITALIC);
             break;
 
         case F_SHAPE_SLANTED_3:
         case F_SHAPE_ITALIC_3:
-            fprintRTF("\\scaps0\\i ");
+            putRtfRaw("\\scaps0\\i ");
+            SetCurrentFontShape(F_SHAPE_ITALIC);
             break;
 
         case F_SHAPE_SLANTED_4:
         case F_SHAPE_ITALIC_4:
-            fprintRTF("\\scaps0\\b0\\i ");
+            putRtfRaw("\\scaps0\\b0\\i ");
+            SetCurrentFontShape(F_SHAPE_ITALIC);
+            SetCurrentFontSeries(F_SERIES_MEDIUM);
             break;
 
         case F_SHAPE_CAPS:
         case F_SHAPE_CAPS_3:
-            fprintRTF("\\scaps ");
+            putRtfRaw("\\scaps ");
+            SetCurrentFontShape(F_SHAPE_CAPS);
             break;
 
         case F_SHAPE_CAPS_1:
         case F_SHAPE_CAPS_4:
-            fprintRTF("\\i0\\b0\\scaps ");
+            putRtfRaw("\\i0\\b0\\scaps ");
+            SetCurrentFontShape(F_SHAPE_CAPS);
+            SetCurrentFontSeries(F_SERIES_MEDIUM);
             break;
 
         case F_SHAPE_CAPS_2:
-            fprintRTF("{\\scaps ");
+            fprintRTF("{");
+            putRtfRaw("\\scaps ");
+            SetCurrentFontShape(F_SHAPE_CAPS);
             break;
     }
 
@@ -376,29 +447,39 @@ void CmdFontSeries(int code)
     switch (code) {
         case F_SERIES_MEDIUM_3:
         case F_SERIES_MEDIUM:
-            fprintRTF("\\b0 ");
+            putRtfRaw("\\b0 ");
+            SetCurrentFontSeries(F_SERIES_MEDIUM);
             break;
 
         case F_SERIES_MEDIUM_1:
-            fprintRTF("\\i0\\scaps0\\b0 ");
+            putRtfRaw("\\i0\\scaps0\\b0 ");
+            SetCurrentFontShape(UprightShape());
+            SetCurrentFontSeries(F_SERIES_MEDIUM);
             break;
 
         case F_SERIES_MEDIUM_2:
-            fprintRTF("{\\b0 ");
+            fprintRTF("{");
+            putRtfRaw("\\b0 ");
+            SetCurrentFontSeries(F_SERIES_MEDIUM);
             break;
 
         case F_SERIES_BOLD:
         case F_SERIES_BOLD_3:
-            fprintRTF("\\b ");
+            putRtfRaw("\\b ");
+            SetCurrentFontSeries(F_SERIES_BOLD);
             break;
 
         case F_SERIES_BOLD_1:
         case F_SERIES_BOLD_4:
-            fprintRTF("\\i0\\scaps0\\b ");
+            putRtfRaw("\\i0\\scaps0\\b ");
+            SetCurrentFontShape(UprightShape());
+            SetCurrentFontSeries(F_SERIES_BOLD);
             break;
 
         case F_SERIES_BOLD_2:
-            fprintRTF("{\\b ");
+            fprintRTF("{");
+            putRtfRaw("\\b ");
+            SetCurrentFontSeries(F_SERIES_BOLD);
             break;
     }
 
@@ -438,7 +519,8 @@ void CmdFontSize(int code)
     else
         scaled_size = (int) (code * DefaultFontSize() / 20.0 + 0.5);
 
-    fprintRTF("\\fs%d ", scaled_size);
+    WriteFontNumber("\\fs", scaled_size);
+    SetCurrentFontSize(scaled_size);
 
     diagnostics(5, "CmdFontSize (after) depth=%d, family=%d, size=%d, shape=%d, series=%d",
       FontInfoDepth, RtfFontInfo[FontInfoDepth].family,
@@ -502,10 +584,13 @@ void CmdEmphasize(int code)
 
     } else {
 
-        if (CurrentFontShape() == F_SHAPE_UPRIGHT)
-            fprintRTF("\\i ");
-        else
-            fprintRTF("\\i0 ");
+        if (CurrentFontShape() == F_SHAPE_UPRIGHT) {
+            putRtfRaw("\\i ");
+            SetCurrentFontShape(F_SHAPE_ITALIC);
+        } else {
+            putRtfRaw("\\i0 ");
+            SetCurrentFontShape(UprightShape());
+        }
 
     }
 
@@ -652,6 +737,16 @@ void InitializeDocumentFont(int family, int size, int shape, int series, int enc
       RtfFontInfo[0].family, RtfFontInfo[0].size, RtfFontInfo[0].shape, RtfFontInfo[0].series);
 }
 
+void ResetFonts(void)
+
+/******************************************************************************
+  purpose: forget the fonts of the previous document
+ ******************************************************************************/
+{
+    memset(RtfFontInfo, 0, sizeof(RtfFontInfo));
+    FontInfoDepth = 0;
+}
+
 int DefaultFontFamily(void)
 {
     diagnostics(5, "DefaultFontFamily -- family=%d", RtfFontInfo[0].family);
@@ -744,6 +839,31 @@ void CmdFontEncoding(int code)
     diagnostics(6, "CurrentFontSeries -- encoding=%d", RtfFontInfo[FontInfoDepth].encoding);
 }
 
+/******************************************************************************
+     save and restore the depth and the current entry of the font stack
+ ******************************************************************************/
+void getFontState(int *state)
+{
+    state[0] = FontInfoDepth;
+    state[1] = RtfFontInfo[FontInfoDepth].family;
+    state[2] = RtfFontInfo[FontInfoDepth].shape;
+    state[3] = RtfFontInfo[FontInfoDepth].series;
+    state[4] = RtfFontInfo[FontInfoDepth].size;
+    state[5] = RtfFontInfo[FontInfoDepth].encoding;
+}
+
+void setFontState(const int *state)
+{
+    if (state[0] < 0 || state[0] >= MAX_FONT_INFO_DEPTH)
+        return;
+    FontInfoDepth = state[0];
+    RtfFontInfo[FontInfoDepth].family = state[1];
+    RtfFontInfo[FontInfoDepth].shape = state[2];
+    RtfFontInfo[FontInfoDepth].series = state[3];
+    RtfFontInfo[FontInfoDepth].size = state[4];
+    RtfFontInfo[FontInfoDepth].encoding = state[5];
+}
+
 void PushFontSettings(void)
 {
     if (FontInfoDepth == MAX_FONT_INFO_DEPTH)
@@ -779,46 +899,54 @@ void PopFontSettings(void)
 }
 
 void MonitorFontChanges(const unsigned char *text)
+
+/******************************************************************************
+  purpose: follow the font changes made by RTF that was not written by the
+           font commands above, e.g., text taken from direct.cfg or style.cfg
+ ******************************************************************************/
 {
     int n;
 
+    /* only \b, \i, \scaps, \f, \fs and \plain change the font */
+    switch (text[1]) {
+        case 'b':
+        case 'i':
+        case 's':
+        case 'f':
+        case 'p':
+            break;
+        default:
+            return;
+    }
+
     diagnostics(6, "\nMonitorFont %10s\n", text);
     diagnostics(6, "MonitorFont before depth=%d, family=%d, size=%d, shape=%d, series=%d",
       FontInfoDepth, RtfFontInfo[FontInfoDepth].family,
       RtfFontInfo[FontInfoDepth].size, RtfFontInfo[FontInfoDepth].shape, RtfFontInfo[FontInfoDepth].series);
 
     if (strstart(text, "\\b0"))
-        RtfFontInfo[FontInfoDepth].series = F_SERIES_MEDIUM;
+        SetCurrentFontSeries(F_SERIES_MEDIUM);
 
     else if (strstart(text, "\\b ") || strstart(text, "\\b\\"))
-        RtfFontInfo[FontInfoDepth].series = F_SERIES_BOLD;
+        SetCurrentFontSeries(F_SERIES_BOLD);
+
+    else if (strstart(text, "\\i0"))
+        SetCurrentFontShape(UprightShape());
 
-    else if (strstart(text, "\\i0")) {
-        int mode=getTexMode();
-        if (mode==MODE_MATH || mode==MODE_DISPLAYMATH)
-            RtfFontInfo[FontInfoDepth].shape = F_SHAPE_MATH_UPRIGHT;
-        else
-            RtfFontInfo[FontInfoDepth].shape = F_SHAPE_UPRIGHT;
-    }
     else if (strstart(text, "\\i ") || strstart(text, "\\i\\"))
-        RtfFontInfo[FontInfoDepth].shape = F_SHAPE_ITALIC;
+        SetCurrentFontShape(F_SHAPE_ITALIC);
 
-    else if (strstart(text, "\\scaps0")){
-        int mode=getTexMode();
-        if (mode==MODE_MATH || mode==MODE_DISPLAYMATH)
-            RtfFontInfo[FontInfoDepth].shape = F_SHAPE_MATH_UPRIGHT;
-        else
-            RtfFontInfo[FontInfoDepth].shape = F_SHAPE_UPRIGHT;
-    }
+    else if (strstart(text, "\\scaps0"))
+        SetCurrentFontShape(UprightShape());
 
     else if (strstart(text, "\\scaps ") || strstart(text, "\\scaps\\"))
-        RtfFontInfo[FontInfoDepth].shape = F_SHAPE_CAPS;
+        SetCurrentFontShape(F_SHAPE_CAPS);
 
     else if (strstartnum(text, "\\fs", &n))
-        RtfFontInfo[FontInfoDepth].size = n;
+        SetCurrentFontSize(n);
 
     else if (strstartnum(text, "\\f", &n))
-        RtfFontInfo[FontInfoDepth].family = n;
+        SetCurrentFontFamily(n);
 
     else if (strstart(text, "\\plain")) {
         RtfFontInfo[FontInfoDepth].size = RtfFontInfo[0].size;
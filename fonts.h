@@ -62,21 +62,26 @@
 #define F_LARGER            -2
 
 void    InitializeDocumentFont(int family, int size, int shape, int series, int encoding);
+void    ResetFonts(void);
 
 void    CmdFontFamily(int code);
 int     CurrentFontFamily(void);
+void    SetCurrentFontFamily(int family);
 int     DefaultFontFamily(void);
 
 void    CmdFontShape(int code);
 int     CurrentFontShape(void);
+void    SetCurrentFontShape(int shape);
 int     DefaultFontShape(void);
 
 void    CmdFontSeries(int code);
 int     CurrentFontSeries(void);
+void    SetCurrentFontSeries(int series);
 int     DefaultFontSeries(void);
 
 void    CmdFontSize(int code);
 int     CurrentFontSize(void);
+void    SetCurrentFontSize(int size);
 int     DefaultFontSize(void);
 void    CmdFontSizeEnviron(int code);
 
@@ -91,6 +96,10 @@ void    CmdTextNormal(int code);
 int     TexFontNumber(const char *Fname);
 int     RtfFontNumber(const char *Fname);
 
+#define FONT_STATE_SIZE 6
+
+void    getFontState(int *state);
+void    setFontState(const int *state);
 void    PushFontSettings(void);
 void    PopFontSettings(void);
 void    MonitorFontChanges(const unsigned char *text);
@@ -57,11 +57,11 @@ Authors:
 
 char *roman_item(int n, int upper);
 
-static int g_chapter_numbering = ARABIC_NUMBERING;
-static int g_section_numbering = ARABIC_NUMBERING;
-static int g_appendix = 0;
+static THREAD_LOCAL int g_chapter_numbering = ARABIC_NUMBERING;
+static THREAD_LOCAL int g_section_numbering = ARABIC_NUMBERING;
+static THREAD_LOCAL int g_appendix = 0;
 
-int g_processing_list_environment = FALSE;
+THREAD_LOCAL int g_processing_list_environment = FALSE;
 
 void CmdNewDef(int code)
 
@@ -449,6 +449,38 @@ void CmdAppendix(int code)
     setCounter("section", 0);
 }
 
+void getSectionNumbering(int *chapter, int *section, int *appendix)
+
+/******************************************************************************
+  purpose: report the numbering style changed by \appendix
+ ******************************************************************************/
+{
+    *chapter = g_chapter_numbering;
+    *section = g_section_numbering;
+    *appendix = g_appendix;
+}
+
+void setSectionNumbering(int chapter, int section, int appendix)
+
+/******************************************************************************
+  purpose: restore the numbering style returned by getSectionNumbering()
+ ******************************************************************************/
+{
+    g_chapter_numbering = chapter;
+    g_section_numbering = section;
+    g_appendix = appendix;
+}
+
+void ResetSectionNumbering(void)
+
+/******************************************************************************
+  purpose: arabic numbering and no appendix, as at the start of a document
+ ******************************************************************************/
+{
+    setSectionNumbering(ARABIC_NUMBERING, ARABIC_NUMBERING, 0);
+    g_processing_list_environment = FALSE;
+}
+
 void CmdSection(int code)
 
 /******************************************************************************
@@ -936,7 +968,7 @@ void CmdItem(int code)
  ******************************************************************************/
 {
     char *itemlabel, thechar;
-    static int item_number[5];
+    static THREAD_LOCAL int item_number[5];
     int vspace;
 
     if (code == RESET_ITEM_COUNTER) {
@@ -1358,14 +1390,14 @@ typedef struct iftag {
 } IfName;
 
 /* ifCommands maintains all the \newif CONDitions */
-static int iIfNameCount = 0;   /* number of if condition names */
-static IfName ifCommands[100] = {
+static THREAD_LOCAL int iIfNameCount = 0;   /* number of if condition names */
+static THREAD_LOCAL IfName ifCommands[100] = {
     {NULL,0, 0}
 };
 
 /* ifEnvs/iIfDepth is used to handle nested conditions. */
-static IfName ifEnvs[100];
-static int iIfDepth = 0;   /* number of nested if conditions */
+static THREAD_LOCAL IfName ifEnvs[100];
+static THREAD_LOCAL int iIfDepth = 0;   /* number of nested if conditions */
 
 void CmdNewif( /* @unused@ */ int code)
 
@@ -1403,6 +1435,7 @@ void CmdNewif( /* @unused@ */ int code)
             ifCommands[iIfNameCount].is_true = FALSE;
             ifCommands[iIfNameCount].did_push_env = FALSE;
             iIfNameCount++;
+            InvalidateCommandCache();
         }
     }
     else
@@ -1435,6 +1468,45 @@ void CmdFi( /* @unused@ */ int code)
     }
 }
 
+void ResetConditions(void)
+
+/******************************************************************************
+     purpose : forget all \newif conditions of the previous document
+ ******************************************************************************/
+{
+    int i;
+
+    for (i = 0; i < iIfNameCount; i++)
+        free(ifCommands[i].if_name);
+    memset(ifCommands, 0, sizeof(ifCommands));
+    iIfNameCount = 0;
+    iIfDepth = 0;
+    InvalidateCommandCache();
+}
+
+int existsCondition(char *command)
+
+/******************************************************************************
+     purpose : returns TRUE if TryConditionSet would handle command, that is
+               command is \ifSOMETHING, \SOMETHINGtrue or \SOMETHINGfalse
+ ******************************************************************************/
+{
+    int i;
+    size_t n, len = strlen(command);
+
+    for (i = 0; i < iIfNameCount; i++) {
+        n = strlen(ifCommands[i].if_name);
+
+        if (strncmp(command, "if", 2) == 0 && strcmp(&command[2], ifCommands[i].if_name) == 0)
+            return TRUE;
+
+        if (len > n && strncmp(command, ifCommands[i].if_name, n) == 0 &&
+            (strcmp(command + n, "true") == 0 || strcmp(command + n, "false") == 0))
+            return TRUE;
+    }
+    return FALSE;
+}
+
 int TryConditionSet(char *command)
 {
     int i;
@@ -1530,7 +1602,7 @@ void CmdFigure(int code)
 {
     char *figure_contents, *lines, *position, *width;
     char endfigure[50];
-    static char     oldalignment;
+    static THREAD_LOCAL char     oldalignment;
     int real_code = code & ~ON;
     
     switch (real_code) {
@@ -1605,6 +1677,7 @@ void CmdFigure(int code)
         ConvertString(endfigure);
     } else {
         safe_free(g_figure_label);
+        g_figure_label = NULL;
         g_processing_figure = FALSE;
         diagnostics(4, "exiting CmdFigure");
         setAlignment(oldalignment);
@@ -1742,7 +1815,7 @@ parameter: code: on/off-option
  ******************************************************************************/
 void CmdAbstract(int code)
 {
-    static char oldalignment;
+    static THREAD_LOCAL char oldalignment;
                 
     if (code == ABSTRACT_PRELUDE_BEGIN || 
         code == ABSTRACT_SIMPLE        || 
@@ -1806,7 +1879,7 @@ void CmdKeywords(int code)
 void
 CmdAcknowledgments(int code)
 {
-    static char     oldalignment;
+    static THREAD_LOCAL char     oldalignment;
 
     CmdEndParagraph(0);
     
@@ -150,7 +150,7 @@ void CmdMinipage(int code);
 #define ABSTRACT_PRELUDE_BEGIN      3
 #define ABSTRACT_PRELUDE_END        4
 
-extern int  g_processing_list_environment;
+extern THREAD_LOCAL int  g_processing_list_environment;
 
 void CmdIgnoreEnviron(int code);
 void CmdFigure(int code);
@@ -186,7 +186,12 @@ void CmdIflatextortf(int code);
 void CmdNewif(int code);
 void CmdElse(int code);
 void CmdFi(int code);
+int  existsCondition(char *command);
+void ResetConditions(void);
 int  TryConditionSet(char *command);
 void CmdAppendix(int code);
+void getSectionNumbering(int *chapter, int *section, int *appendix);
+void setSectionNumbering(int chapter, int section, int appendix);
+void ResetSectionNumbering(void);
 void CmdAcronymItem(int code);
 void CmdLap(int code);
@@ -41,6 +41,8 @@ This file is available from http://sourceforge.net/projects/latex2rtf/
 #include "counters.h"
 #include "vertical.h"
 #include "fields.h"
+#include "rendercache.h"
+#include "spawn.h"
 
 /* number of points (72/inch) in a meter */
 #define POINTS_PER_METER 2834.65
@@ -181,8 +183,8 @@ GraphConvertElement GraphConvertTable[] = {
 /********************************************************************************
     purpose: implement \graphicspath{{dir1}{dir2}{...}}
  ********************************************************************************/
-static char **graphicsPath = NULL;
-static int nGraphicsPathElems = 0;
+static THREAD_LOCAL char **graphicsPath = NULL;
+static THREAD_LOCAL int nGraphicsPathElems = 0;
 
 static void appendGraphicsPath (char *newPath)
 {
@@ -214,10 +216,10 @@ void CmdGraphicsPath(int code)
 {
     char *directories = getBraceParam();
     if (directories != NULL) {
-        char *candidate=strtok(directories,"{}");
+        char *candidate=my_strtok(directories,"{}");
         while (NULL != candidate) {
             appendGraphicsPath(candidate);
-            candidate = strtok(NULL,"{}");
+            candidate = my_strtok(NULL,"{}");
         }
     }
     safe_free(directories);
@@ -229,12 +231,21 @@ void CmdGraphicsPath(int code)
 #define CONVERT_LATEX_TO_EPS  4
 #define CONVERT_PDF           5
 #define CONVERT_PS_TO_EPS     6
+#define CONVERT_LATEX_BATCH   7
+#define CONVERT_LATEX_FORMAT  8
 
-static char *g_psset_info   = NULL;
-static char *g_psstyle_info = NULL;
+#define BEGIN_DOCUMENT  "\\begin{document}\n"
+#define END_DOCUMENT    "\n\\end{document}"
 
-static char *tikzlibs[32];
-static int tikzlibsnum = 0;
+THREAD_LOCAL int g_preamble_format = FALSE;
+static THREAD_LOCAL char *preamble_format = NULL;     /* for latex2png -f */
+static THREAD_LOCAL char preamble_format_key[RENDER_KEY_SIZE];
+
+static THREAD_LOCAL char *g_psset_info   = NULL;
+static THREAD_LOCAL char *g_psstyle_info = NULL;
+
+static THREAD_LOCAL char *tikzlibs[32];
+static THREAD_LOCAL int tikzlibsnum = 0;
 
 /******************************************************************************
      purpose : portable routine to delete filename
@@ -301,6 +312,7 @@ static char *strdup_tmp_path(const char *s)
         the script pdf2pnga to solve this problem.
 
         So here we are, creating different commands for Windows XP and Unix!
+        The command is an argument vector, on Unix it is run without a shell.
         
         Parameters:
         
@@ -308,136 +320,139 @@ static char *strdup_tmp_path(const char *s)
         offset  vertical offset
         in              input filename
         out             output filename
+        a               the arguments of the command
         
  ******************************************************************************/
 
-static char *SysGraphicsConvert(int opt, int offset, uint16_t dpi, const char *in, const char *out)
+static char *GraphicsCommand(int opt, int offset, uint16_t dpi, const char *in, const char *out, spawnArgs *a)
 
 {
-    char cmd[512], *out_tmp;
-    int err;
-
-    int N = 511;        
+    char *out_tmp, *latex2png;
 
     diagnostics(3, "SysGraphicsConvert '%s' to '%s'", in, out);
+    SpawnArgsInit(a);
 
     out_tmp = strdup_tmp_path(out);
 
     if (in == NULL || out == NULL || out_tmp == NULL)
         return NULL;
 
-#ifdef UNIX
-
-    if (strchr(in, (int) '\'')) {
-        diagnostics(WARNING, "single quote found in filename '%s'.  skipping conversion", in);
-        free(out_tmp);
-        return NULL;
-    }
-
-    if (out_tmp && strchr(out_tmp, (int) '\'')) {
-        diagnostics(WARNING, "single quote found in filename '%s'.  skipping conversion", out_tmp);
-        free(out_tmp);
-        return NULL;
-    }
-
     if (opt == CONVERT_SIMPLE) {
-        const char format_simple[] = "convert '%s' '%s'";
-        snprintf(cmd, N, format_simple, in, out_tmp);
+        SpawnArg(a, "convert");
+        SpawnArg(a, in);
+        SpawnArg(a, out_tmp);
     }
 
     if (opt == CONVERT_CROP) {
-        const char format_crop[]   = "convert -trim +repage -units PixelsPerInch -density %d '%s' '%s'";
-        snprintf(cmd, N, format_crop, dpi, in, out_tmp);
+        SpawnArg(a, "convert");
+#ifdef UNIX
+        SpawnArg(a, "-trim");
+        SpawnArg(a, "+repage");
+#else
+        SpawnArg(a, "-crop");
+        SpawnArg(a, "0x0");
+#endif
+        SpawnArg(a, "-units");
+        SpawnArg(a, "PixelsPerInch");
+        SpawnArg(a, "-density");
+        SpawnArgf(a, "%d", dpi);
+        SpawnArg(a, in);
+        SpawnArg(a, out_tmp);
     }
 
-    if (opt == CONVERT_LATEX_TO_PNG) {
-        if (g_home_dir == NULL) {
-            const char format_unix[] = "%slatex2png -d %d -o %d '%s'";
-            if (g_script_dir)
-                snprintf(cmd, N, format_unix, g_script_dir, dpi, offset, in);
-            else
-                snprintf(cmd, N, format_unix, "", dpi, offset, in);
-        } else {
-            const char format_unix[] = "%slatex2png -k -d %d -o %d -H '%s' '%s'";
-            if (g_script_dir)
-                snprintf(cmd, N, format_unix, g_script_dir, dpi, offset, g_home_dir, in);
-            else
-                snprintf(cmd, N, format_unix, "", dpi, offset, g_home_dir, in);
-        }
-    }
+    if (opt == CONVERT_LATEX_TO_PNG || opt == CONVERT_LATEX_BATCH ||
+        opt == CONVERT_LATEX_FORMAT || opt == CONVERT_LATEX_TO_EPS) {
+#ifdef UNIX
+        latex2png = strdup_together(g_script_dir ? g_script_dir : "", "latex2png");
+        SpawnArg(a, latex2png);
+        free(latex2png);
+#else
+        SpawnArg(a, "bash");
+        SpawnArg(a, "latex2png");
+#endif
 
-    if (opt == CONVERT_LATEX_TO_EPS) {
-        if (g_home_dir == NULL) {
-            const char format_unix[] = "%slatex2png -e '%s'";
-            if (g_script_dir)
-                snprintf(cmd, N, format_unix, g_script_dir, in);
-            else
-                snprintf(cmd, N, format_unix, "", in);
-        } else {
-            const char format_unix[] = "%slatex2png -e -H '%s' '%s'";
-            if (g_script_dir)
-                snprintf(cmd, N, format_unix, g_script_dir, g_home_dir, in);
-            else
-                snprintf(cmd, N, format_unix, "", g_home_dir, in);
+        /* the preamble is read from a format made by latex2png -F */
+        if (preamble_format && (opt == CONVERT_LATEX_TO_PNG || opt == CONVERT_LATEX_BATCH)) {
+            SpawnArg(a, "-f");
+            SpawnArg(a, preamble_format);
         }
-    }
-    
-    if (opt == CONVERT_PDF) {
-        const char format_unix[] = "gs -q -dNOPAUSE -dSAFER -dBATCH -sDEVICE=pngalpha -r%d -sOutputFile='%s' '%s'";
-        snprintf(cmd, N, format_unix, dpi, out_tmp, in);
-    }
 
-    if (opt == CONVERT_PS_TO_EPS) {
-        const char format_unix[] = "eps2eps '%s' '%s'";
-        snprintf(cmd, N, format_unix, in, out_tmp);
-    }
-
-#else
+        if (opt == CONVERT_LATEX_BATCH)
+            SpawnArg(a, "-b");
 
-    if (opt == CONVERT_SIMPLE) {
-        char format_simple[] = "convert \"%s\" \"%s\"";
-        snprintf(cmd, N, format_simple, in, out_tmp);
-    }
+        if (opt == CONVERT_LATEX_FORMAT) {
+            SpawnArg(a, "-F");
+            SpawnArg(a, out);
+        }
 
-    if (opt == CONVERT_CROP) {
-        char format_crop[]   = "convert -crop 0x0 -units PixelsPerInch -density %d \"%s\" \"%s\"";
-        snprintf(cmd, N, format_crop, dpi, in, out_tmp);
-    }
+        if (opt == CONVERT_LATEX_TO_EPS)
+            SpawnArg(a, "-e");
 
-    if (opt == CONVERT_LATEX_TO_PNG) {
-        if (g_home_dir == NULL){
-            char format_xp[] = "bash latex2png -d %d -o %d \"%s\"";
-            snprintf(cmd, N, format_xp, dpi, offset, in);
-        } else {
-            char format_xp[] = "bash latex2png -d %d -o %d -H \"%s\" \"%s\"";
-            snprintf(cmd, N, format_xp, dpi, offset, g_home_dir, in);
+        if (opt == CONVERT_LATEX_TO_PNG || opt == CONVERT_LATEX_BATCH) {
+#ifdef UNIX
+            if (g_home_dir)
+                SpawnArg(a, "-k");
+#endif
+            SpawnArg(a, "-d");
+            SpawnArgf(a, "%d", dpi);
+            SpawnArg(a, "-o");
+            SpawnArgf(a, "%d", offset);
         }
-    }
 
-    if (opt == CONVERT_LATEX_TO_EPS) {
-        if (g_home_dir == NULL){
-            char format_xp[] = "bash latex2png -e \"%s\"";
-            snprintf(cmd, N, format_xp, in);
-        } else {
-            char format_xp[] = "bash latex2png -e -H \"%s\" \"%s\"";
-            snprintf(cmd, N, format_xp, g_home_dir, in);
+        if (g_home_dir) {
+            SpawnArg(a, "-H");
+            SpawnArg(a, g_home_dir);
         }
+        SpawnArg(a, in);
     }
-    
+
     if (opt == CONVERT_PDF) {
-        char format_xp[] = "bash pdf2pnga \"%s\" \"%s\" %d";
-        snprintf(cmd, N, format_xp, in, out_tmp, dpi);
+#ifdef UNIX
+        SpawnArg(a, "gs");
+        SpawnArg(a, "-q");
+        SpawnArg(a, "-dNOPAUSE");
+        SpawnArg(a, "-dSAFER");
+        SpawnArg(a, "-dBATCH");
+        SpawnArg(a, "-sDEVICE=pngalpha");
+        SpawnArgf(a, "-r%d", dpi);
+        SpawnArgf(a, "-sOutputFile=%s", out_tmp);
+        SpawnArg(a, in);
+#else
+        SpawnArg(a, "bash");
+        SpawnArg(a, "pdf2pnga");
+        SpawnArg(a, in);
+        SpawnArg(a, out_tmp);
+        SpawnArgf(a, "%d", dpi);
+#endif
     }
 
     if (opt == CONVERT_PS_TO_EPS) {
-        char format_xp[] = "eps2eps \"%s\" \"%s\"";
-        snprintf(cmd, N, format_xp, in, out_tmp);
+        SpawnArg(a, "eps2eps");
+        SpawnArg(a, in);
+        SpawnArg(a, out_tmp);
     }
-        
-#endif
-    diagnostics(3, "`%s`", cmd);
 
-    err = system(cmd);
+    return out_tmp;
+}
+
+/******************************************************************************
+   purpose :  run the program for a conversion (see GraphicsCommand)
+   returns :  the name of the converted file in the tmp directory or NULL
+ ******************************************************************************/
+static char *SysGraphicsConvert(int opt, int offset, uint16_t dpi, const char *in, const char *out)
+{
+    spawnArgs a;
+    char *out_tmp;
+    int err;
+
+    out_tmp = GraphicsCommand(opt, offset, dpi, in, out, &a);
+    if (out_tmp == NULL) {
+        SpawnArgsFree(&a);
+        return NULL;
+    }
+
+    err = SpawnRun(&a);
+    SpawnArgsFree(&a);
 
     if (err) {
         diagnostics(WARNING, "\nerror=%d when converting %s", err, in);
@@ -448,6 +463,90 @@ static char *SysGraphicsConvert(int opt, int offset, uint16_t dpi, const char *i
     return out_tmp;
 }
 
+static char *ReadLatexFile(const char *tex_file_stem)
+{
+    char *name, *text;
+    FILE *f;
+    long size;
+
+    name = strdup_together(tex_file_stem, ".tex");
+    f = fopen(name, "rb");
+    free(name);
+    if (f == NULL)
+        return NULL;
+
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    rewind(f);
+    text = (char *) malloc(size + 1);
+    if (text != NULL)
+        text[fread(text, 1, size, f)] = '\0';
+    fclose(f);
+    return text;
+}
+
+/******************************************************************************
+ purpose   : with -y latex2png reads the preamble of tex_file_stem.tex from a
+             format instead of loading the packages again for every bitmap.
+             The format is made once by latex2png -F and kept under a key
+             made from the preamble, in the -c directory if there is one
+ ******************************************************************************/
+static void PreparePreambleFormat(const char *tex_file_stem)
+{
+    char *text, *end, *name, *fmt, *fmt_file, *tmp_path, key[RENDER_KEY_SIZE];
+    renderHash h;
+
+    if (!g_preamble_format)
+        return;
+
+    text = ReadLatexFile(tex_file_stem);
+    if (text == NULL)
+        return;
+    end = strstr(text, BEGIN_DOCUMENT);
+    if (end == NULL) {
+        free(text);
+        return;
+    }
+    *end = '\0';
+
+    RenderHashInit(&h);
+    RenderHashAdd(&h, text);
+    RenderHashAdd(&h, g_home_dir);
+    RenderHashKey(&h, key);
+    free(text);
+
+    /* same preamble as the last bitmap, with or without a format */
+    if (strcmp(key, preamble_format_key) == 0)
+        return;
+    my_strcpy(preamble_format_key, key);
+    safe_free(preamble_format);
+    preamble_format = NULL;
+
+    name = strdup_together("l2r_", key);
+    fmt = RenderCachePath(name);
+    if (fmt == NULL) {
+        tmp_path = getTmpPath();
+        fmt = strdup_together(tmp_path, name);
+        free(tmp_path);
+    }
+    free(name);
+
+    fmt_file = strdup_together(fmt, ".fmt");
+    if (!file_exists(fmt_file)) {
+        diagnostics(2, "Making the LaTeX format <%s>", fmt_file);
+        tmp_path = SysGraphicsConvert(CONVERT_LATEX_FORMAT, 0, 0, tex_file_stem, fmt);
+        safe_free(tmp_path);
+    }
+
+    if (file_exists(fmt_file))
+        preamble_format = fmt;
+    else {
+        diagnostics(WARNING, "Could not make a LaTeX format of the preamble, rendering without one");
+        free(fmt);
+    }
+    free(fmt_file);
+}
+
 static void PicComment(int16_t label, int16_t size, FILE * fp)
 {
     int16_t long_comment = 0x00A1;
@@ -1691,21 +1790,473 @@ static double GetBaseline(const char *tex_file_stem, const char *pre)
 }
 
 /******************************************************************************
- purpose   : Convert LaTeX to Bitmap and insert in RTF file
+ purpose   : insert the bitmap png made by latex2png at resolution dpi
  ******************************************************************************/
-static void PutLatexFile(const char *tex_file_stem, double scale, const char *pre, conversion_t convertTo, int hinline)
+static void PutLatexPng(char *png, double scale, double baseline, uint16_t dpi)
 {
-    char *png_file_name = NULL;
-    char *tmp_path;
-    int  bmoffset;
     int bad_res;
     double height_goal, width_goal;
-    double baseline = 0;
     double png_xres, png_yres;
     uint32_t png_width = 0;
     uint32_t png_height= 0;
-    uint16_t png_resolution=0;
+
+    GetPngSize(png, &png_width, &png_height, &png_xres, &png_yres, &bad_res);
+
+    diagnostics(3, "PutLatexFile bitmap has (height=%d,width=%d) baseline=%g  resolution=%u", 
+                                    png_height, png_width, baseline, dpi);
+    
+    height_goal = (scale * png_height * POINTS_PER_METER / png_yres * 20.0 + 0.5);
+    width_goal  = (scale * png_width  * POINTS_PER_METER / png_xres * 20.0 + 0.5);
+    
+    PutPngFile(png, height_goal, width_goal, scale*100, baseline);
+}
+
+/******************************************************************************
+ purpose   : insert the bitmap that latex2png made from tex_file_stem.tex
+ ******************************************************************************/
+static void FinishLatexBitmap(const char *tex_file_stem, const char *key, double scale, const char *pre)
+{
+    char *png_file_name, *tmp_path;
+    int  bmoffset, bad_res;
+    double baseline;
+    double png_xres, png_yres;
+    uint32_t png_width = 0;
+    uint32_t png_height= 0;
+    uint16_t png_resolution = (uint16_t) g_dots_per_inch;
     double max_fig_size = 32767.0 / 20.0;  /* in twips */
+
+    bmoffset = g_dots_per_inch / 60 + 1;
+    png_file_name = strdup_together(tex_file_stem, ".png");
+
+    /* Figures can only have so many bits ... figure out the width and height
+       and if these are too large then reduce resolution and make a new bitmap */
+    GetPngSize(png_file_name, &png_width, &png_height, &png_xres, &png_yres, &bad_res);
+
+    if (png_width  > max_fig_size || png_height > max_fig_size) {
+            
+        if (png_height && png_height > png_width) 
+            png_resolution = (uint16_t)((double)g_dots_per_inch / (double)png_height * max_fig_size);
+        else
+            png_resolution = (uint16_t)((double)g_dots_per_inch / (double)png_width * max_fig_size);
+
+        tmp_path = SysGraphicsConvert(CONVERT_LATEX_TO_PNG, bmoffset, png_resolution, tex_file_stem, png_file_name);
+        if (tmp_path == NULL) {
+            safe_free(png_file_name);
+            return;
+        }
+        safe_free(tmp_path);
+    }
+    
+    /* we have a png file of the latex now ... insert it after figuring out offset and scaling */
+
+    baseline = GetBaseline(tex_file_stem, pre);
+    RenderCacheStore(key, png_file_name, baseline);
+    PutLatexPng(png_file_name, scale, baseline, png_resolution);
+    
+    safe_free(png_file_name);
+}
+
+/* With -r# up to # latex2png commands run at once while the conversion goes
+   on.  The RTF file gets a placeholder for each bitmap, and the bitmaps are
+   put in place of the placeholders, in order, once the last one is done.
+   With -R the bitmaps are not rendered one at a time: their LaTeX is kept
+   and rendered at the end as the pages of a single document (or of #
+   documents with -r#), so latex starts and reads the preamble only once. */
+
+THREAD_LOCAL int g_render_jobs = 0;
+THREAD_LOCAL int g_render_batch = FALSE;
+
+#ifdef UNIX
+
+#define DEFERRED_BITMAP "{\\*\\l2rbitmap "
+
+typedef struct {
+    char *stem;
+    char key[RENDER_KEY_SIZE];
+    char *pre;
+    char *page;                 /* the LaTeX of its page with -R, else NULL */
+    double scale;
+    spawnProcess latex2png;     /* its pid is 0 once it has finished */
+    int status;
+} deferredBitmap;
+
+static THREAD_LOCAL FILE *deferred_rtf = NULL;
+static THREAD_LOCAL deferredBitmap *deferred = NULL;
+static THREAD_LOCAL int deferred_count = 0;
+static THREAD_LOCAL int deferred_reserved = 0;
+static THREAD_LOCAL int deferred_running = 0;
+static THREAD_LOCAL int deferred_oldest = 0;   /* no job before this one runs */
+static THREAD_LOCAL char *batch_preamble = NULL;
+
+static void WaitForBitmap(int n)
+{
+    deferredBitmap *d = &deferred[n];
+
+    if (d->latex2png.pid == 0)
+        return;
+    d->status = SpawnWait(&d->latex2png);
+    deferred_running--;
+}
+
+/******************************************************************************
+ purpose   : add a bitmap to the list and put its placeholder in the RTF file
+ ******************************************************************************/
+static deferredBitmap *AddDeferredBitmap(const char *tex_file_stem, const char *key, double scale, const char *pre)
+{
+    deferredBitmap *d;
+
+    if (deferred_count == deferred_reserved) {
+        deferred_reserved = (deferred_reserved) ? 2 * deferred_reserved : 32;
+        deferred = (deferredBitmap *) realloc(deferred, deferred_reserved * sizeof(deferredBitmap));
+        if (deferred == NULL)
+            diagnostics(ERROR, "Cannot allocate memory for bitmaps");
+    }
+
+    d = &deferred[deferred_count];
+    d->stem = strdup(tex_file_stem);
+    my_strcpy(d->key, key);
+    d->pre = strdup(pre);
+    d->page = NULL;
+    d->scale = scale;
+    d->latex2png.pid = 0;
+    d->status = 0;
+
+    fprintRTF(DEFERRED_BITMAP "%d}", deferred_count++);
+    return d;
+}
+
+/******************************************************************************
+ purpose   : keep the LaTeX of tex_file_stem.tex to render it later as a page
+             of one document with the other bitmaps (-R)
+ returns   : FALSE if its preamble differs and it must be rendered now
+ ******************************************************************************/
+static int BatchLatexBitmap(const char *tex_file_stem, const char *key, double scale, const char *pre)
+{
+    char *text, *page, *end;
+    deferredBitmap *d;
+
+    text = ReadLatexFile(tex_file_stem);
+    if (text == NULL)
+        return FALSE;
+
+    page = strstr(text, BEGIN_DOCUMENT);
+    end = (page) ? strstr(page, END_DOCUMENT) : NULL;
+    if (end == NULL) {
+        free(text);
+        return FALSE;
+    }
+    *page = '\0';
+    *end = '\0';
+    page += strlen(BEGIN_DOCUMENT);
+
+    if (batch_preamble == NULL)
+        batch_preamble = strdup(text);
+    else if (strcmp(batch_preamble, text) != 0) {
+        free(text);
+        return FALSE;
+    }
+
+    d = AddDeferredBitmap(tex_file_stem, key, scale, pre);
+    d->page = strdup(page);
+    d->status = -1;             /* until its page is rendered */
+    free(text);
+    return TRUE;
+}
+
+/******************************************************************************
+ purpose   : start latex2png for tex_file_stem.tex in the background and put
+             a placeholder for the bitmap in the RTF file
+ returns   : FALSE if the bitmap must be made now
+ ******************************************************************************/
+static int DeferLatexBitmap(const char *tex_file_stem, const char *key, double scale, const char *pre)
+{
+    char *png_file_name, *tmp_path;
+    spawnArgs a;
+    spawnProcess latex2png;
+
+    if (deferred_rtf == NULL || fRtf != deferred_rtf)
+        return FALSE;
+
+    if (g_render_batch)
+        return BatchLatexBitmap(tex_file_stem, key, scale, pre);
+
+    png_file_name = strdup_together(tex_file_stem, ".png");
+    tmp_path = GraphicsCommand(CONVERT_LATEX_TO_PNG, g_dots_per_inch / 60 + 1, (uint16_t) g_dots_per_inch,
+                               tex_file_stem, png_file_name, &a);
+    safe_free(png_file_name);
+    if (tmp_path == NULL) {
+        SpawnArgsFree(&a);
+        return FALSE;
+    }
+    safe_free(tmp_path);
+
+    /* keep at most g_render_jobs running, the oldest is likely done first */
+    while (deferred_running >= g_render_jobs)
+        WaitForBitmap(deferred_oldest++);
+
+    if (!SpawnStart(&latex2png, &a)) {
+        SpawnArgsFree(&a);
+        return FALSE;
+    }
+    SpawnArgsFree(&a);
+
+    AddDeferredBitmap(tex_file_stem, key, scale, pre)->latex2png = latex2png;
+    deferred_running++;
+    return TRUE;
+}
+
+/******************************************************************************
+ purpose   : write the pages of the bitmaps first..last as one LaTeX file
+ returns   : the stem of the file, or NULL
+ ******************************************************************************/
+static char *WriteBatchFile(int first, int last)
+{
+    char *stem, *name;
+    FILE *f;
+    int i;
+
+    stem = strdup_together(deferred[first].stem, "_batch");
+    name = strdup_together(stem, ".tex");
+    f = fopen(name, "w");
+    free(name);
+    if (f == NULL) {
+        diagnostics(WARNING, "Could not open '%s.tex' to render bitmaps", stem);
+        free(stem);
+        return NULL;
+    }
+
+    /* latex2png -b checks the number of pages and finds the baseline of the inline ones */
+    fputs(batch_preamble, f);
+    fprintf(f, "%%L2R_PAGES %d\n%%INLINE_PAGES", last - first + 1);
+    for (i = first; i <= last; i++) {
+        if (strstr(deferred[i].page, "%INLINE_DOT_ON_BASELINE"))
+            fprintf(f, " %d", i - first + 1);
+    }
+
+    /* each page starts out like a file of its own: its definitions are
+       local and the counters that a bitmap may show begin at zero.  This
+       comes after \begin{document}, which is where a format of the
+       preamble (-y) takes over */
+    fputs("\n" BEGIN_DOCUMENT "\\pagestyle{empty}\n\\makeatletter\n"
+          "\\newcommand\\LtoRpage{\\@for\\LtoR@c:=figure,table,footnote\\do"
+          "{\\@ifundefined{c@\\LtoR@c}{}{\\setcounter{\\LtoR@c}{0}}}}\n"
+          "\\makeatother\n", f);
+    for (i = first; i <= last; i++)
+        fprintf(f, "\\LtoRpage\n\\begingroup\n%s\n\\endgroup\n\\clearpage\n", deferred[i].page);
+    fputs("\\end{document}\n", f);
+    fclose(f);
+    return stem;
+}
+
+/******************************************************************************
+ purpose   : give page n of the batch the names latex2png would have used
+             for tex_file_stem alone
+ returns   : 0 if there is a bitmap for the page
+ ******************************************************************************/
+static int MoveBatchPage(const char *batch, int n, const char *tex_file_stem)
+{
+    char number[32], *from, *to;
+    int status;
+
+    snprintf(number, sizeof(number), "-%d", n);
+
+    from = strdup_together3(batch, number, ".png");
+    to = strdup_together(tex_file_stem, ".png");
+    status = rename(from, to);
+    free(from);
+    free(to);
+
+    from = strdup_together3(batch, number, ".pbm");
+    to = strdup_together(tex_file_stem, ".pbm");
+    remove(to);
+    rename(from, to);
+    free(from);
+    free(to);
+
+    return status;
+}
+
+/******************************************************************************
+ purpose   : render the pages kept by -R as g_render_jobs documents at once
+ ******************************************************************************/
+static void RenderBatches(void)
+{
+    char *tmp_path, **stem;
+    spawnArgs a;
+    spawnProcess *latex2png;
+    int c, i, first, last, per, batches, status;
+
+    if (deferred_count == 0 || deferred[0].page == NULL)
+        return;
+
+    batches = (g_render_jobs > 1) ? g_render_jobs : 1;
+    per = (deferred_count + batches - 1) / batches;
+    batches = (deferred_count + per - 1) / per;
+
+    stem = (char **) calloc(batches, sizeof(char *));
+    latex2png = (spawnProcess *) calloc(batches, sizeof(spawnProcess));
+    if (stem == NULL || latex2png == NULL)
+        diagnostics(ERROR, "Cannot allocate memory to render bitmaps");
+
+    for (c = 0; c < batches; c++) {
+        first = c * per;
+        last = (first + per < deferred_count) ? first + per - 1 : deferred_count - 1;
+        latex2png[c].status = -1;
+        stem[c] = WriteBatchFile(first, last);
+        if (stem[c] == NULL)
+            continue;
+        tmp_path = GraphicsCommand(CONVERT_LATEX_BATCH, g_dots_per_inch / 60 + 1, (uint16_t) g_dots_per_inch,
+                                   stem[c], stem[c], &a);
+        if (tmp_path != NULL)
+            SpawnStart(&latex2png[c], &a);
+        safe_free(tmp_path);
+        SpawnArgsFree(&a);
+    }
+
+    for (c = 0; c < batches; c++) {
+        first = c * per;
+        last = (first + per < deferred_count) ? first + per - 1 : deferred_count - 1;
+        status = SpawnWait(&latex2png[c]);
+        if (status != 0) {
+            if (stem[c])
+                diagnostics(WARNING, "latex2png failed to render '%s.tex', rendering its %d bitmaps one by one",
+                            stem[c], last - first + 1);
+        } else {
+            for (i = first; i <= last; i++)
+                deferred[i].status = MoveBatchPage(stem[c], i - first + 1, deferred[i].stem);
+        }
+        safe_free(stem[c]);
+    }
+
+    diagnostics(2, "Rendered %d bitmaps with %d LaTeX runs", deferred_count, batches);
+    free(stem);
+    free(latex2png);
+}
+
+static void ForgetDeferredBitmaps(void)
+{
+    int i;
+
+    for (i = 0; i < deferred_count; i++) {
+        WaitForBitmap(i);
+        free(deferred[i].stem);
+        free(deferred[i].pre);
+        safe_free(deferred[i].page);
+    }
+    free(deferred);
+    deferred = NULL;
+    deferred_count = deferred_reserved = deferred_running = deferred_oldest = 0;
+    deferred_rtf = NULL;
+    safe_free(batch_preamble);
+    batch_preamble = NULL;
+}
+
+#else
+
+static int DeferLatexBitmap(const char *tex_file_stem, const char *key, double scale, const char *pre)
+{
+    return FALSE;
+}
+
+static void ForgetDeferredBitmaps(void)
+{
+}
+
+#endif
+
+void BeginDeferredBitmaps(FILE *rtf)
+
+/******************************************************************************
+  purpose: let bitmaps for the RTF file rtf be rendered in the background.
+           rtf must be open for reading too, see FinishDeferredBitmaps(),
+           so bitmaps for stdout are rendered one at a time as they come
+ ******************************************************************************/
+{
+    ForgetDeferredBitmaps();
+#ifdef UNIX
+    if ((g_render_jobs > 1 || g_render_batch) && rtf != stdout)
+        deferred_rtf = rtf;
+#endif
+}
+
+void FinishDeferredBitmaps(void)
+
+/******************************************************************************
+  purpose: wait for the bitmaps rendered in the background and rewrite the
+           RTF file with the bitmaps in place of their placeholders
+ ******************************************************************************/
+{
+#ifdef UNIX
+    FILE *rtf = deferred_rtf;
+    char *text, *s, *t, *end, *png_file_name, *tmp_path;
+    deferredBitmap *d;
+    long size;
+    int n;
+
+    deferred_rtf = NULL;
+    if (rtf == NULL || deferred_count == 0) {
+        ForgetDeferredBitmaps();
+        return;
+    }
+
+    RenderBatches();
+
+    fflush(rtf);
+    fseek(rtf, 0, SEEK_END);
+    size = ftell(rtf);
+    text = (char *) malloc(size + 1);
+    if (text == NULL)
+        diagnostics(ERROR, "Cannot allocate memory to insert the bitmaps");
+    rewind(rtf);
+    if (fread(text, 1, size, rtf) != (size_t) size)
+        diagnostics(ERROR, "Cannot read back the RTF file to insert the bitmaps");
+    text[size] = '\0';
+    end = text + size;
+
+    /* the bitmaps are never shorter than their placeholders */
+    rewind(rtf);
+    for (s = text; (t = strstr(s, DEFERRED_BITMAP)) != NULL; s = strchr(t, '}') + 1) {
+        fwrite(s, 1, t - s, rtf);
+        n = atoi(t + strlen(DEFERRED_BITMAP));
+        d = &deferred[n];
+        WaitForBitmap(n);
+
+        /* a page that did not come out of the batch is rendered on its own */
+        if (d->status != 0 && d->page != NULL) {
+            png_file_name = strdup_together(d->stem, ".png");
+            tmp_path = SysGraphicsConvert(CONVERT_LATEX_TO_PNG, g_dots_per_inch / 60 + 1,
+                                          (uint16_t) g_dots_per_inch, d->stem, png_file_name);
+            d->status = (tmp_path == NULL);
+            safe_free(tmp_path);
+            safe_free(png_file_name);
+        }
+
+        if (d->status != 0)
+            diagnostics(WARNING, "PutLatexFile failed to convert '%s.tex' to '%s.png'", d->stem, d->stem);
+        else
+            FinishLatexBitmap(d->stem, d->key, d->scale, d->pre);
+    }
+    fwrite(s, 1, end - s, rtf);
+    fflush(rtf);
+    if (ftruncate(fileno(rtf), ftell(rtf)) != 0)
+        diagnostics(WARNING, "Cannot truncate the RTF file");
+    fseek(rtf, 0, SEEK_END);
+
+    free(text);
+    ForgetDeferredBitmaps();
+#endif
+}
+
+/******************************************************************************
+ purpose   : Convert LaTeX to Bitmap and insert in RTF file
+ ******************************************************************************/
+static void PutLatexFile(const char *tex_file_stem, const char *key, double scale, const char *pre, conversion_t convertTo, int hinline)
+{
+    char *png_file_name = NULL;
+    char *tmp_path;
+    int  bmoffset;
+    double baseline = 0;
+    uint16_t png_resolution=0;
         
     if (convertTo == EPS) {
     	char *eps_file_name = NULL;
@@ -1733,47 +2284,25 @@ static void PutLatexFile(const char *tex_file_stem, double scale, const char *pr
     
     png_resolution = (uint16_t) g_dots_per_inch;
     
-    png_file_name = strdup_together(tex_file_stem, ".png");
-    tmp_path = SysGraphicsConvert(CONVERT_LATEX_TO_PNG, bmoffset, png_resolution, tex_file_stem, png_file_name);
-
-    if (NULL == tmp_path) {
-        diagnostics(WARNING, "PutLatexFile failed to convert '%s.tex' to '%s'",tex_file_stem,png_file_name);
+    /* the same LaTeX was rendered before, by this or an earlier run */
+    png_file_name = RenderCacheFind(key, &baseline);
+    if (png_file_name) {
+        PutLatexPng(png_file_name, scale, baseline, png_resolution);
         safe_free(png_file_name);
         return;
     }
-    
-    /* Figures can only have so many bits ... figure out the width and height
-       and if these are too large then reduce resolution and make a new bitmap */
-    GetPngSize(png_file_name, &png_width, &png_height, &png_xres, &png_yres, &bad_res);
 
-    if (png_width  > max_fig_size || png_height > max_fig_size) {
-            
-        if (png_height && png_height > png_width) 
-            png_resolution = (uint16_t)((double)g_dots_per_inch / (double)png_height * max_fig_size);
-        else
-            png_resolution = (uint16_t)((double)g_dots_per_inch / (double)png_width * max_fig_size);
+    PreparePreambleFormat(tex_file_stem);
+    if (DeferLatexBitmap(tex_file_stem, key, scale, pre))
+        return;
 
-        safe_free(tmp_path);
-        tmp_path = SysGraphicsConvert(CONVERT_LATEX_TO_PNG, bmoffset, png_resolution, tex_file_stem, png_file_name);
-        if (tmp_path == NULL) {
-            safe_free(png_file_name);
-            return;
-        }
-        
-        GetPngSize(png_file_name, &png_width, &png_height, &png_xres, &png_yres, &bad_res);
-    }
-    
-    /* we have a png file of the latex now ... insert it after figuring out offset and scaling */
+    png_file_name = strdup_together(tex_file_stem, ".png");
+    tmp_path = SysGraphicsConvert(CONVERT_LATEX_TO_PNG, bmoffset, png_resolution, tex_file_stem, png_file_name);
 
-    baseline = GetBaseline(tex_file_stem, pre);
-    
-    diagnostics(3, "PutLatexFile bitmap has (height=%d,width=%d) baseline=%g  resolution=%u", 
-                                    png_height, png_width, baseline, png_resolution);
-    
-    height_goal = (scale * png_height * POINTS_PER_METER / png_yres * 20.0 + 0.5);
-    width_goal  = (scale * png_width  * POINTS_PER_METER / png_xres * 20.0 + 0.5);
-    
-    PutPngFile(png_file_name, height_goal, width_goal, scale*100, baseline);
+    if (NULL == tmp_path)
+        diagnostics(WARNING, "PutLatexFile failed to convert '%s.tex' to '%s'",tex_file_stem,png_file_name);
+    else
+        FinishLatexBitmap(tex_file_stem, key, scale, pre);
     
     safe_free(tmp_path);
     safe_free(png_file_name);
@@ -1782,21 +2311,102 @@ static void PutLatexFile(const char *tex_file_stem, double scale, const char *pr
 /* this is more general than just equations because it is used to create
    documents for the latex picture, music, tikzpicture environments also */
    
+static THREAD_LOCAL int equation_file_number = 0;
+static THREAD_LOCAL int equation_file_worker = 0;
+
+void setEquationFileNumber(int n)
+
+/******************************************************************************
+  purpose: number the next l2r_NNNN.tex file from n+1 so that workers
+           converting sections at the same time do not share file names
+ ******************************************************************************/
+{
+    equation_file_number = n;
+}
+
+void setEquationFileWorker(int n)
+
+/******************************************************************************
+  purpose: name the l2r_*.tex files of document worker n (see pool.c)
+           l2r_n_NNNN.tex so that workers sharing a tmp directory do not
+           overwrite each other's files
+ ******************************************************************************/
+{
+    equation_file_worker = n;
+}
+
+void ResetGraphics(void)
+
+/******************************************************************************
+  purpose: forget the \graphicspath, \psset, \psnewstyle and tikz libraries
+           of the previous document and number equation files from 1 again
+ ******************************************************************************/
+{
+    int i;
+
+    for (i = 0; i < nGraphicsPathElems; i++)
+        free(graphicsPath[i]);
+    free(graphicsPath);
+    graphicsPath = NULL;
+    nGraphicsPathElems = 0;
+
+    for (i = 0; i < tikzlibsnum && i < 31; i++)
+        safe_free(tikzlibs[i]);
+    tikzlibsnum = 0;
+
+    safe_free(g_psset_info);
+    safe_free(g_psstyle_info);
+    g_psset_info = g_psstyle_info = NULL;
+
+    equation_file_number = 0;
+    ResetRenderCache();
+    ForgetDeferredBitmaps();
+    safe_free(preamble_format);
+    preamble_format = NULL;
+    preamble_format_key[0] = '\0';
+}
+
+static void PutEquationText(FILE *f, renderHash *h, const char *s)
+{
+    fputs(s, f);
+    RenderHashAdd(h, s);
+}
+
+/******************************************************************************
+ purpose   : true if the LaTeX of a bitmap would show the equation counter
+ ******************************************************************************/
+static int ShowsEquationNumber(const char *pre, const char *eq)
+{
+    const char *numbered[] = { "{equation}", "{eqnarray}", "{align}", "{alignat}",
+                               "{flalign}", "{gather}", "{multline}", "\\theequation" };
+    int i;
+
+    for (i = 0; i < (int) (sizeof(numbered) / sizeof(numbered[0])); i++) {
+        if (strstr(pre, numbered[i]) || strstr(eq, numbered[i]))
+            return TRUE;
+    }
+    return FALSE;
+}
+
 static char *SaveEquationAsFile(const char *post_begin_document,
-                                const char *pre, const char *eq_with_spaces, const char *post)
+                                const char *pre, const char *eq_with_spaces, const char *post,
+                                char *key)
 {
     FILE *f;
-    char name[15];
+    char name[32], counter[64];
     char *tmp_dir, *tex_file_stem, *tex_file_name, *eq;
-    static int file_number = 0;
+    renderHash h;
 
     if (!pre || !eq_with_spaces || !post)
         return NULL;
 
 /* create needed file names */
-    file_number++;
+    equation_file_number++;
     tmp_dir = getTmpPath();
-    snprintf(name, 15, "l2r_%04d", file_number);
+    if (equation_file_worker > 0)
+        snprintf(name, sizeof(name), "l2r_%d_%04d", equation_file_worker, equation_file_number);
+    else
+        snprintf(name, sizeof(name), "l2r_%04d", equation_file_number);
     tex_file_stem = strdup_together(tmp_dir, name);
     safe_free(tmp_dir);
 
@@ -1816,33 +2426,54 @@ static char *SaveEquationAsFile(const char *post_begin_document,
     
     eq = strdup_noendblanks(eq_with_spaces);
     
-    fprintf(f, "%s", g_preamble);
-    fprintf(f, "\\thispagestyle{empty}\n");
-    fprintf(f, "\\begin{document}\n");
-    if (post_begin_document) 
-            fprintf(f, "%s\n", post_begin_document);
+    /* the key for the render cache is made from the text of the file,
+       leaving out the equation counter unless the bitmap shows it */
+    RenderHashInit(&h);
+    PutEquationText(f, &h, g_preamble);
+    PutEquationText(f, &h, "\\thispagestyle{empty}\n");
+    PutEquationText(f, &h, "\\begin{document}\n");
+    if (post_begin_document) {
+            PutEquationText(f, &h, post_begin_document);
+            PutEquationText(f, &h, "\n");
+    }
             
-    fprintf(f, "\\setcounter{equation}{%d}\n", getCounter("equation"));
+    snprintf(counter, sizeof(counter), "\\setcounter{equation}{%d}\n", getCounter("equation"));
+    fputs(counter, f);
     
     if ( streq(pre, "$") || streq(pre, "\\begin{math}") || streq(pre, "\\(") ) {
-        fprintf(f, "%%INLINE_DOT_ON_BASELINE\n");
-        if ((g_equation_inline_eps) || (g_equation_display_eps)) {
-        fprintf(f, "%s\n^I_g%s\n%s", pre, eq, post);  
-        }
-        else {
-        fprintf(f, "%s\n.\\quad %s\n%s", pre, eq, post);  
-        }
+        PutEquationText(f, &h, "%INLINE_DOT_ON_BASELINE\n");
+        PutEquationText(f, &h, pre);
+        if ((g_equation_inline_eps) || (g_equation_display_eps))
+            PutEquationText(f, &h, "\n^I_g");
+        else
+            PutEquationText(f, &h, "\n.\\quad ");
+        PutEquationText(f, &h, eq);
+        PutEquationText(f, &h, "\n");
+        PutEquationText(f, &h, post);
     } 
-    else if (strstr(pre, "equation"))
+    else if (strstr(pre, "equation")) {
         /* fprintf(f, "$$%s$$", eq);  WH 2014-01-17*/
-        fprintf(f, "\\begin{displaymath}\n%s\n\\end{displaymath}", eq);  /* WH 2014-04-03*/
-    else
-        fprintf(f, "%s\n%s\n%s", pre, eq, post);
+        PutEquationText(f, &h, "\\begin{displaymath}\n");   /* WH 2014-04-03*/
+        PutEquationText(f, &h, eq);
+        PutEquationText(f, &h, "\n\\end{displaymath}");
+    } else {
+        PutEquationText(f, &h, pre);
+        PutEquationText(f, &h, "\n");
+        PutEquationText(f, &h, eq);
+        PutEquationText(f, &h, "\n");
+        PutEquationText(f, &h, post);
+        if (ShowsEquationNumber(pre, eq))
+            RenderHashAdd(&h, counter);
+    }
 
-    fprintf(f, "\n\\end{document}");
+    PutEquationText(f, &h, "\n\\end{document}");
     fclose(f);
     free(eq);
 
+    RenderHashAddInt(&h, g_dots_per_inch);
+    RenderHashAdd(&h, g_home_dir);
+    RenderHashKey(&h, key);
+
     return tex_file_stem;
 }
 
@@ -1879,7 +2510,7 @@ static char * abbreviate(const char *s, int len)
     if (n<len) {
         t =strdup(s);
     } else { 
-        t = (char *) malloc(len * sizeof(char));
+        t = (char *) malloc((len + 1) * sizeof(char));
         
         half = (len - 6)/2;
         for (i=0; i<=half; i++)
@@ -1907,7 +2538,7 @@ static char * abbreviate(const char *s, int len)
 void WriteLatexAsBitmapOrEPS(char *pre, char *eq, char *post, conversion_t convertTo)
 {
     char *p, *abbrev, *latex_to_convert;
-    char *name = NULL;
+    char *name = NULL, key[RENDER_KEY_SIZE];
     int hinline = 0;
     
     /* go to a bit a trouble to give the user some feedback */
@@ -1926,9 +2557,9 @@ void WriteLatexAsBitmapOrEPS(char *pre, char *eq, char *post, conversion_t conve
         if (p && strlen(p) > 6) /* found one ... is there a second? */
             p = strstr(p + 6, "\\label");
         if (p == NULL)
-            name = SaveEquationAsFile(NULL, "\\begin{eqnarray*}", eq, "\\end{eqnarray*}");
+            name = SaveEquationAsFile(NULL, "\\begin{eqnarray*}", eq, "\\end{eqnarray*}", key);
         else
-            name = SaveEquationAsFile(NULL, pre, eq, post);
+            name = SaveEquationAsFile(NULL, pre, eq, post, key);
 
     } else if (pre && streq(pre, "\\begin{align}")) {
 
@@ -1937,17 +2568,17 @@ void WriteLatexAsBitmapOrEPS(char *pre, char *eq, char *post, conversion_t conve
             p = strstr(p + 6, "\\label");
             
         if (p)
-            name = SaveEquationAsFile(NULL, pre, eq, post);
+            name = SaveEquationAsFile(NULL, pre, eq, post, key);
         else
-            name = SaveEquationAsFile(NULL, "\\begin{align*}", eq, "\\end{align*}");
+            name = SaveEquationAsFile(NULL, "\\begin{align*}", eq, "\\end{align*}", key);
             
     } else if (pre && (strstr(pre, "psgraph") || strstr(pre, "pspicture")) ){
         p = strdup_together(g_psset_info, g_psstyle_info);
-        name = SaveEquationAsFile(p, pre, eq, post);
+        name = SaveEquationAsFile(p, pre, eq, post, key);
         safe_free(p);
         
     } else  {
-        name = SaveEquationAsFile(NULL, pre, eq, post);
+        name = SaveEquationAsFile(NULL, pre, eq, post, key);
         if ( streq(pre, "$") || streq(pre, "\\begin{math}") || streq(pre, "\\(") ) 
             hinline=1;
     }
@@ -1961,9 +2592,9 @@ void WriteLatexAsBitmapOrEPS(char *pre, char *eq, char *post, conversion_t conve
             || strstr(pre, "psgraph")
             || strstr(pre, "pspicture")
             || strstr(pre, "tikzpicture")) 
-            PutLatexFile(name, g_png_figure_scale, pre, convertTo, hinline);
+            PutLatexFile(name, key, g_png_figure_scale, pre, convertTo, hinline);
         else
-            PutLatexFile(name, g_png_equation_scale, pre, convertTo, hinline);
+            PutLatexFile(name, key, g_png_equation_scale, pre, convertTo, hinline);
 
         safe_free(name);
     }
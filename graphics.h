@@ -22,4 +22,13 @@ void CmdTikzlib(int code);
 void CmdPsset(int code);
 void CmdNewPsStyle(int code);
 void CmdGraphicsPath(int code);
+void setEquationFileNumber(int n);
+void setEquationFileWorker(int n);
+void ResetGraphics(void);
+void BeginDeferredBitmaps(FILE *rtf);
+void FinishDeferredBitmaps(void);
+
+extern THREAD_LOCAL int g_render_jobs;
+extern THREAD_LOCAL int g_render_batch;
+extern THREAD_LOCAL int g_preamble_format;
 #endif
@@ -0,0 +1,270 @@
+/* hash.c - string keyed hash tables used for the various lookup tables
+
+Copyright (C) 2014 The Free Software Foundation
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+This file is available from http://sourceforge.net/projects/latex2rtf/
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "main.h"
+#include "hash.h"
+
+/******************************************************************************
+ purpose:  FNV-1a hash of a NUL terminated string
+******************************************************************************/
+unsigned long hashString(const char *s)
+{
+    unsigned long h = 2166136261UL;
+
+    while (*s) {
+        h ^= (unsigned char) *s++;
+        h *= 16777619UL;
+    }
+    return h;
+}
+
+/******************************************************************************
+ purpose:  allocate an empty table with room for about 'size' entries
+******************************************************************************/
+hashTable *hashNew(int size)
+{
+    hashTable *h;
+    int n = 16;
+
+    while (n < size)
+        n *= 2;
+
+    h = (hashTable *) malloc(sizeof(hashTable));
+    if (h)
+        h->bucket = (hashEntry **) calloc(n, sizeof(hashEntry *));
+    if (h == NULL || h->bucket == NULL)
+        diagnostics(ERROR, "Cannot allocate hash table of size %d", n);
+
+    h->buckets = n;
+    h->count = 0;
+    return h;
+}
+
+/******************************************************************************
+ purpose:  remove all entries, optionally freeing the values as well
+******************************************************************************/
+void hashClear(hashTable *h, void (*free_value) (void *))
+{
+    int i;
+    hashEntry *e, *next;
+
+    if (h == NULL)
+        return;
+
+    for (i = 0; i < h->buckets; i++) {
+        for (e = h->bucket[i]; e; e = next) {
+            next = e->next;
+            if (free_value && e->value)
+                free_value(e->value);
+            free(e->key);
+            free(e);
+        }
+        h->bucket[i] = NULL;
+    }
+    h->count = 0;
+}
+
+/******************************************************************************
+ purpose:  release a table and all of its entries
+******************************************************************************/
+void hashFree(hashTable *h, void (*free_value) (void *))
+{
+    if (h == NULL)
+        return;
+    hashClear(h, free_value);
+    free(h->bucket);
+    free(h);
+}
+
+/******************************************************************************
+ purpose:  double the number of buckets once the chains get long
+******************************************************************************/
+static void hashGrow(hashTable *h)
+{
+    int i, n = h->buckets * 2;
+    hashEntry **bucket, *e, *next;
+
+    bucket = (hashEntry **) calloc(n, sizeof(hashEntry *));
+    if (bucket == NULL)
+        return;                 /* keep the old, slower, table */
+
+    for (i = 0; i < h->buckets; i++) {
+        for (e = h->bucket[i]; e; e = next) {
+            next = e->next;
+            e->next = bucket[e->code & (n - 1)];
+            bucket[e->code & (n - 1)] = e;
+        }
+    }
+    free(h->bucket);
+    h->bucket = bucket;
+    h->buckets = n;
+}
+
+/******************************************************************************
+ purpose:  returns the entry for key or NULL if key is not in the table
+******************************************************************************/
+hashEntry *hashLookup(hashTable *h, const char *key)
+{
+    unsigned long code;
+    hashEntry *e;
+
+    if (h == NULL || key == NULL)
+        return NULL;
+
+    code = hashString(key);
+    for (e = h->bucket[code & (h->buckets - 1)]; e; e = e->next) {
+        if (e->code == code && strcmp(e->key, key) == 0)
+            return e;
+    }
+    return NULL;
+}
+
+/******************************************************************************
+ purpose:  returns the value stored for key or NULL
+******************************************************************************/
+void *hashFind(hashTable *h, const char *key)
+{
+    hashEntry *e = hashLookup(h, key);
+
+    return e ? e->value : NULL;
+}
+
+/******************************************************************************
+ purpose:  store value under key, replacing any value already present
+ returns:  the entry holding the value
+******************************************************************************/
+hashEntry *hashInsert(hashTable *h, const char *key, void *value)
+{
+    unsigned long code;
+    hashEntry *e = hashLookup(h, key);
+
+    if (e) {
+        e->value = value;
+        return e;
+    }
+
+    if (h->count >= h->buckets)
+        hashGrow(h);
+
+    code = hashString(key);
+    e = (hashEntry *) malloc(sizeof(hashEntry));
+    if (e == NULL || (e->key = strdup(key)) == NULL)
+        diagnostics(ERROR, "Cannot allocate hash entry for '%s'", key);
+
+    e->value = value;
+    e->code = code;
+    e->next = h->bucket[code & (h->buckets - 1)];
+    h->bucket[code & (h->buckets - 1)] = e;
+    h->count++;
+    return e;
+}
+
+/******************************************************************************
+ purpose:  store value under key unless key is already present
+ returns:  TRUE when the value was added
+******************************************************************************/
+int hashAdd(hashTable *h, const char *key, void *value)
+{
+    if (hashLookup(h, key))
+        return FALSE;
+    hashInsert(h, key, value);
+    return TRUE;
+}
+
+/******************************************************************************
+ purpose:  remove key from the table
+ returns:  the value that was stored so that the caller may free it
+******************************************************************************/
+void *hashRemove(hashTable *h, const char *key)
+{
+    unsigned long code;
+    hashEntry **p, *e;
+    void *value;
+
+    if (h == NULL || key == NULL)
+        return NULL;
+
+    code = hashString(key);
+    for (p = &h->bucket[code & (h->buckets - 1)]; (e = *p) != NULL; p = &e->next) {
+        if (e->code == code && strcmp(e->key, key) == 0) {
+            *p = e->next;
+            value = e->value;
+            free(e->key);
+            free(e);
+            h->count--;
+            return value;
+        }
+    }
+    return NULL;
+}
+
+/******************************************************************************
+ purpose:  a fine grained clock for hashStatsCount(), only read with -X
+******************************************************************************/
+double hashStatsStart(void)
+{
+#ifdef UNIX
+    struct timespec ts;
+
+    if (!g_lookup_stats)
+        return 0;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+    if (!g_lookup_stats)
+        return 0;
+    return (double) clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+/******************************************************************************
+ purpose:  count one lookup that started at start and found found
+******************************************************************************/
+void hashStatsCount(hashStats *s, const void *found, double start)
+{
+    if (!g_lookup_stats)
+        return;
+    s->lookups++;
+    if (found)
+        s->found++;
+    s->seconds += hashStatsStart() - start;
+}
+
+/******************************************************************************
+ purpose:  print the lookups of a table holding entries entries (-X)
+******************************************************************************/
+void hashStatsReport(hashStats *s, int entries)
+{
+    if (!g_lookup_stats)
+        return;
+    diagnostics(WARNING, "%-10s %6d entries %8ld lookups %8ld found %9.6f s",
+                s->name, entries, s->lookups, s->found, s->seconds);
+}
+
+void hashStatsReset(hashStats *s)
+{
+    s->lookups = 0;
+    s->found = 0;
+    s->seconds = 0;
+}
@@ -0,0 +1,63 @@
+/* hash.h - string keyed hash tables
+
+Copyright (C) 2014 The Free Software Foundation
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+This file is available from http://sourceforge.net/projects/latex2rtf/
+*/
+
+#ifndef _HASH_H_INCLUDED
+#define _HASH_H_INCLUDED 1
+
+typedef struct hashEntryTag {
+    char *key;                      /* private copy of the key */
+    void *value;                    /* owned by the caller */
+    unsigned long code;             /* full hash value of key */
+    struct hashEntryTag *next;
+} hashEntry;
+
+typedef struct hashTableTag {
+    hashEntry **bucket;
+    int buckets;                    /* always a power of two */
+    int count;
+} hashTable;
+
+/* lookups of a table counted and timed with -X */
+typedef struct hashStatsTag {
+    const char *name;
+    long lookups;
+    long found;
+    double seconds;
+} hashStats;
+
+unsigned long hashString(const char *s);
+
+hashTable *hashNew(int size);
+void       hashClear(hashTable *h, void (*free_value) (void *));
+void       hashFree(hashTable *h, void (*free_value) (void *));
+
+hashEntry *hashLookup(hashTable *h, const char *key);
+void      *hashFind(hashTable *h, const char *key);
+hashEntry *hashInsert(hashTable *h, const char *key, void *value);
+int        hashAdd(hashTable *h, const char *key, void *value);
+void      *hashRemove(hashTable *h, const char *key);
+
+double     hashStatsStart(void);
+void       hashStatsCount(hashStats *s, const void *found, double start);
+void       hashStatsReport(hashStats *s, int entries);
+void       hashStatsReset(hashStats *s);
+
+#endif
@@ -89,7 +89,7 @@ static void IgnoreMeasure(void)
 
 /****************************************************************************
 purpose : ignores variable-formats shown in file "ignore.cfg"
-returns : TRUE if variable was ignored correctly, otherwise FALSE
+          RtfCommand is the ignore.cfg entry for \command
 
 #  SINGLE        ignore single command. e.g., \noindent
 #  NUMBER        simple numeric value e.g., \tolerance10000
@@ -103,17 +103,11 @@ returns : TRUE if variable was ignored correctly, otherwise FALSE
 #  ENVCMD        proceses contents of unknown environment as if it were plain latex
 #  ENVIRONMENT   ignores contents of that environment
  ****************************************************************************/
-int TryVariableIgnore(const char *command)
+void VariableIgnore(const char *command, const char *RtfCommand)
 {
-    const char *RtfCommand;
-    char *TexCommand, c;
+    char c;
         
-    TexCommand = strdup_together("\\", command);
-    RtfCommand = SearchCfgRtf(TexCommand, IGNORE_A);
-    free(TexCommand);
-    
     diagnostics(4, "Ignoring '%s' as '%s'", command, RtfCommand);
-    if (RtfCommand == NULL) return FALSE;
     
     if (strcmp(RtfCommand, "SINGLE") == 0) {
     
@@ -159,8 +153,6 @@ int TryVariableIgnore(const char *command)
     } else if (strcmp(RtfCommand, "ENVCMD") == 0) {
         PushEnvironment(IGNORE_MODE);
     } 
-    
-    return TRUE;
 }
 
 int TryPackageIgnore(const char *package) {
@@ -1,3 +1,3 @@
-int TryVariableIgnore(const char *command);
+void VariableIgnore(const char *command, const char *RtfCommand);
 void Ignore_Environment(char *endstring);
 int TryPackageIgnore(const char *package);
@@ -34,14 +34,17 @@ Authors:
 #include "parser.h"
 #include "utils.h"
 #include "auxfile.h"
+#include "hash.h"
 #include "labels.h"
 
-static labelElem *labelTable = NULL;
-static int labelCount = 0;
-static int labelReserved = 0;
+static THREAD_LOCAL labelElem *labelTable = NULL;
+static THREAD_LOCAL int labelCount = 0;
+static THREAD_LOCAL int labelReserved = 0;
+static THREAD_LOCAL hashTable *labelIndex = NULL;  /* name -> position + 1 */
+static THREAD_LOCAL hashStats labelStats = { "labels" };
 #define labelDelta 8
 
-/* reserve 8 labels in a row when we grow the label table */
+/* start with 8 labels and double the table when it is full */
 /* return pointer to new label or NULL if memory overflow */
 
 static labelElem *newLabel(char *name,char *def)
@@ -49,14 +52,12 @@ static labelElem *newLabel(char *name,char *def)
     labelElem *result = labelTable;
 
     if (labelCount == labelReserved) {
-        /* time to reserve another chunk */
-        /* of 8 labels                   */
+        int reserve = (labelReserved) ? 2 * labelReserved : labelDelta;
         result =
-            (labelElem *)realloc(labelTable,
-                                (labelReserved+labelDelta)*sizeof(labelElem));
+            (labelElem *)realloc(labelTable, reserve*sizeof(labelElem));
         if (NULL != result) {
             labelTable = result;
-            labelReserved += labelDelta;
+            labelReserved = reserve;
         }
     }
     
@@ -64,6 +65,11 @@ static labelElem *newLabel(char *name,char *def)
         result = &labelTable[labelCount++];
         result->labelName = name;
         result->labelDef  = def;
+
+        /* the first \newlabel of a name is the one that counts */
+        if (NULL == labelIndex)
+            labelIndex = hashNew(64);
+        hashAdd(labelIndex, name, (void *) (size_t) labelCount);
     }
     return result;
 }
@@ -71,15 +77,16 @@ static labelElem *newLabel(char *name,char *def)
 labelElem *getLabel(char *name)
 {
     labelElem *result = NULL;
-    int        label;
+    size_t     label;
+    double     start;
+
     LoadAuxFile();      /* LoadAuxFile if not already loaded */
     
-    for (label = 0; label < labelCount; label++) {
-        if (streq(name,labelTable[label].labelName)) {
-            result = &labelTable[label];
-            break;
-        }   
-    }
+    start = hashStatsStart();
+    label = (size_t) hashFind(labelIndex, name);
+    if (label > 0)
+        result = &labelTable[label - 1];
+    hashStatsCount(&labelStats, result, start);
     return result;
 }
 
@@ -149,6 +156,30 @@ char *getLabelDefinition(char *name)
     return result;
 }
 
+/* forget all labels read from the .aux file */
+
+void ResetLabels(void)
+{
+    int label;
+
+    for (label = 0; label < labelCount; label++) {
+        free(labelTable[label].labelName);
+        free(labelTable[label].labelDef);
+    }
+    free(labelTable);
+    labelTable = NULL;
+    labelCount = 0;
+    labelReserved = 0;
+    hashFree(labelIndex, NULL);
+    labelIndex = NULL;
+    hashStatsReset(&labelStats);
+}
+
+void ReportLabelStats(void)
+{
+    hashStatsReport(&labelStats, labelCount);
+}
+
 /*  \newlabel{sec:test}{{1.1}{1}} */
 
 void CmdNewLabel(int code)
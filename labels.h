@@ -16,5 +16,7 @@ char *getLabelSection(char *name);
 char *getLabelPage(char *name);
 char *getLabelNameref(char *name);
 
+void ResetLabels(void);
+void ReportLabelStats(void);
 void CmdNewLabel(int code);
 #endif
@@ -0,0 +1,57 @@
+/* latex2rtf.h - converting LaTeX to RTF from another program
+
+    Link with libl2r.a or libl2r.so and call
+
+        l2rResult result;
+
+        if (l2r_convert(latex, strlen(latex), "-P /usr/share/latex2rtf/cfg", &result) == 0)
+            fwrite(result.rtf, 1, result.rtf_size, out);
+        for (i = 0; i < result.diagnostic_count; i++)
+            fprintf(stderr, "%s:%d %s\n", result.diagnostics[i].file,
+                    result.diagnostics[i].line, result.diagnostics[i].message);
+        l2r_free_result(&result);
+
+    The options are those of the command line, separated by blanks.
+    The cfg files are read by the first call, later calls use the same
+    tables.  Errors abandon the conversion but never the calling program.
+    Every thread converts with its own state (and reads its own copy of
+    the cfg files), so several threads may call l2r_convert() at once.
+    That state lives until the thread calls l2r_thread_cleanup(), which
+    a thread that has converted should do before it exits.
+    -J forks the whole process and should not be used from threads.
+*/
+
+#ifndef _LATEX2RTF_H_INCLUDED
+#define _LATEX2RTF_H_INCLUDED 1
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+    int level;                  /* 0 error, 1 warning, 2-7 debugging */
+    char *file;                 /* LaTeX file being read, or "(Not set)" */
+    int line;
+    char *message;
+} l2rDiagnostic;
+
+typedef struct {
+    int status;                 /* 0 if converted, 1 after an error */
+    char *rtf;                  /* the RTF, also NUL terminated */
+    size_t rtf_size;
+    l2rDiagnostic *diagnostics;
+    int diagnostic_count;
+} l2rResult;
+
+int l2r_convert(const char *latex, size_t size, const char *options, l2rResult *result);
+void l2r_free_result(l2rResult *result);
+void l2r_thread_cleanup(void);
+int l2r_main(int argc, char **argv);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
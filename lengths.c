@@ -39,9 +39,9 @@ typedef struct {
     int distance;
 } length_type;
 
-length_type Lengths[MAX_LENGTHS];
+THREAD_LOCAL length_type Lengths[MAX_LENGTHS];
 
-static int iLengthCount = 0;
+static THREAD_LOCAL int iLengthCount = 0;
 
 static int existsLength(char *s)
 
@@ -116,6 +116,63 @@ int getLength(char *s)
     return Lengths[i].distance;
 }
 
+void resetLengths(void)
+
+/**************************************************************************
+     purpose: removes all lengths
+**************************************************************************/
+{
+    int i;
+
+    for (i = 0; i < iLengthCount; i++)
+        free(Lengths[i].name);
+    iLengthCount = 0;
+}
+
+char *saveLengths(void)
+
+/**************************************************************************
+     purpose: returns all lengths as "distance name" pairs on one line,
+              suitable for restoreLengths()
+**************************************************************************/
+{
+    int i;
+    size_t n = 2;
+    char *s, *t;
+
+    for (i = 0; i < iLengthCount; i++)
+        n += strlen(Lengths[i].name) + 16;
+
+    s = (char *) malloc(n);
+    if (s == NULL)
+        diagnostics(ERROR, "Cannot allocate memory to save lengths");
+
+    t = s;
+    for (i = 0; i < iLengthCount; i++) {
+        sprintf(t, "%d %s ", Lengths[i].distance, Lengths[i].name);
+        t += strlen(t);
+    }
+    strcpy(t, "\n");
+    return s;
+}
+
+void restoreLengths(char *s)
+
+/**************************************************************************
+     purpose: sets all lengths from the line returned by saveLengths()
+**************************************************************************/
+{
+    char name[256];
+    int d, n;
+
+    while (s && *s != '\n' && sscanf(s, "%d %255s%n", &d, name, &n) == 2) {
+        setLength(name, d);
+        s += n;
+        if (*s == ' ')
+            s++;
+    }
+}
+
 void CmdSetTexLength(int code)
 {
     int d;
@@ -15,3 +15,7 @@
 void setLength(char * s, int d);
 int getLength(char * s);
 void CmdSetTexLength(int code);
+
+void resetLengths(void);
+char *saveLengths(void);
+void restoreLengths(char *s);
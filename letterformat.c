@@ -33,12 +33,26 @@ Authors:
 #include "funct1.h"
 #include "convert.h"
 #include "vertical.h"
+#include "utils.h"
 
-static int g_letterOpened = FALSE; /* true after \opening */
+static THREAD_LOCAL int g_letterOpened = FALSE; /* true after \opening */
 
-static char *g_letterToAddress = NULL;
-static char *g_letterReturnAddress = NULL;
-static char *g_letterSignature = NULL;
+static THREAD_LOCAL char *g_letterToAddress = NULL;
+static THREAD_LOCAL char *g_letterReturnAddress = NULL;
+static THREAD_LOCAL char *g_letterSignature = NULL;
+
+void ResetLetter(void)
+
+/******************************************************************************
+ purpose: forget the addresses and signature of the previous document
+ ******************************************************************************/
+{
+    safe_free(g_letterToAddress);
+    safe_free(g_letterReturnAddress);
+    safe_free(g_letterSignature);
+    g_letterToAddress = g_letterReturnAddress = g_letterSignature = NULL;
+    g_letterOpened = FALSE;
+}
 
 void CmdSignature(int code)
 
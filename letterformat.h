@@ -2,6 +2,7 @@
 #define LETTER_CC 2
 #define LETTER_ENCL 3
 
+void ResetLetter(void);
 void CmdLetter(int code);
 void CmdAddress(int code);
 void CmdSignature(int code);
@@ -30,12 +30,15 @@ Authors:
 #define ERROUT stderr
 #endif 
 
+#define RTF_BUFFER_SIZE 65536   /* stdio buffer for the RTF file */
+
 #include <stdio.h>
 #include <ctype.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdarg.h>
 #include <errno.h>
+#include <setjmp.h>
 #include "main.h"
 #include "mygetopt.h"
 #include "convert.h"
@@ -58,96 +61,109 @@ Authors:
 #include "preparse.h"
 #include "vertical.h"
 #include "fields.h"
-
-FILE *fRtf = NULL;              /* file pointer to RTF file */
-char *g_tex_name = NULL;
-char *g_rtf_name = NULL;
-char *g_aux_name = NULL;
-char *g_toc_name = NULL;
-char *g_lof_name = NULL;
-char *g_lot_name = NULL;
-char *g_fff_name = NULL;
-char *g_ttt_name = NULL;
-char *g_bbl_name = NULL;
-char *g_home_dir = NULL;
-
-char *progname;                 /* name of the executable file */
-int SpanishMode = FALSE;       /* support spanishstyle */
-int GermanMode = FALSE;        /* support germanstyle */
-int FrenchMode = FALSE;        /* support frenchstyle */
-int RussianMode = FALSE;       /* support russianstyle */
-int CzechMode = FALSE;         /* support czech */
-
-int twoside = FALSE;
-int g_verbosity_level = WARNING;
-int g_little_endian = FALSE;   /* set properly in main() */
-uint16_t g_dots_per_inch = 300;
-
-int pagenumbering = TRUE;      /* by default use plain style */
-int headings = FALSE;
-
-int g_processing_preamble = TRUE;  /* flag set until \begin{document} */
-int g_processing_figure = FALSE;   /* flag, set for figures and not tables */
-int g_processing_eqnarray = FALSE; /* flag set when in an eqnarry */
-int g_processing_arrays = 0;
-
-int g_show_equation_number = FALSE;
-int g_enumerate_depth = 0;
-int g_suppress_equation_number = FALSE;
-int g_aux_file_missing = FALSE;    /* assume that it exists */
-int g_bbl_file_missing = FALSE;    /* assume that it exists */
-
-int g_document_type = FORMAT_ARTICLE;
-int g_document_bibstyle = BIBSTYLE_STANDARD;
-
-int g_safety_braces = 0;
-int g_processing_equation = FALSE;
-int g_RTF_warnings = FALSE;
-char *g_config_path = NULL;
-char *g_script_dir = NULL;
-char *g_tmp_dir = NULL;
-char *g_preamble = NULL;
-int g_escape_parens = FALSE;
-char *g_package_babel = NULL;
-
-int g_equation_display_rtf = TRUE;
-int g_equation_inline_rtf = TRUE;
-int g_equation_inline_bitmap = FALSE;
-int g_equation_display_bitmap = FALSE;
-int g_equation_comment = FALSE;
-int g_equation_raw_latex = FALSE;
-int g_equation_inline_eps = FALSE;
-int g_equation_display_eps = FALSE;
-int g_equation_mtef = FALSE;
-
-int g_figure_include_direct = TRUE;
-int g_figure_include_converted = TRUE;
-int g_figure_comment_direct = FALSE;
-int g_figure_comment_converted = FALSE;
-
-int g_tableofcontents = FALSE;
-
-int g_tabular_display_rtf = TRUE;
-int g_tabular_display_bitmap = FALSE;
-int g_tab_counter = 0;
-int g_processing_table = FALSE;
-int g_processing_tabbing = FALSE;
-int g_processing_tabular = FALSE;
-
-double g_png_equation_scale = 1.00;
-double g_png_figure_scale = 1.00;
-int g_latex_figures = FALSE;
-int g_endfloat_figures = FALSE;
-int g_endfloat_tables = FALSE;
-int g_endfloat_markers = TRUE;
-int  g_graphics_package = GRAPHICS_NONE;
-
-int indent = 0;
-char alignment = JUSTIFIED;     /* default for justified: */
-
-int RecursionLevel = 0;
-int twocolumn = FALSE;
-int titlepage = FALSE;
+#include "parallel.h"
+#include "pool.h"
+#include "server.h"
+#include "auxfile.h"
+#include "definitions.h"
+#include "graphics.h"
+#include "letterformat.h"
+#include "styles.h"
+#include "latex2rtf.h"
+#include "rendercache.h"
+#include "spawn.h"
+
+THREAD_LOCAL FILE *fRtf = NULL;             /* file pointer to RTF file */
+THREAD_LOCAL char *g_tex_name = NULL;
+THREAD_LOCAL char *g_rtf_name = NULL;
+THREAD_LOCAL char *g_aux_name = NULL;
+THREAD_LOCAL char *g_toc_name = NULL;
+THREAD_LOCAL char *g_lof_name = NULL;
+THREAD_LOCAL char *g_lot_name = NULL;
+THREAD_LOCAL char *g_fff_name = NULL;
+THREAD_LOCAL char *g_ttt_name = NULL;
+THREAD_LOCAL char *g_bbl_name = NULL;
+THREAD_LOCAL char *g_home_dir = NULL;
+
+THREAD_LOCAL char *progname;                 /* name of the executable file */
+THREAD_LOCAL int SpanishMode = FALSE;       /* support spanishstyle */
+THREAD_LOCAL int GermanMode = FALSE;        /* support germanstyle */
+THREAD_LOCAL int FrenchMode = FALSE;        /* support frenchstyle */
+THREAD_LOCAL int RussianMode = FALSE;       /* support russianstyle */
+THREAD_LOCAL int CzechMode = FALSE;         /* support czech */
+
+THREAD_LOCAL int twoside = FALSE;
+THREAD_LOCAL int g_verbosity_level = WARNING;
+THREAD_LOCAL int g_recover_from_errors = FALSE; /* errors abandon the document, not the run */
+THREAD_LOCAL int g_little_endian = FALSE;   /* set properly in main() */
+THREAD_LOCAL uint16_t g_dots_per_inch = 300;
+
+THREAD_LOCAL int pagenumbering = TRUE;      /* by default use plain style */
+THREAD_LOCAL int headings = FALSE;
+
+THREAD_LOCAL int g_processing_preamble = TRUE;  /* flag set until \begin{document} */
+THREAD_LOCAL int g_processing_figure = FALSE;   /* flag, set for figures and not tables */
+THREAD_LOCAL int g_processing_eqnarray = FALSE; /* flag set when in an eqnarry */
+THREAD_LOCAL int g_processing_arrays = 0;
+
+THREAD_LOCAL int g_show_equation_number = FALSE;
+THREAD_LOCAL int g_enumerate_depth = 0;
+THREAD_LOCAL int g_suppress_equation_number = FALSE;
+THREAD_LOCAL int g_aux_file_missing = FALSE;    /* assume that it exists */
+THREAD_LOCAL int g_bbl_file_missing = FALSE;    /* assume that it exists */
+
+THREAD_LOCAL int g_document_type = FORMAT_ARTICLE;
+THREAD_LOCAL int g_document_bibstyle = BIBSTYLE_STANDARD;
+
+THREAD_LOCAL int g_safety_braces = 0;
+THREAD_LOCAL int g_processing_equation = FALSE;
+THREAD_LOCAL int g_RTF_warnings = FALSE;
+THREAD_LOCAL int g_lookup_stats = FALSE;
+THREAD_LOCAL char *g_config_path = NULL;
+THREAD_LOCAL char *g_script_dir = NULL;
+THREAD_LOCAL char *g_tmp_dir = NULL;
+THREAD_LOCAL char *g_preamble = NULL;
+THREAD_LOCAL int g_escape_parens = FALSE;
+THREAD_LOCAL char *g_package_babel = NULL;
+
+THREAD_LOCAL int g_equation_display_rtf = TRUE;
+THREAD_LOCAL int g_equation_inline_rtf = TRUE;
+THREAD_LOCAL int g_equation_inline_bitmap = FALSE;
+THREAD_LOCAL int g_equation_display_bitmap = FALSE;
+THREAD_LOCAL int g_equation_comment = FALSE;
+THREAD_LOCAL int g_equation_raw_latex = FALSE;
+THREAD_LOCAL int g_equation_inline_eps = FALSE;
+THREAD_LOCAL int g_equation_display_eps = FALSE;
+THREAD_LOCAL int g_equation_mtef = FALSE;
+
+THREAD_LOCAL int g_figure_include_direct = TRUE;
+THREAD_LOCAL int g_figure_include_converted = TRUE;
+THREAD_LOCAL int g_figure_comment_direct = FALSE;
+THREAD_LOCAL int g_figure_comment_converted = FALSE;
+
+THREAD_LOCAL int g_tableofcontents = FALSE;
+
+THREAD_LOCAL int g_tabular_display_rtf = TRUE;
+THREAD_LOCAL int g_tabular_display_bitmap = FALSE;
+THREAD_LOCAL int g_tab_counter = 0;
+THREAD_LOCAL int g_processing_table = FALSE;
+THREAD_LOCAL int g_processing_tabbing = FALSE;
+THREAD_LOCAL int g_processing_tabular = FALSE;
+
+THREAD_LOCAL double g_png_equation_scale = 1.00;
+THREAD_LOCAL double g_png_figure_scale = 1.00;
+THREAD_LOCAL int g_latex_figures = FALSE;
+THREAD_LOCAL int g_endfloat_figures = FALSE;
+THREAD_LOCAL int g_endfloat_tables = FALSE;
+THREAD_LOCAL int g_endfloat_markers = TRUE;
+THREAD_LOCAL int  g_graphics_package = GRAPHICS_NONE;
+
+THREAD_LOCAL int indent = 0;
+THREAD_LOCAL char alignment = JUSTIFIED;     /* default for justified: */
+
+THREAD_LOCAL int RecursionLevel = 0;
+THREAD_LOCAL int twocolumn = FALSE;
+THREAD_LOCAL int titlepage = FALSE;
 
 static void OpenRtfFile(char *filename, FILE ** f);
 static void CloseRtf(FILE ** f);
@@ -156,19 +172,42 @@ static void InitializeLatexLengths(void);
 
 static void SetEndianness(void);
 static void ConvertWholeDocument(void);
+static void ParseOptions(int argc, char **argv);
+static void SetDocumentNames(char *name);
+static void ConvertSource(void);
+static int ConvertDocument(void);
+static void ResetDocument(void);
+static int ConvertWithRecovery(int (*convert) (void));
+static int ConvertBatchFile(char *name);
+static int ConvertBatch(int argc, char **argv);
+static int ConvertRequest(int argc, char **argv);
+static int ConvertLibraryDocument(void);
 static void print_usage(void);
 static void print_version(void);
 
-extern char *optarg;
-extern int optind;
+static char *g_batch_list = NULL;   /* -B file listing the documents, "-" is stdin */
+static THREAD_LOCAL jmp_buf g_document_error;    /* where an error returns to in a batch */
+static THREAD_LOCAL FILE *g_preamble_rtf = NULL; /* real fRtf while the preamble goes to ERROUT */
+static int g_batch_argc;            /* command line given to every document */
+static char **g_batch_argv;
+static THREAD_LOCAL int g_batch_documents = 0;   /* documents started by this thread */
+static THREAD_LOCAL l2rResult *g_library_result = NULL; /* diagnostics go here, not to ERROUT */
+static THREAD_LOCAL int first = TRUE;     /* no diagnostic written to ERROUT yet */
+static THREAD_LOCAL const char *g_library_latex;  /* what l2r_convert() was asked to do */
+static THREAD_LOCAL size_t g_library_size;
+static THREAD_LOCAL const char *g_library_options;
+static THREAD_LOCAL int g_library_cfg_read = FALSE;
+static THREAD_LOCAL char *g_library_args = NULL; /* the options point into this */
+static int g_library_threads = 0;   /* threads that have called l2r_convert() */
+
+#define MAX_LIBRARY_ARGS 64
+
+int l2r_main(int argc, char **argv)
 
-int main(int argc, char **argv)
+/****************************************************************************
+purpose: everything the latex2rtf command does, main() only calls this
+ ****************************************************************************/
 {
-    int c, x;
-    char *p;
-    char *basename = NULL;
-    double xx;
-
     SetEndianness();
     progname = argv[0];
 
@@ -176,53 +215,101 @@ int main(int argc, char **argv)
     InitializeLatexLengths();
     InitializeBibliography();
     
-    while ((c = my_getopt(argc, argv, "lhpuvFSVWZ:o:a:b:d:f:i:s:u:C:D:E:M:P:T:t:")) != EOF) {
+    ParseOptions(argc, argv);
+
+    if (g_server_socket != NULL) {
+        ReadCfg();
+        return RunServer(g_server_socket, ConvertRequest);
+    }
+
+    if (g_batch_list != NULL || argc - my_optind > 1)
+        return ConvertBatch(argc, argv);
+
+    if (argc - my_optind == 1 && strcmp(argv[my_optind], "-") != 0)
+        SetDocumentNames(argv[my_optind]);
+
+    ReadCfg();
+
+    return ConvertDocument();
+}
+
+static void ParseOptions(int argc, char **argv)
+
+/****************************************************************************
+purpose: set the globals from the command line options, leaves my_optind at
+         the first file name
+ ****************************************************************************/
+{
+    int c, x;
+    char *p;
+    double xx;
+
+    while ((c = my_getopt(argc, argv, "lhpuvyFRSVWXZ:o:a:b:c:d:f:i:j:r:s:u:w:B:C:D:E:J:K:L:M:P:T:t:")) != EOF) {
         switch (c) {
             case 'a':
-                g_aux_name = optarg;
+                g_aux_name = strdup(my_optarg);
                 break;
             case 'b':
-                g_bbl_name = optarg;
+                g_bbl_name = strdup(my_optarg);
+                break;
+            case 'B':
+                g_batch_list = my_optarg;
+                break;
+            case 'c':
+                safe_free(g_render_cache_dir);
+                g_render_cache_dir = strdup(my_optarg);
                 break;
             case 'd':
-                g_verbosity_level = *optarg - '0';
+                g_verbosity_level = *my_optarg - '0';
                 if (g_verbosity_level < 0 || g_verbosity_level > 7) {
                     diagnostics(WARNING, "debug level (-d# option) must be 0-7");
                     print_usage();
                 }
                 break;
             case 'f':
-                sscanf(optarg, "%d", &x);
+                sscanf(my_optarg, "%d", &x);
                 set_fields_use_EQ(x & 1);
                 set_fields_use_REF(x & 2);
                 break;
             case 'i':
-                g_package_babel = strdup(optarg);
+                g_package_babel = strdup(my_optarg);
                 break;
             case 'l':
                 g_package_babel = strdup("latin");
                 break;
             case 'o':
-                g_rtf_name = strdup(optarg);
+                g_rtf_name = strdup(my_optarg);
                 break;
             case 'p':
                 g_escape_parens = TRUE;
                 break;
             case 'v':
+            case 'V':
+                if (g_library_result != NULL) {
+                    diagnostics(WARNING, "latex2rtf %s", Version);
+                    break;
+                }
                 print_version();
-                return (0);
+                exit(0);
             case 'C':
-                setPackageInputenc(optarg);
+                setPackageInputenc(my_optarg);
                 break;
             case 'D':
-                sscanf(optarg, "%d", &x);
+                sscanf(my_optarg, "%d", &x);
                 g_dots_per_inch = (uint16_t) x;
                 if (g_dots_per_inch < 25 || g_dots_per_inch > 600)
                     diagnostics(WARNING, "Dots per inch must be between 25 and 600 dpi\n");
                 break;
+            case 'K':
+                g_render_cache_megabytes = atol(my_optarg);
+                if (g_render_cache_megabytes < 1) {
+                    diagnostics(WARNING, "Render cache size (-K#) must be at least 1 megabyte");
+                    g_render_cache_megabytes = 64;
+                }
+                break;
             case 'E':
-                sscanf(optarg, "%d", &x);
-                diagnostics(3, "Figure option = %s x=%d", optarg, x);
+                sscanf(my_optarg, "%d", &x);
+                diagnostics(3, "Figure option = %s x=%d", my_optarg, x);
                 g_figure_include_direct    = (x &  1) ? TRUE : FALSE;
                 g_figure_include_converted = (x &  2) ? TRUE : FALSE;
                 g_figure_comment_direct    = (x &  4) ? TRUE : FALSE;
@@ -235,9 +322,46 @@ int main(int argc, char **argv)
             case 'F':
                 g_latex_figures = TRUE;
                 break;
+            case 'j':
+                g_document_jobs = atoi(my_optarg);
+                if (g_document_jobs < 1) {
+                    diagnostics(WARNING, "number of jobs (-j# option) must be at least 1");
+                    print_usage();
+                }
+                break;
+            case 'r':
+                g_render_jobs = atoi(my_optarg);
+                if (g_render_jobs < 1) {
+                    diagnostics(WARNING, "number of renders (-r# option) must be at least 1");
+                    g_render_jobs = 1;
+                }
+                break;
+            case 'R':
+                g_render_batch = TRUE;
+                break;
+            case 'y':
+                g_preamble_format = TRUE;
+                break;
+            case 'w':
+                g_spawn_timeout = atoi(my_optarg);
+                if (g_spawn_timeout < 0) {
+                    diagnostics(WARNING, "time limit (-w# option) must be 0 or more seconds");
+                    g_spawn_timeout = 600;
+                }
+                break;
+            case 'J':
+                g_section_jobs = atoi(my_optarg);
+                if (g_section_jobs < 1) {
+                    diagnostics(WARNING, "number of jobs (-J# option) must be at least 1");
+                    print_usage();
+                }
+                break;
+            case 'L':
+                g_server_socket = my_optarg;
+                break;
             case 'M':
-                sscanf(optarg, "%d", &x);
-                diagnostics(3, "Math option = %s x=%d", optarg, x);
+                sscanf(my_optarg, "%d", &x);
+                diagnostics(3, "Math option = %s x=%d", my_optarg, x);
                 g_equation_display_rtf   = (x &  1) ? TRUE : FALSE;
                 g_equation_inline_rtf    = (x &  2) ? TRUE : FALSE;
                 g_equation_display_bitmap= (x &  4) ? TRUE : FALSE;
@@ -262,8 +386,8 @@ int main(int argc, char **argv)
                 break;
 
             case 't':
-                sscanf(optarg, "%d", &x);
-                diagnostics(3, "Table option = %s x=%d", optarg, x);
+                sscanf(my_optarg, "%d", &x);
+                diagnostics(3, "Table option = %s x=%d", my_optarg, x);
                 g_tabular_display_rtf    = (x &  1) ? TRUE : FALSE;
                 g_tabular_display_bitmap = (x &  2) ? TRUE : FALSE;
                 diagnostics(3, "Table option g_tabular_display_rtf     = %d", g_tabular_display_rtf);
@@ -271,28 +395,28 @@ int main(int argc, char **argv)
                 break;
 
             case 'P':          /* -P path/to/cfg:path/to/script or -P path/to/cfg or -P :path/to/script */
-                p = strchr(optarg, ENVSEP);
-                if (p) {
-                    *p = '\0';
+                p = strchr(my_optarg, ENVSEP);
+                if (p)
                     g_script_dir = strdup(p + 1);
-                }
-                if (p != optarg)
-                    g_config_path = strdup(optarg);
+                if (p == NULL)
+                    g_config_path = strdup(my_optarg);
+                else if (p != my_optarg)
+                    g_config_path = my_strndup(my_optarg, p - my_optarg);
                 diagnostics(2, "cfg=%s, script=%s", g_config_path, g_script_dir);
                 break;
 
             case 's':
-                if (optarg && optarg[0] == 'e') {
-                    if (sscanf(optarg, "e%lf", &xx) == 1 && xx > 0) {
+                if (my_optarg && my_optarg[0] == 'e') {
+                    if (sscanf(my_optarg, "e%lf", &xx) == 1 && xx > 0) {
                         g_png_equation_scale = xx;
                     } else {
                         diagnostics(WARNING, "Mistake in command line number for scaling equations");
                         diagnostics(WARNING, "Either use no spaces: '-se1.22' or write as '-s e1.22'");
                     }
                     
-                } else if (optarg && optarg[0] == 'f') {
+                } else if (my_optarg && my_optarg[0] == 'f') {
                 
-                    if (sscanf(optarg, "f%lf", &xx) == 1 && xx > 0) {
+                    if (sscanf(my_optarg, "f%lf", &xx) == 1 && xx > 0) {
                         g_png_figure_scale = xx;
                     } else {
                         diagnostics(WARNING, "Mistake in command line number for scaling figures");
@@ -307,17 +431,17 @@ int main(int argc, char **argv)
                 g_field_separator = ';';
                 break;
             case 'T':
-                g_tmp_dir = strdup(optarg);
+                g_tmp_dir = strdup(my_optarg);
                 break;
-            case 'V':
-                print_version();
-                return (0);
             case 'W':
                 g_RTF_warnings = TRUE;
                 break;
+            case 'X':
+                g_lookup_stats = TRUE;
+                break;
             case 'Z':
                 g_safety_braces = FALSE;
-                g_safety_braces = *optarg - '0';
+                g_safety_braces = *my_optarg - '0';
                 if (g_safety_braces < 0 || g_safety_braces > 9) {
                     diagnostics(WARNING, "Number of safety braces (-Z#) must be 0-9");
                     print_usage();
@@ -331,82 +455,103 @@ int main(int argc, char **argv)
         }
     }
 
-    argc -= optind;
-    argv += optind;
-
-    if (argc > 1) {
-        diagnostics(WARNING, "Only a single file can be processed at a time");
-        diagnostics(ERROR, " Type \"latex2rtf -h\" for help");
-    }
-
-/* Parse filename.  Extract directory if possible.  Beware of stdin cases */
-
-    if (argc == 1 && strcmp(*argv, "-") != 0) { /* filename exists and != "-" */
-        char *s, *t, *ext;
+}
 
-        basename = strdup(*argv);   /* parse filename */
-        s = strrchr(basename, PATHSEP);
-        if (s != NULL) {
-            g_home_dir = strdup(basename);  /* parse /tmp/file.tex */
-            t = strdup(s + 1);
-            free(basename);
-            basename = t;       /* basename = file.tex */
-            s = strrchr(g_home_dir, PATHSEP);
-            *(s + 1) = '\0';    /* g_home_dir = /tmp/ */
-        }
+static void SetDocumentNames(char *name)
 
-        /* remove .tex or .ltx if present */
-        ext = basename + strlen(basename) - 4;
-        if (strcmp(ext, ".tex") == 0 || strcmp(ext, ".ltx") == 0) {
-            g_tex_name = strdup(basename);
-            *ext = '\0';
-        } else 
-            g_tex_name = strdup_together(basename, ".tex");
-        
-        if (g_rtf_name == NULL) 
-            g_rtf_name = strdup_together3(g_home_dir,basename,".rtf");
+/****************************************************************************
+purpose: derive the names of the .tex, .rtf, .aux, ... files from name.
+         Extract directory if possible.
+ ****************************************************************************/
+{
+    char *basename, *s, *t, *ext;
+
+    basename = strdup(name);   /* parse filename */
+    s = strrchr(basename, PATHSEP);
+    if (s != NULL) {
+        g_home_dir = strdup(basename);  /* parse /tmp/file.tex */
+        t = strdup(s + 1);
+        free(basename);
+        basename = t;       /* basename = file.tex */
+        s = strrchr(g_home_dir, PATHSEP);
+        *(s + 1) = '\0';    /* g_home_dir = /tmp/ */
     }
 
-    if (g_aux_name == NULL && basename != NULL)
+    /* remove .tex or .ltx if present */
+    ext = basename + strlen(basename) - 4;
+    if (strcmp(ext, ".tex") == 0 || strcmp(ext, ".ltx") == 0) {
+        g_tex_name = strdup(basename);
+        *ext = '\0';
+    } else 
+        g_tex_name = strdup_together(basename, ".tex");
+    
+    if (g_rtf_name == NULL) 
+        g_rtf_name = strdup_together3(g_home_dir,basename,".rtf");
+
+    if (g_aux_name == NULL)
         g_aux_name = strdup_together(basename, ".aux");
 
-    if (g_bbl_name == NULL && basename != NULL)
+    if (g_bbl_name == NULL)
         g_bbl_name = strdup_together(basename, ".bbl");
 
-    if (g_toc_name == NULL && basename != NULL)
+    if (g_toc_name == NULL)
         g_toc_name = strdup_together(basename, ".toc");
 
-    if (g_lof_name == NULL && basename != NULL)
+    if (g_lof_name == NULL)
         g_lof_name = strdup_together(basename, ".lof");
 
-    if (g_lot_name == NULL && basename != NULL)
+    if (g_lot_name == NULL)
         g_lot_name = strdup_together(basename, ".lot");
 
-    if (g_fff_name == NULL && basename != NULL)
+    if (g_fff_name == NULL)
         g_fff_name = strdup_together(basename, ".fff");
 
-    if (g_ttt_name == NULL && basename != NULL)
+    if (g_ttt_name == NULL)
         g_ttt_name = strdup_together(basename, ".ttt");
 
-    if (basename) {
-        diagnostics(2, "latex filename is <%s>", g_tex_name);
-        diagnostics(2, "  rtf filename is <%s>", g_rtf_name);
-        diagnostics(2, "  aux filename is <%s>", g_aux_name);
-        diagnostics(2, "  bbl filename is <%s>", g_bbl_name);
-        diagnostics(2, "home directory is <%s>", (g_home_dir) ? g_home_dir : "");
+    diagnostics(2, "latex filename is <%s>", g_tex_name);
+    diagnostics(2, "  rtf filename is <%s>", g_rtf_name);
+    diagnostics(2, "  aux filename is <%s>", g_aux_name);
+    diagnostics(2, "  bbl filename is <%s>", g_bbl_name);
+    diagnostics(2, "home directory is <%s>", (g_home_dir) ? g_home_dir : "");
+
+    free(basename);
+}
+
+static void ConvertSource(void)
+
+/****************************************************************************
+purpose: convert the source pushed last to fRtf, which is closed at the end
+ ****************************************************************************/
+{
+    InitializeDocumentFont(TexFontNumber("Roman"), 20, F_SHAPE_UPRIGHT, F_SERIES_MEDIUM, ENCODING_1252);
+    PushTrackLineNumber(TRUE);
+
+    ConvertWholeDocument();
+    PopSource();
+    FinishDeferredBitmaps();
+    CloseRtf(&fRtf);
+
+    if (g_lookup_stats) {
+        ReportAuxStats();
+        ReportCrossReferenceStats();
+        ReportRenderCacheStats();
+        if (g_library_result == NULL)
+            fprintf(ERROUT, "\n");
     }
+}
 
-    ReadCfg();
+static int ConvertDocument(void)
 
+/****************************************************************************
+purpose: convert g_tex_name (or stdin) to g_rtf_name (or stdout)
+returns: 0 on success, 1 if the LaTeX file could not be opened
+ ****************************************************************************/
+{
     if (PushSource(g_tex_name, NULL) == 0) {
         OpenRtfFile(g_rtf_name, &fRtf);
-
-        InitializeDocumentFont(TexFontNumber("Roman"), 20, F_SHAPE_UPRIGHT, F_SERIES_MEDIUM, ENCODING_1252);
-        PushTrackLineNumber(TRUE);
-
-        ConvertWholeDocument();
-        PopSource();
-        CloseRtf(&fRtf);
+        BeginDeferredBitmaps(fRtf);
+        ConvertSource();
         printf("\n");
 
     if (0) debug_malloc();
@@ -418,6 +563,489 @@ int main(int argc, char **argv)
     }
 }
 
+static void ResetDocument(void)
+
+/****************************************************************************
+purpose: return every module to the state it had when latex2rtf started so
+         that the next document of a batch is converted like a fresh run.
+         The cfg tables are kept, they do not depend on the document.
+ ****************************************************************************/
+{
+    ResetParser();
+    ResetEnvironments();
+    ResetFonts();
+    ResetVerticalState();
+    ResetDefinitions();
+    resetPreParse();
+    ResetConditions();
+    ResetSectionNumbering();
+    resetCounters();
+    resetLengths();
+    ResetCrossReferences();
+    ResetAuxFile();
+    ResetPreamble();
+    ResetGraphics();
+    ResetLetter();
+    ResetCurrentStyle();
+    ResetFields();
+    ResetLanguage();
+
+    safe_free(g_tex_name);
+    safe_free(g_rtf_name);
+    safe_free(g_aux_name);
+    safe_free(g_toc_name);
+    safe_free(g_lof_name);
+    safe_free(g_lot_name);
+    safe_free(g_fff_name);
+    safe_free(g_ttt_name);
+    safe_free(g_bbl_name);
+    safe_free(g_home_dir);
+    safe_free(g_package_babel);
+    safe_free(g_config_path);
+    safe_free(g_script_dir);
+    safe_free(g_tmp_dir);
+    safe_free(g_preamble);
+    safe_free(g_render_cache_dir);
+    g_tex_name = NULL;
+    g_rtf_name = NULL;
+    g_aux_name = NULL;
+    g_toc_name = NULL;
+    g_lof_name = NULL;
+    g_lot_name = NULL;
+    g_fff_name = NULL;
+    g_ttt_name = NULL;
+    g_bbl_name = NULL;
+    g_home_dir = NULL;
+    g_package_babel = NULL;
+    g_config_path = NULL;
+    g_script_dir = NULL;
+    g_tmp_dir = NULL;
+    g_preamble = NULL;
+    g_render_cache_dir = NULL;
+    g_render_cache_megabytes = 64;
+    g_render_jobs = 0;
+    g_render_batch = FALSE;
+    g_preamble_format = FALSE;
+    g_spawn_timeout = 600;
+    g_section_jobs = 0;
+
+    SpanishMode = FALSE;
+    GermanMode = FALSE;
+    FrenchMode = FALSE;
+    RussianMode = FALSE;
+    CzechMode = FALSE;
+
+    twoside = FALSE;
+    g_verbosity_level = WARNING;
+    g_dots_per_inch = 300;
+    pagenumbering = TRUE;
+    headings = FALSE;
+
+    g_processing_preamble = TRUE;
+    g_processing_figure = FALSE;
+    g_processing_eqnarray = FALSE;
+    g_processing_arrays = 0;
+
+    g_show_equation_number = FALSE;
+    g_enumerate_depth = 0;
+    g_suppress_equation_number = FALSE;
+    g_aux_file_missing = FALSE;
+    g_bbl_file_missing = FALSE;
+
+    g_document_type = FORMAT_ARTICLE;
+    g_document_bibstyle = BIBSTYLE_STANDARD;
+
+    g_safety_braces = 0;
+    g_processing_equation = FALSE;
+    g_RTF_warnings = FALSE;
+    g_lookup_stats = FALSE;
+    g_escape_parens = FALSE;
+
+    g_equation_display_rtf = TRUE;
+    g_equation_inline_rtf = TRUE;
+    g_equation_inline_bitmap = FALSE;
+    g_equation_display_bitmap = FALSE;
+    g_equation_comment = FALSE;
+    g_equation_raw_latex = FALSE;
+    g_equation_inline_eps = FALSE;
+    g_equation_display_eps = FALSE;
+    g_equation_mtef = FALSE;
+    g_equation_column = 1;
+    g_amsmath_package = FALSE;
+
+    g_figure_include_direct = TRUE;
+    g_figure_include_converted = TRUE;
+    g_figure_comment_direct = FALSE;
+    g_figure_comment_converted = FALSE;
+
+    g_tableofcontents = FALSE;
+
+    g_tabular_display_rtf = TRUE;
+    g_tabular_display_bitmap = FALSE;
+    g_tab_counter = 0;
+    g_processing_table = FALSE;
+    g_processing_tabbing = FALSE;
+    g_processing_tabular = FALSE;
+    pos_begin_kill = 0;
+
+    g_png_equation_scale = 1.00;
+    g_png_figure_scale = 1.00;
+    g_latex_figures = FALSE;
+    g_endfloat_figures = FALSE;
+    g_endfloat_tables = FALSE;
+    g_endfloat_markers = TRUE;
+    g_graphics_package = GRAPHICS_NONE;
+
+    indent = 0;
+    alignment = JUSTIFIED;
+    RecursionLevel = 0;
+    twocolumn = FALSE;
+    titlepage = FALSE;
+}
+
+static int ConvertWithRecovery(int (*convert) (void))
+
+/****************************************************************************
+purpose: call convert() so that an error only abandons this document, the
+         next one is converted after ResetDocument()
+returns: what convert() returns, or 1 after an error
+ ****************************************************************************/
+{
+    int result;
+
+    if (setjmp(g_document_error) != 0) {
+        g_recover_from_errors = FALSE;
+        if (fRtf == ERROUT)
+            fRtf = g_preamble_rtf;
+        if (fRtf != NULL && fRtf != stdout)
+            fclose(fRtf);
+        fRtf = NULL;
+        g_preamble_rtf = NULL;
+        if (g_library_result == NULL)
+            printf("\n");
+        return 1;
+    }
+
+    g_recover_from_errors = TRUE;
+    result = convert();
+    g_recover_from_errors = FALSE;
+    return result;
+}
+
+static int ConvertBatchFile(char *name)
+
+/****************************************************************************
+purpose: convert one document of a batch starting from a clean state with
+         the options of the command line
+returns: 0 on success, 1 otherwise
+ ****************************************************************************/
+{
+    if (g_batch_documents++ > 0) {
+        ResetDocument();
+        InitializeStack();
+        InitializeLatexLengths();
+        InitializeBibliography();
+        my_optind = 1;
+        ParseOptions(g_batch_argc, g_batch_argv);
+    }
+
+    if (strcmp(name, "-") == 0) {
+        diagnostics(WARNING, "Skipping '-', standard input cannot be part of a batch");
+        return 1;
+    }
+
+    SetDocumentNames(name);
+    return ConvertWithRecovery(ConvertDocument);
+}
+
+static int ConvertRequest(int argc, char **argv)
+
+/****************************************************************************
+purpose: convert the single file named in argv for a client of the server.
+         The process is a fresh fork of the server, only the options of
+         the request need to be added.
+returns: 0 on success, 1 otherwise
+ ****************************************************************************/
+{
+    my_optind = 1;
+    ParseOptions(argc, argv);
+
+    if (my_optind != argc - 1 || strcmp(argv[my_optind], "-") == 0) {
+        diagnostics(WARNING, "A request must name exactly one file");
+        return 1;
+    }
+
+    SetDocumentNames(argv[my_optind]);
+    return ConvertWithRecovery(ConvertDocument);
+}
+
+#define MAX_BATCH_LINE 65536
+
+static char *ReadBatchLine(FILE *f, char **line, size_t *size)
+
+/****************************************************************************
+purpose: read the next line of the -B list into *line, which grows as needed.
+         A line longer than MAX_BATCH_LINE is skipped whole.
+returns: the line without its line ending, or NULL at the end of the list
+ ****************************************************************************/
+{
+    size_t n;
+
+    while (TRUE) {
+        n = 0;
+        do {
+            if (*size - n < 2) {
+                *size = (*size) ? 2 * *size : 256;
+                *line = (char *) realloc(*line, *size);
+                if (*line == NULL)
+                    diagnostics(ERROR, "Cannot allocate memory for batch file list");
+            }
+            if (fgets(*line + n, (int) (*size - n), f) == NULL) {
+                if (n == 0)
+                    return NULL;
+                break;
+            }
+            n += strlen(*line + n);
+        } while ((*line)[n - 1] != '\n');
+
+        while (n > 0 && ((*line)[n - 1] == '\n' || (*line)[n - 1] == '\r'))
+            (*line)[--n] = '\0';
+        if (n <= MAX_BATCH_LINE)
+            return *line;
+        diagnostics(WARNING, "Skipping a line of %lu characters in the batch list", (unsigned long) n);
+    }
+}
+
+static int ConvertBatch(int argc, char **argv)
+
+/****************************************************************************
+purpose: convert the files named on the command line followed by those
+         listed (one per line) in the -B file.  Each document gets the
+         command line options anew; the cfg files are read only once.
+         With -j the documents are shared out to a pool of workers.
+returns: 0 if every document was converted, 1 otherwise
+ ****************************************************************************/
+{
+    char **files, *line = NULL, *s;
+    size_t size = 0;
+    int i, n, max, failed = 0;
+    FILE *f = NULL;
+
+    max = argc - my_optind + 16;
+    files = (char **) malloc(max * sizeof(char *));
+    if (files == NULL)
+        diagnostics(ERROR, "Cannot allocate memory for batch file list");
+
+    n = 0;
+    for (i = my_optind; i < argc; i++)
+        files[n++] = strdup(argv[i]);
+
+    if (g_batch_list != NULL) {
+        if (strcmp(g_batch_list, "-") == 0)
+            f = stdin;
+        else
+            f = fopen(g_batch_list, "r");
+        if (f == NULL)
+            diagnostics(ERROR, "Cannot open batch list <%s>", g_batch_list);
+
+        while (ReadBatchLine(f, &line, &size) != NULL) {
+            for (s = line; *s == ' ' || *s == '\t'; s++);
+            if (*s == '\0' || *s == '%')
+                continue;
+            if (n == max) {
+                max *= 2;
+                files = (char **) realloc(files, max * sizeof(char *));
+                if (files == NULL)
+                    diagnostics(ERROR, "Cannot allocate memory for batch file list");
+            }
+            files[n++] = strdup(s);
+        }
+        free(line);
+        if (f != stdin)
+            fclose(f);
+    }
+
+    if (n > 1 && (g_rtf_name || g_aux_name || g_bbl_name))
+        diagnostics(ERROR, "-o, -a and -b cannot be used when converting several files");
+
+    ReadCfg();
+
+    g_batch_argc = argc;
+    g_batch_argv = argv;
+    if (g_document_jobs > 1 && n > 1)
+        failed = ConvertDocumentsInPool(files, n, ConvertBatchFile);
+    else {
+        for (i = 0; i < n; i++)
+            failed += ConvertBatchFile(files[i]);
+    }
+
+    for (i = 0; i < n; i++)
+        free(files[i]);
+    free(files);
+
+    /* about the whole batch, so without the file and line of diagnostics() */
+    if (failed && g_verbosity_level >= WARNING) {
+        if (!first) fprintf(ERROUT, "\n");
+        fprintf(ERROUT, "%d of %d files could not be converted", failed, n);
+        first = FALSE;
+    }
+
+    return (failed) ? 1 : 0;
+}
+
+static int ConvertLibraryDocument(void)
+
+/****************************************************************************
+purpose: parse the options and convert the LaTeX given to l2r_convert()
+returns: 0 on success, 1 otherwise
+ ****************************************************************************/
+{
+    char *argv[MAX_LIBRARY_ARGS + 2], *s;
+    int argc = 0;
+
+    argv[argc++] = progname;
+    if (g_library_args)
+        free(g_library_args);
+    g_library_args = strdup(g_library_options ? g_library_options : "");
+    for (s = my_strtok(g_library_args, " \t\n"); s != NULL; s = my_strtok(NULL, " \t\n")) {
+        if (argc > MAX_LIBRARY_ARGS)
+            diagnostics(ERROR, "More than %d options", MAX_LIBRARY_ARGS);
+        argv[argc++] = s;
+    }
+    argv[argc] = NULL;
+
+    my_optind = 1;
+    ParseOptions(argc, argv);
+    if (my_optind < argc)
+        diagnostics(WARNING, "Ignoring <%s>, only the LaTeX passed is converted", argv[my_optind]);
+
+    if (!g_library_cfg_read) {
+        ReadCfg();
+        g_library_cfg_read = TRUE;
+    }
+
+#ifdef UNIX
+    fRtf = open_memstream(&g_library_result->rtf, &g_library_result->rtf_size);
+#else
+    g_rtf_name = strdup_together(getTmpPath(), "l2r_library.rtf");
+    fRtf = fopen(g_rtf_name, "w+b");
+#endif
+    if (fRtf == NULL)
+        diagnostics(ERROR, "Cannot open a buffer for the RTF");
+
+    PushOwnedSource(my_strndup(g_library_latex, g_library_size));
+    ConvertSource();
+    return 0;
+}
+
+#ifndef UNIX
+static void ReadLibraryRtf(l2rResult *result)
+
+/****************************************************************************
+purpose: read back the RTF written to the temporary file g_rtf_name
+ ****************************************************************************/
+{
+    FILE *f;
+    long size;
+
+    f = fopen(g_rtf_name, "rb");
+    if (f == NULL)
+        return;
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    rewind(f);
+    result->rtf = (char *) malloc(size + 1);
+    if (result->rtf != NULL) {
+        result->rtf_size = fread(result->rtf, 1, size, f);
+        result->rtf[result->rtf_size] = '\0';
+    }
+    fclose(f);
+    remove(g_rtf_name);
+}
+#endif
+
+int l2r_convert(const char *latex, size_t size, const char *options, l2rResult *result)
+
+/****************************************************************************
+purpose: convert size bytes of LaTeX to RTF in memory with the command line
+         options (separated by blanks) in options.  The diagnostics are
+         collected in result instead of being printed and an error only
+         abandons this conversion.  Release result with l2r_free_result().
+         Every thread has its own state, so threads may convert at the
+         same time; each reads the cfg files on its first call and keeps
+         its tables until l2r_thread_cleanup().
+returns: 0 on success, 1 otherwise (result->status)
+ ****************************************************************************/
+{
+    memset(result, 0, sizeof(l2rResult));
+
+    if (g_batch_documents++ == 0) {
+        SetEndianness();
+        if (progname == NULL)
+            progname = "latex2rtf";
+#if defined(__GNUC__)
+        setEquationFileWorker(__sync_add_and_fetch(&g_library_threads, 1));
+#else
+        setEquationFileWorker(++g_library_threads);
+#endif
+    } else
+        ResetDocument();
+    InitializeStack();
+    InitializeLatexLengths();
+    InitializeBibliography();
+
+    g_library_result = result;
+    g_library_latex = latex;
+    g_library_size = size;
+    g_library_options = options;
+
+    result->status = ConvertWithRecovery(ConvertLibraryDocument);
+#ifndef UNIX
+    if (g_rtf_name)
+        ReadLibraryRtf(result);
+#endif
+
+    g_library_result = NULL;
+    return result->status;
+}
+
+void l2r_thread_cleanup(void)
+
+/****************************************************************************
+purpose: release everything l2r_convert() keeps for the calling thread, the
+         cfg tables included.  A thread calls this before it exits; a later
+         l2r_convert() on the same thread starts again from scratch.
+ ****************************************************************************/
+{
+    if (g_batch_documents == 0)
+        return;
+
+    ResetDocument();
+    FreeDefinitions();
+    FreeCommandIndexes();
+    freePreParse();
+    FreeEncodings();
+    FreeCfg();
+
+    safe_free(g_library_args);
+    g_library_args = NULL;
+    g_library_cfg_read = FALSE;
+    g_batch_documents = 0;
+}
+
+void l2r_free_result(l2rResult *result)
+{
+    int i;
+
+    for (i = 0; i < result->diagnostic_count; i++) {
+        free(result->diagnostics[i].file);
+        free(result->diagnostics[i].message);
+    }
+    free(result->diagnostics);
+    free(result->rtf);
+    memset(result, 0, sizeof(l2rResult));
+}
+
 static void SetEndianness(void)
 
 /*
@@ -459,6 +1087,9 @@ static void ConvertWholeDocument(void)
     if (label)
         free(label);
 
+    if (g_section_jobs > 1 && !g_endfloat_figures && !g_endfloat_tables)
+        sec_head = ConvertSectionsInParallel(sec_head);
+
     while (strcmp(sec_head,"\\end{document}")!=0) {
         preParse(&body, &sec_head2, &g_section_label);
         label = ExtractLabelTag(sec_head);
@@ -502,6 +1133,7 @@ static void ConvertWholeDocument(void)
         diagnostics(2, "\\end{document}");
         ConvertString(sec_head);
     }
+    free(sec_head);
 }
 
 static void print_version(void)
@@ -519,11 +1151,16 @@ static void print_usage(void)
 {
     char *s;
 
+    if (g_library_result != NULL)
+        diagnostics(ERROR, "Bad options <%s>", g_library_options);
+
     fprintf(stdout, "`%s' converts text files in LaTeX format to rich text format (RTF).\n\n", progname);
-    fprintf(stdout, "Usage:  %s [options] input[.tex]\n\n", progname);
+    fprintf(stdout, "Usage:  %s [options] input[.tex] ...\n\n", progname);
     fprintf(stdout, "Options:\n");
     fprintf(stdout, "  -a auxfile       use LaTeX auxfile rather than input.aux\n");
     fprintf(stdout, "  -b bblfile       use BibTex bblfile rather than input.bbl\n");
+    fprintf(stdout, "  -B listfile      also convert the files listed in listfile (- for stdin)\n");
+    fprintf(stdout, "  -c dir           keep bitmaps of equations etc. in dir for later runs\n");
     fprintf(stdout, "  -C codepage      charset used by the latex document (latin1, cp850, raw, etc.)\n");
     fprintf(stdout, "  -d level         debugging output (level is 0-6)\n");
     fprintf(stdout, "  -D dpi           number of dots per inch for bitmaps\n");
@@ -542,6 +1179,10 @@ static void print_usage(void)
     fprintf(stdout, "  -F               use LaTeX to convert all figures to bitmaps\n");
     fprintf(stdout, "  -h               display help\n");
     fprintf(stdout, "  -i language      idiom or language (e.g., german, french)\n");
+    fprintf(stdout, "  -j#              convert several files with # worker processes\n");
+    fprintf(stdout, "  -J#              convert sections using # worker processes\n");
+    fprintf(stdout, "  -K#              limit the -c directory to # megabytes (default 64)\n");
+    fprintf(stdout, "  -L socket        wait for conversion requests on a Unix domain socket\n");
     fprintf(stdout, "  -l               use latin1 encoding (default)\n");
     fprintf(stdout, "  -M#              math equation handling\n");
     fprintf(stdout, "       -M1          displayed equations to RTF\n");
@@ -558,6 +1199,8 @@ static void print_usage(void)
     fprintf(stdout, "  -o outputfile    file for RTF output\n");
     fprintf(stdout, "  -p               option to avoid bug in Word for some equations\n");
     fprintf(stdout, "  -P path          paths to *.cfg & latex2png\n");
+    fprintf(stdout, "  -r#              run # latex2png commands at once\n");
+    fprintf(stdout, "  -R               render all bitmaps in a single LaTeX run\n");
     fprintf(stdout, "  -S               use ';' to separate args in RTF fields\n");
     fprintf(stdout, "  -se#             scale factor for bitmap equations\n");
     fprintf(stdout, "  -sf#             scale factor for bitmap figures\n");
@@ -567,7 +1210,10 @@ static void print_usage(void)
     fprintf(stdout, "  -T /path/to/tmp  temporary directory\n");
     fprintf(stdout, "  -v               version information\n");
     fprintf(stdout, "  -V               version information\n");
+    fprintf(stdout, "  -w#              stop latex2png, convert etc. after # seconds (0 = never)\n");
     fprintf(stdout, "  -W               include warnings in RTF\n");
+    fprintf(stdout, "  -X               report the lookups of labels, citations, bookmarks etc.\n");
+    fprintf(stdout, "  -y               load the preamble of bitmaps from a precompiled format\n");
     fprintf(stdout, "  -Z#              add # of '}'s at end of rtf file (# is 0-9)\n\n");
     fprintf(stdout, "Examples:\n");
     fprintf(stdout, "  latex2rtf foo                       convert foo.tex to foo.rtf\n");
@@ -590,23 +1236,71 @@ static void print_usage(void)
     exit(1);
 }
 
+static void PutRtfWarning(char *message)
+
+/****************************************************************************
+purpose: put a warning into the RTF as well (-W)
+ ****************************************************************************/
+{
+    fprintRTF("{\\plain\\cf2 [latex2rtf:");
+    while (*message) {
+        putRtfCharEscaped(*message);
+        message++;
+    }
+    fprintRTF("]}");
+}
+
+static void CollectDiagnostic(int level, char *format, va_list apf)
+
+/****************************************************************************
+purpose: add the message to the diagnostics of l2r_convert()
+ ****************************************************************************/
+{
+    l2rResult *r = g_library_result;
+    l2rDiagnostic *d;
+    char buffer[1024], *s;
+    size_t n;
+
+    vsnprintf(buffer, sizeof(buffer), format, apf);
+    for (s = buffer; *s == '\n'; s++);
+    n = strlen(s);
+    while (n > 0 && s[n - 1] == '\n')
+        s[--n] = '\0';
+
+    if (level == 1 && g_RTF_warnings && fRtf != NULL)
+        PutRtfWarning(s);
+
+    if (r->diagnostic_count % 16 == 0) {
+        d = (l2rDiagnostic *) realloc(r->diagnostics, (r->diagnostic_count + 16) * sizeof(l2rDiagnostic));
+        if (d == NULL)
+            return;
+        r->diagnostics = d;
+    }
+
+    d = &r->diagnostics[r->diagnostic_count++];
+    d->level = level;
+    d->file = strdup(CurrentFileName());
+    d->line = CurrentLineNumber();
+    d->message = strdup(s);
+}
+
 void diagnostics(int level, char *format, ...)
 
 /****************************************************************************
-purpose: Writes the message to stderr depending on debugging level
+purpose: Writes the message to stderr depending on debugging level, or
+         collects it for l2r_convert()
  ****************************************************************************/
 {
-    static int first = TRUE;
-    
-    char buffer[512], *buff_ptr;
+    char buffer[512];
     va_list apf;
     int i;
 
-    buff_ptr = buffer;
-
     va_start(apf, format);
 
-    if (level <= g_verbosity_level) {
+    if (level <= g_verbosity_level && g_library_result != NULL) {
+        CollectDiagnostic(level, format, apf);
+
+    } else if (level <= g_verbosity_level) {
 
         CurrentEnvironmentCount();
 
@@ -618,14 +1312,9 @@ purpose: Writes the message to stderr depending on debugging level
                 fprintf(ERROUT, "Error! ");
                 break;
             case 1:
-                if (g_RTF_warnings) {
+                if (g_RTF_warnings && fRtf != NULL) {
                     vsnprintf(buffer, 512, format, apf);
-                    fprintRTF("{\\plain\\cf2 [latex2rtf:");
-                    while (*buff_ptr) {
-                        putRtfCharEscaped(*buff_ptr);
-                        buff_ptr++;
-                    }
-                    fprintRTF("]}");
+                    PutRtfWarning(buffer);
                 }
                 break;
             case 5:
@@ -652,15 +1341,43 @@ purpose: Writes the message to stderr depending on debugging level
     va_end(apf);
 
     if (level == 0) {
-        fprintf(ERROUT, "\n");
-        fflush(ERROUT);
+        if (g_library_result == NULL) {
+            fprintf(ERROUT, "\n");
+            fflush(ERROUT);
+        }
         if (fRtf) 
             fflush(fRtf);
+
+        if (g_recover_from_errors)
+            longjmp(g_document_error, 1);
             
         exit(EXIT_FAILURE);
     }
 }
 
+void RelayDiagnostics(FILE *f)
+
+/****************************************************************************
+purpose: Writes the diagnostics that another process wrote to f as if they
+         had been written here, one message per line
+ ****************************************************************************/
+{
+    char buffer[8192];
+    size_t n;
+    int c;
+
+    rewind(f);
+    while ((c = getc(f)) == '\n');
+    if (c == EOF)
+        return;
+
+    if (!first) fprintf(ERROUT, "\n");
+    fputc(c, ERROUT);
+    while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+        fwrite(buffer, 1, n, ERROUT);
+    first = FALSE;
+}
+
 static void InitializeLatexLengths(void)
 {
     /* Default Page Sizes */
@@ -738,14 +1455,13 @@ purpose: reads the LaTeX preamble (to \begin{document} ) for the file
 {
     char *raw_latex;
     char t[] = "\\begin|{|document|}";
-    FILE *rtf_file;
 
     /* Here we switch the file pointers ... it is important that nothing
        get printed to fRtf until the entire preamble has been processed.  
        This is really hard to track down, so the processed RTF get sent
        directly to stderr instead.
     */
-    rtf_file = fRtf;
+    g_preamble_rtf = fRtf;
     fRtf = ERROUT;
     
     raw_latex = getSpacedTexUntil(t, 1);
@@ -760,7 +1476,8 @@ purpose: reads the LaTeX preamble (to \begin{document} ) for the file
 
     ConvertString(g_preamble);
     diagnostics(5, "Exiting ConvertString() from ConvertLatexPreamble");
-    fRtf = rtf_file;
+    fRtf = g_preamble_rtf;
+    g_preamble_rtf = NULL;
 }
 
 
@@ -778,11 +1495,14 @@ params: filename - name of outputfile, possibly NULL for already open file
 
     } else {
 
-        *f = fopen(filename, "w");
+        /* read back by FinishDeferredBitmaps() */
+        *f = fopen(filename, "w+");
 
         if (*f == NULL)
             diagnostics(ERROR, "Error opening RTF file <%s>\n", filename);
 
+        setvbuf(*f, NULL, _IOFBF, RTF_BUFFER_SIZE);
+
         diagnostics(2, "Opened RTF file <%s>", filename);
     }
 }
@@ -819,7 +1539,8 @@ globals: g_tex_name;
     }
     *f = NULL;
     diagnostics(4, "Closed RTF file");
-    fprintf(ERROUT,"\n");
+    if (g_library_result == NULL)
+        fprintf(ERROUT,"\n");
 }
 
 void putRtfCharEscaped(char cThis)
@@ -832,15 +1553,15 @@ purpose: output a single escaped character to the RTF file
     if (getTexMode() == MODE_VERTICAL)
         changeTexMode(MODE_HORIZONTAL);
     if (cThis == '\\')
-        fprintRTF("%s","\\\\");
+        putRtfStr("\\\\");
     else if (cThis == '{')
-        fprintRTF("%s", "\\{");
+        putRtfStr("\\{");
     else if (cThis == '}')
-        fprintRTF("%s", "\\}");
+        putRtfStr("\\}");
     else if (cThis == '\n')
-        fprintRTF("%s", "\n\\par ");
+        putRtfStr("\n\\par ");
     else
-        fprintRTF("%c",cThis);
+        putRtfChar(cThis);
 }
 
 /****************************************************************************
@@ -855,27 +1576,29 @@ void putRtfStrEscaped(const char * string)
 }
 
 
-void fprintRTF(char *format, ...)
+static void WriteRtfText(const unsigned char *text)
 
 /****************************************************************************
-purpose: output a formatted string to the RTF file.  It is assumed that the
-         formatted string has been properly escaped for the RTF file.  
-         *ALL* output to the RTF file passes through this routine.
+purpose: copy already escaped text to the RTF file while keeping track of
+         the font changes made by its braces and control words.  Runs of
+         plain 7-bit characters are copied with a single fwrite().
  ****************************************************************************/
 {
-    char buffer[1024];
-    unsigned char *text;
-    char last='\0';
-    
-    va_list apf;
-
-    va_start(apf, format);
-    vsnprintf(buffer, 1024, format, apf);
-    va_end(apf);
-    text = (unsigned char *) buffer;
+    const unsigned char *run;
+    unsigned char last = '\0';
 
     while (*text) {
 
+        run = text;
+        while (*text && *text < 128 && *text != '{' && *text != '}' && *text != '\\')
+            text++;
+
+        if (text > run) {
+            fwrite(run, 1, (size_t) (text - run), fRtf);
+            last = text[-1];
+            continue;
+        }
+
         WriteEightBitChar(text[0], fRtf);
     
         if (*text == '{' && last != '\\')
@@ -887,11 +1610,74 @@ purpose: output a formatted string to the RTF file.  It is assumed that the
         if (*text == '\\' && last != '\\')
             MonitorFontChanges(text);
     
-        last= *text;
+        last = *text;
         text++;
     }
 }
 
+void putRtfStr(const char *string)
+
+/****************************************************************************
+purpose: output a string that has already been escaped for the RTF file,
+         equivalent to fprintRTF("%s", string) without the formatting
+ ****************************************************************************/
+{
+    if (string)
+        WriteRtfText((const unsigned char *) string);
+}
+
+void putRtfRaw(const char *string)
+
+/****************************************************************************
+purpose: output plain 7-bit RTF without looking at it.  Font changes in
+         string must be recorded by the caller with SetCurrentFont*()
+ ****************************************************************************/
+{
+    fputs(string, fRtf);
+}
+
+void putRtfChar(char cThis)
+
+/****************************************************************************
+purpose: output a single character, equivalent to fprintRTF("%c", cThis)
+ ****************************************************************************/
+{
+    char text[2];
+
+    text[0] = cThis;
+    text[1] = '\0';
+    WriteRtfText((unsigned char *) text);
+}
+
+void fprintRTF(char *format, ...)
+
+/****************************************************************************
+purpose: output a formatted string to the RTF file.  It is assumed that the
+         formatted string has been properly escaped for the RTF file.  
+         *ALL* output to the RTF file passes through this routine.
+ ****************************************************************************/
+{
+    char buffer[1024];
+    va_list apf;
+
+    /* plain text, "%s" and "%c" need no trip through vsnprintf() */
+    if (strchr(format, '%') == NULL) {
+        WriteRtfText((unsigned char *) format);
+        return;
+    }
+
+    va_start(apf, format);
+    if (strcmp(format, "%s") == 0)
+        putRtfStr(va_arg(apf, char *));
+    else if (strcmp(format, "%c") == 0)
+        putRtfChar((char) va_arg(apf, int));
+    else {
+        vsnprintf(buffer, 1024, format, apf);
+        WriteRtfText((unsigned char *) buffer);
+    }
+    va_end(apf);
+}
+
 char *getTmpPath(void)
 
 /****************************************************************************
@@ -22,6 +22,18 @@
 #define strdup my_strdup
 #endif
 
+/* the state of a conversion lives in THREAD_LOCAL variables, so that
+   every thread of a program linked with libl2r converts on its own */
+#if defined(__GNUC__)
+#define THREAD_LOCAL __thread
+#elif defined(_MSC_VER)
+#define THREAD_LOCAL __declspec(thread)
+#elif defined(__STDC_VERSION__) && __STDC_VERSION__ >= 201112L
+#define THREAD_LOCAL _Thread_local
+#else
+#define THREAD_LOCAL
+#endif
+
 #ifndef SEEK_SET
 #define SEEK_SET 0
 #define SEEK_CUR 1
@@ -55,94 +67,103 @@ typedef enum { FALSE = 0,
 extern const char  * InterpretCommentString;
 
 void            diagnostics(int level, char *format,...);
-
-extern          char *g_aux_name;
-extern          char *g_toc_name;
-extern          char *g_lof_name;
-extern          char *g_lot_name;
-extern          char *g_bbl_name;
-extern          char *g_home_dir;
-extern          char *progname;         /* name of the executable file */
-
-extern int      GermanMode;
-extern int      FrenchMode;
-extern int      RussianMode;
-extern int      CzechMode;
-extern int      pagenumbering;
-extern int      headings;
-
-extern int      g_verbosity_level;
-extern int      RecursionLevel;
+void            RelayDiagnostics(FILE *f);
+
+extern THREAD_LOCAL char *g_rtf_name;
+extern THREAD_LOCAL char *g_aux_name;
+extern THREAD_LOCAL char *g_toc_name;
+extern THREAD_LOCAL char *g_lof_name;
+extern THREAD_LOCAL char *g_lot_name;
+extern THREAD_LOCAL char *g_bbl_name;
+extern THREAD_LOCAL char *g_home_dir;
+extern THREAD_LOCAL char *progname;         /* name of the executable file */
+
+extern THREAD_LOCAL int      GermanMode;
+extern THREAD_LOCAL int      FrenchMode;
+extern THREAD_LOCAL int      RussianMode;
+extern THREAD_LOCAL int      CzechMode;
+extern THREAD_LOCAL int      pagenumbering;
+extern THREAD_LOCAL int      headings;
+
+extern THREAD_LOCAL int      g_verbosity_level;
+extern THREAD_LOCAL int      g_recover_from_errors;
+extern THREAD_LOCAL int      RecursionLevel;
+extern THREAD_LOCAL FILE *fRtf;
 
 /* table  & tabbing variables */
-extern long     pos_begin_kill;
-extern int      g_tab_counter;
-extern int      g_equation_column;
-
-extern int      twocolumn;
-extern int      titlepage;
-
-extern int      g_processing_equation;
-extern int      g_processing_preamble;
-extern int      g_processing_figure;
-extern int      g_processing_table;
-extern int      g_processing_tabbing;
-extern int      g_processing_tabular;
-extern int      g_processing_eqnarray;
-extern int      g_processing_arrays;
-extern uint16_t g_dots_per_inch;
-
-extern int      g_document_type;
-extern int      g_document_bibstyle;
+extern THREAD_LOCAL long     pos_begin_kill;
+extern THREAD_LOCAL int      g_tab_counter;
+extern THREAD_LOCAL int      g_equation_column;
+
+extern THREAD_LOCAL int      twocolumn;
+extern THREAD_LOCAL int      titlepage;
+
+extern THREAD_LOCAL int      g_processing_equation;
+extern THREAD_LOCAL int      g_processing_preamble;
+extern THREAD_LOCAL int      g_processing_figure;
+extern THREAD_LOCAL int      g_processing_table;
+extern THREAD_LOCAL int      g_processing_tabbing;
+extern THREAD_LOCAL int      g_processing_tabular;
+extern THREAD_LOCAL int      g_processing_eqnarray;
+extern THREAD_LOCAL int      g_processing_arrays;
+extern THREAD_LOCAL uint16_t g_dots_per_inch;
+
+extern THREAD_LOCAL int      g_document_type;
+extern THREAD_LOCAL int      g_document_bibstyle;
 
 extern int      g_equation_number;
-extern int      g_escape_parens;
-extern int      g_show_equation_number;
-extern int      g_enumerate_depth;
-extern int      g_suppress_equation_number;
-extern int      g_aux_file_missing;
-extern int      g_bbl_file_missing;
-extern int      g_graphics_package;
-extern int      g_amsmath_package;
-
-extern char     *g_figure_label;
-extern char     *g_table_label;
-extern char     *g_equation_label;
-extern char     *g_section_label;
-extern char     *g_config_path;
-extern char     *g_script_dir;
-extern char     g_field_separator;
-extern char     *g_preamble;
-
-extern double   g_png_equation_scale; 
-extern double   g_png_figure_scale;
-extern int      g_latex_figures;
-extern int      g_endfloat_figures;
-extern int      g_endfloat_tables;
-extern int      g_endfloat_markers;
-
-extern int      g_equation_inline_rtf;
-extern int      g_equation_display_rtf;
-extern int      g_equation_inline_bitmap;
-extern int      g_equation_display_bitmap;
-extern int      g_equation_comment;
-extern int      g_equation_raw_latex;
-extern int      g_equation_inline_eps;
-extern int      g_equation_display_eps;
-extern int      g_equation_mtef;
-
-extern int      g_figure_include_direct;
-extern int      g_figure_include_converted;
-extern int      g_figure_comment_direct;
-extern int      g_figure_comment_converted;
-
-extern int      g_tabular_display_rtf;
-extern int      g_tabular_display_bitmap;
-
-extern int      g_little_endian;
-extern int      g_tableofcontents;
+extern THREAD_LOCAL int      g_escape_parens;
+extern THREAD_LOCAL int      g_lookup_stats;
+extern THREAD_LOCAL int      g_show_equation_number;
+extern THREAD_LOCAL int      g_enumerate_depth;
+extern THREAD_LOCAL int      g_suppress_equation_number;
+extern THREAD_LOCAL int      g_aux_file_missing;
+extern THREAD_LOCAL int      g_bbl_file_missing;
+extern THREAD_LOCAL int      g_graphics_package;
+extern THREAD_LOCAL int      g_amsmath_package;
+
+extern THREAD_LOCAL char     *g_figure_label;
+extern THREAD_LOCAL char     *g_table_label;
+extern THREAD_LOCAL char     *g_equation_label;
+extern THREAD_LOCAL char     *g_section_label;
+extern THREAD_LOCAL char     *g_config_path;
+extern THREAD_LOCAL char     *g_script_dir;
+extern THREAD_LOCAL char     *g_tmp_dir;
+extern THREAD_LOCAL char     g_field_separator;
+extern THREAD_LOCAL char     *g_preamble;
+
+extern THREAD_LOCAL double   g_png_equation_scale; 
+extern THREAD_LOCAL double   g_png_figure_scale;
+extern THREAD_LOCAL int      g_latex_figures;
+extern THREAD_LOCAL int      g_endfloat_figures;
+extern THREAD_LOCAL int      g_endfloat_tables;
+extern THREAD_LOCAL int      g_endfloat_markers;
+
+extern THREAD_LOCAL int      g_equation_inline_rtf;
+extern THREAD_LOCAL int      g_equation_display_rtf;
+extern THREAD_LOCAL int      g_equation_inline_bitmap;
+extern THREAD_LOCAL int      g_equation_display_bitmap;
+extern THREAD_LOCAL int      g_equation_comment;
+extern THREAD_LOCAL int      g_equation_raw_latex;
+extern THREAD_LOCAL int      g_equation_inline_eps;
+extern THREAD_LOCAL int      g_equation_display_eps;
+extern THREAD_LOCAL int      g_equation_mtef;
+
+extern THREAD_LOCAL int      g_figure_include_direct;
+extern THREAD_LOCAL int      g_figure_include_converted;
+extern THREAD_LOCAL int      g_figure_comment_direct;
+extern THREAD_LOCAL int      g_figure_comment_converted;
+
+extern THREAD_LOCAL int      g_tabular_display_rtf;
+extern THREAD_LOCAL int      g_tabular_display_bitmap;
+
+extern THREAD_LOCAL int      g_little_endian;
+extern THREAD_LOCAL int      g_tableofcontents;
 
 void fprintRTF(char *format, ...);
+void putRtfStr(const char *string);
+void putRtfChar(char cThis);
+void putRtfRaw(const char *string);
 void putRtfCharEscaped(char cThis);
 void putRtfStrEscaped(const char * string);
 char *getTmpPath(void);
@@ -4,10 +4,10 @@
  * to the man pages, is written by Henry Spencer to emulate the Bell Lab
  * version).
  * 
- * my_getopt is scanning argv[optind] (and, perhaps, following arguments),
+ * my_getopt is scanning argv[my_optind] (and, perhaps, following arguments),
  * looking for the first option starting with `-' and a character from
  * optstring[]. Therefore, if you are looking for options in argv[1] etc.,
- * you should initialize optind with 1 (not 0, as the manual erroneously
+ * you should initialize my_optind with 1 (not 0, as the manual erroneously
  * claims).
  * 
  * Experiments with getopt() established that when an argument consists of more
@@ -24,32 +24,34 @@
 #include "main.h"
 #include "mygetopt.h"
 
-char *optarg = 0;
-int optind = 1;
+THREAD_LOCAL char *my_optarg = 0;
+THREAD_LOCAL int my_optind = 1;
 
 int my_getopt(int argc, char **argv, char *optstring)
 {
     char *q;
-    static char *rem = NULL;
+    static THREAD_LOCAL char *rem = NULL;
     int c;
     int needarg = 0;
 
-    optarg = NULL;
+    my_optarg = NULL;
 
-    diagnostics(4, "Processing option `%s'", argv[optind]);
+    diagnostics(4, "Processing option `%s'", argv[my_optind]);
 
     /* 
-     * printf("optind = %d\n", optind);  if (rem) printf("rem=`%s'\n",
+     * printf("my_optind = %d\n", my_optind);  if (rem) printf("rem=`%s'\n",
      * rem);
      */
 
     if (!rem) {
-        if (optind < argc && argv[optind][0] == '-') {
-            rem = argv[optind] + 1;
-            if (*rem == 0)
+        if (my_optind < argc && argv[my_optind][0] == '-') {
+            rem = argv[my_optind] + 1;
+            if (*rem == 0) {
+                rem = NULL;
                 return EOF;     /* Treat lone "-" as a non-option arg */
+            }
             if (*rem == '-') {
-                optind++;
+                my_optind++;
                 return EOF;
             }                   /* skip "--" and terminate */
         } else
@@ -61,11 +63,11 @@ int my_getopt(int argc, char **argv, char *optstring)
         needarg = (q[1] == ':');
         if (needarg) {
             if (rem[1] != 0)
-                optarg = rem + 1;
+                my_optarg = rem + 1;
             else {
-                optind++;
-                if (optind < argc)
-                    optarg = argv[optind];
+                my_optind++;
+                if (my_optind < argc)
+                    my_optarg = argv[my_optind];
                 else {
                     diagnostics(ERROR, "Missing argument after -%c\n", c);
                 }
@@ -79,7 +81,7 @@ int my_getopt(int argc, char **argv, char *optstring)
     }
     if (needarg || *rem == 0) {
         rem = NULL;
-        optind++;
+        my_optind++;
     }
     return c;
 }
@@ -1 +1,4 @@
+extern THREAD_LOCAL char *my_optarg;
+extern THREAD_LOCAL int my_optind;
+
 int             my_getopt(int argc, char **argv, char *optstring);
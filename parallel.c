@@ -0,0 +1,782 @@
+/* parallel.c - convert the sections found by preParse() in worker processes
+
+Copyright (C) 2014 The Free Software Foundation
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+This file is available from http://sourceforge.net/projects/latex2rtf/
+
+    Runs of sections are converted by forked copies of latex2rtf, each
+    into its own temporary files, and the files are appended to the RTF
+    file in document order.  A run of sections is called a job below.
+    A job holds about JOB_SIZE bytes of LaTeX so that the cost of the
+    fork is spread over several short sections.
+
+    A worker starts with a copy of the font, environment and counter
+    state of the parent.  The parent does not convert the sections
+    itself, it only makes a quick pass over each one: the section
+    heading is converted with the output thrown away (this sets the
+    sectioning counters) and the body is scanned for captions, numbered
+    equations, labels and explicit counter changes.  This guesses the
+    counters and bookmarks the next job will start with.
+
+    Every worker reports the state it finished with.  Jobs are accepted
+    in order, and a job is only accepted if it was started with exactly
+    the state that the previous job finished with.  A job started with a
+    bad guess is converted again with the right state, so the output is
+    always the same as a sequential run.
+
+    The parent keeps reading ahead, and preParse() adds the definitions
+    it finds to the parent as it goes.  A worker is forked as soon as the
+    first section of its job has been read and gets the other sections
+    through a pipe, and a job ends at the first section that changes a
+    definition.  For the same reason a job must not be converted again
+    from the parent.  A spare copy of the parent is forked next to each
+    worker instead.  The spare waits on a pipe and either exits when the
+    pipe is closed or converts the job again with the state and the
+    sections that are written to it.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+#include "parallel.h"
+
+THREAD_LOCAL int g_section_jobs = 0;
+
+#ifdef UNIX
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "auxfile.h"
+#include "convert.h"
+#include "counters.h"
+#include "definitions.h"
+#include "fonts.h"
+#include "funct1.h"
+#include "graphics.h"
+#include "lengths.h"
+#include "parser.h"
+#include "preparse.h"
+#include "stack.h"
+#include "utils.h"
+#include "vertical.h"
+#include "xrefs.h"
+
+#define MAX_SECTION_JOBS 64
+#define MAX_JOB_SECTIONS 32
+#define JOB_SIZE         32768  /* LaTeX handed to a worker, fits in a pipe */
+
+typedef struct {
+    char *head;                 /* e.g., \section{Cows eat grass} */
+    char *body;
+    char *label;                /* label for the section or NULL */
+    int line;                   /* line number the head is converted at */
+} sectionText;
+
+typedef struct {
+    sectionText text[MAX_JOB_SECTIONS];
+    int sections;
+    size_t size;                /* of all the sections in bytes */
+    char *start;                /* state the worker was started with */
+    FILE *rtf;                  /* RTF written by the worker */
+    FILE *err;                  /* diagnostics written by the worker */
+    FILE *state;                /* state the worker finished with */
+    FILE *more;                 /* hands the other sections to the worker */
+    pid_t pid;                  /* 0 once the worker has finished */
+    int failed;
+    pid_t spare;                /* copy waiting to convert the job again */
+    int spare_fd;               /* pipe to the spare, 0 if there is none */
+} sectionJob;
+
+static sectionJob jobs[4 * MAX_SECTION_JOBS];
+static int window;
+static int next_line;           /* line number the next section starts at */
+
+static char *WriteInts(char *s, const int *v, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++) {
+        sprintf(s, "%d ", v[i]);
+        s += strlen(s);
+    }
+    *(s - 1) = '\n';
+    return s;
+}
+
+static char *ReadInts(char *s, int *v, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        v[i] = (int) strtol(s, &s, 10);
+    return strchr(s, '\n') + 1;
+}
+
+static char *SaveSectionState(void)
+
+/******************************************************************************
+  purpose: everything that one section passes on to the next one.  The
+           first seven lines are the numbering style, the paragraph state,
+           the font state, the brace stack, the lengths, the \\urlstyle and
+           the \\baseurl.  These are followed by the bookmarks and the
+           counters.
+ ******************************************************************************/
+{
+    char layout[512], *t, *stack, *lengths, *url, *bookmarks, *counters, *s;
+    int v[VERTICAL_STATE_SIZE + FONT_STATE_SIZE];
+
+    getSectionNumbering(&v[0], &v[1], &v[2]);
+    t = WriteInts(layout, v, 3);
+    getVerticalState(v);
+    t = WriteInts(t, v, VERTICAL_STATE_SIZE);
+    getFontState(v);
+    WriteInts(t, v, FONT_STATE_SIZE);
+
+    stack = saveStack();
+    lengths = saveLengths();
+    url = saveUrlState();
+    bookmarks = saveBookmarks();
+    counters = saveCounters();
+    t = strdup_together3(layout, stack, lengths);
+    s = strdup_together4(t, url, bookmarks, counters);
+    free(t);
+    free(stack);
+    free(lengths);
+    free(url);
+    free(bookmarks);
+    free(counters);
+    return s;
+}
+
+static char *RestoreLayout(char *s)
+
+/******************************************************************************
+  purpose: restore everything but the numbering and counters saved in s
+  returns: the saved bookmarks and counters
+ ******************************************************************************/
+{
+    int v[VERTICAL_STATE_SIZE + FONT_STATE_SIZE];
+
+    s = strchr(s, '\n') + 1;
+    s = ReadInts(s, v, VERTICAL_STATE_SIZE);
+    setVerticalState(v);
+    s = ReadInts(s, v, FONT_STATE_SIZE);
+    setFontState(v);
+    restoreStack(s);
+    s = strchr(s, '\n') + 1;
+    restoreLengths(s);
+    s = strchr(s, '\n') + 1;
+    restoreUrlState(s);
+    s = strchr(s, '\n') + 1;
+    return strchr(s, '\n') + 1;
+}
+
+static void RestoreSectionState(char *s)
+{
+    int v[3];
+
+    ReadInts(s, v, 3);
+    setSectionNumbering(v[0], v[1], v[2]);
+    s = RestoreLayout(s);
+    restoreBookmarks(s);
+    restoreCounters(strchr(s, '\n') + 1);
+}
+
+static char *ReadWholeFile(FILE *f)
+{
+    long n;
+    char *s;
+
+    fseek(f, 0, SEEK_END);
+    n = ftell(f);
+    rewind(f);
+    s = (char *) malloc(n + 1);
+    if (s == NULL)
+        diagnostics(ERROR, "Cannot allocate memory for section state");
+    n = (long) fread(s, 1, n, f);
+    s[n] = '\0';
+    return s;
+}
+
+static void CopyWholeFile(FILE *from, FILE *to)
+{
+    char buffer[8192];
+    size_t n;
+
+    rewind(from);
+    while ((n = fread(buffer, 1, sizeof(buffer), from)) > 0)
+        fwrite(buffer, 1, n, to);
+}
+
+static void CloseSectionFiles(sectionJob *job)
+{
+    if (job->rtf)
+        fclose(job->rtf);
+    if (job->err)
+        fclose(job->err);
+    if (job->state)
+        fclose(job->state);
+    job->rtf = job->err = job->state = NULL;
+}
+
+static void CloseSparePipes(void)
+
+/******************************************************************************
+  purpose: a child must not keep the pipes to the spares open, otherwise
+           a spare does not see the pipe being closed by the parent
+ ******************************************************************************/
+{
+    int i;
+
+    for (i = 0; i < window; i++) {
+        if (jobs[i].spare_fd > 0)
+            close(jobs[i].spare_fd);
+    }
+}
+
+static void WriteText(FILE *f, const char *s)
+{
+    fprintf(f, "%lu\n", (unsigned long) (s ? strlen(s) : 0));
+    if (s)
+        fputs(s, f);
+}
+
+static char *ReadText(FILE *f)
+
+/******************************************************************************
+  purpose: read a string written by WriteText()
+  returns: the string or NULL at the end of the pipe or for an empty string
+ ******************************************************************************/
+{
+    unsigned long n;
+    char *s;
+
+    if (fscanf(f, "%lu", &n) != 1 || getc(f) != '\n' || n == 0)
+        return NULL;
+
+    s = (char *) malloc(n + 1);
+    if (s == NULL || fread(s, 1, n, f) != n)
+        _exit(EXIT_FAILURE);
+    s[n] = '\0';
+    return s;
+}
+
+static void WriteSection(FILE *f, sectionText *t)
+{
+    fprintf(f, "%d\n", t->line);
+    WriteText(f, t->head);
+    WriteText(f, t->label);
+    WriteText(f, t->body);
+}
+
+static int ReadSection(FILE *f, sectionText *t)
+{
+    if (fscanf(f, "%d", &t->line) != 1 || getc(f) != '\n')
+        t->line = 0;
+    t->head = ReadText(f);
+    t->label = ReadText(f);
+    t->body = ReadText(f);
+    return t->head != NULL;
+}
+
+static void FreeSection(sectionText *t)
+{
+    safe_free(t->head);
+    safe_free(t->label);
+    safe_free(t->body);
+    t->head = t->label = t->body = NULL;
+}
+
+static void ConvertSectionText(sectionText *t)
+{
+    safe_free(g_section_label);
+    g_section_label = t->label ? strdup(t->label) : NULL;
+    SetLineNumber(t->line);
+    ConvertString(t->head);
+    if (t->body)
+        ConvertString(t->body);
+}
+
+static void ConvertSections(sectionJob *job, int number, FILE *more)
+
+/******************************************************************************
+  purpose: converts the first section of a job starting from job->start and
+           then the other sections of the job as they arrive on 'more'
+ ******************************************************************************/
+{
+    sectionText t;
+    char *state;
+
+    dup2(fileno(job->err), fileno(stderr));
+    RestoreSectionState(job->start);
+    setEquationFileNumber(10000 * number);
+    fRtf = job->rtf;
+    BeginDeferredBitmaps(fRtf);
+
+    ConvertSectionText(&job->text[0]);
+    while (ReadSection(more, &t)) {
+        ConvertSectionText(&t);
+        FreeSection(&t);
+    }
+    FinishDeferredBitmaps();
+
+    state = SaveSectionState();
+    fputs(state, job->state);
+    fflush(NULL);
+}
+
+static void Rewrite(FILE *f)
+{
+    rewind(f);
+    if (ftruncate(fileno(f), 0) != 0)
+        _exit(EXIT_FAILURE);
+}
+
+static void RunSpare(sectionJob *job, int number, int from)
+
+/******************************************************************************
+  purpose: the spare waits for the state to start from and the rest of the
+           sections, and exits when the pipe is closed without them
+ ******************************************************************************/
+{
+    FILE *f = fdopen(from, "rb");
+
+    if (f == NULL)
+        _exit(EXIT_FAILURE);
+    free(job->start);
+    job->start = ReadText(f);
+    if (job->start == NULL)
+        _exit(EXIT_SUCCESS);
+
+    Rewrite(job->rtf);
+    Rewrite(job->err);
+    Rewrite(job->state);
+    ConvertSections(job, number, f);
+    _exit(EXIT_SUCCESS);
+}
+
+static void StartSection(sectionJob *job, int number)
+
+/******************************************************************************
+  purpose: fork a worker that converts the first section of a job starting
+           from job->start, and a spare copy of the parent as it is now
+ ******************************************************************************/
+{
+    int from[2], more[2];
+    FILE *f;
+
+    CloseSectionFiles(job);
+    job->rtf = tmpfile();
+    job->err = tmpfile();
+    job->state = tmpfile();
+    if (job->rtf == NULL || job->err == NULL || job->state == NULL)
+        diagnostics(ERROR, "Cannot create temporary files for section %d", number);
+
+    if (pipe(from) != 0)
+        diagnostics(ERROR, "Cannot create a pipe for section %d", number);
+
+    fflush(NULL);               /* or the children write these buffers too */
+    job->spare = fork();
+    if (job->spare < 0)
+        diagnostics(ERROR, "Cannot start a worker for section %d", number);
+
+    if (job->spare == 0) {
+        g_recover_from_errors = FALSE;
+        close(from[1]);
+        CloseSparePipes();
+        RunSpare(job, number, from[0]);
+    }
+
+    close(from[0]);
+    job->spare_fd = from[1];
+
+    if (pipe(more) != 0)
+        diagnostics(ERROR, "Cannot create a pipe for section %d", number);
+
+    job->pid = fork();
+    if (job->pid < 0)
+        diagnostics(ERROR, "Cannot start a worker for section %d", number);
+
+    if (job->pid == 0) {
+        g_recover_from_errors = FALSE;
+        close(more[1]);
+        CloseSparePipes();
+        f = fdopen(more[0], "rb");
+        if (f == NULL)
+            _exit(EXIT_FAILURE);
+        ConvertSections(job, number, f);
+        _exit(EXIT_SUCCESS);
+    }
+
+    close(more[0]);
+    job->more = fdopen(more[1], "wb");
+    if (job->more == NULL)
+        diagnostics(ERROR, "Cannot create a pipe for section %d", number);
+}
+
+static void AddSection(sectionJob *job, sectionText *t)
+
+/******************************************************************************
+  purpose: hand another section to a worker that has been started
+ ******************************************************************************/
+{
+    job->text[job->sections++] = *t;
+    job->size += strlen(t->head) + strlen(t->body);
+    WriteSection(job->more, t);
+    fflush(job->more);
+}
+
+static void ReleaseSpare(sectionJob *job, const char *state)
+
+/******************************************************************************
+  purpose: have the spare convert the job again starting from state, or let
+           the spare go when state is NULL
+ ******************************************************************************/
+{
+    FILE *f;
+    int i;
+
+    if (state == NULL) {
+        close(job->spare_fd);
+        waitpid(job->spare, NULL, 0);
+    } else {
+        f = fdopen(job->spare_fd, "wb");
+        if (f == NULL)
+            diagnostics(ERROR, "Lost track of the section workers");
+        WriteText(f, state);
+        for (i = 1; i < job->sections; i++)
+            WriteSection(f, &job->text[i]);
+        fclose(f);
+        job->pid = job->spare;
+    }
+    job->spare = 0;
+    job->spare_fd = 0;
+}
+
+static int WaitForSection(void)
+
+/******************************************************************************
+  purpose: wait for any one worker to finish
+  returns: TRUE if it was one of the workers
+ ******************************************************************************/
+{
+    int i, status;
+    pid_t pid;
+
+    pid = waitpid(-1, &status, 0);
+    if (pid < 0)
+        diagnostics(ERROR, "Lost track of the section workers");
+
+    for (i = 0; i < window; i++) {
+        if (jobs[i].pid == pid) {
+            jobs[i].pid = 0;
+            jobs[i].failed = !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static char *SkipArgument(char *s)
+
+/******************************************************************************
+  purpose: returns the character after the {...} group that starts at s
+ ******************************************************************************/
+{
+    int depth = 0;
+
+    while (*s == ' ' || *s == '\n')
+        s++;
+    if (*s != '{')
+        return s;
+
+    for (; *s; s++) {
+        if (*s == '\\' && *(s + 1))
+            s++;
+        else if (*s == '{')
+            depth++;
+        else if (*s == '}' && --depth == 0)
+            return s + 1;
+    }
+    return s;
+}
+
+static int IsNumberedEquation(char *env)
+{
+    return strncmp(env, "equation}", 9) == 0 ||
+           strncmp(env, "eqnarray}", 9) == 0 ||
+           strncmp(env, "align}", 6) == 0;
+}
+
+static void EstimateSection(char *body)
+
+/******************************************************************************
+  purpose: update the counters and bookmarks for what the body of a
+           section will do without converting it.  Mistakes only cost time.
+ ******************************************************************************/
+{
+    char *s, *t, *cmd;
+    int figure_depth = 0, equation = 0, rows = 0, multiline = 0;
+
+    for (s = body; (s = strchr(s, '\\')) != NULL;) {
+        cmd = s + 1;
+
+        if (*cmd == '\\') {
+            if (equation && multiline)
+                rows++;
+            s += 2;
+            continue;
+        }
+
+        if (strstarts(cmd, "begin{")) {
+            if (strstarts(cmd + 6, "figure"))
+                figure_depth++;
+            if (IsNumberedEquation(cmd + 6)) {
+                equation = TRUE;
+                multiline = !strstarts(cmd + 6, "equation");
+                rows = 1;
+            }
+        } else if (strstarts(cmd, "end{")) {
+            if (strstarts(cmd + 4, "figure") && figure_depth > 0)
+                figure_depth--;
+            if (equation && IsNumberedEquation(cmd + 4)) {
+                while (rows-- > 0)
+                    incrementCounter("equation");
+                equation = FALSE;
+            }
+        } else if (strstarts(cmd, "nonumber") || strstarts(cmd, "notag")) {
+            if (equation)
+                rows--;
+        } else if (strstarts(cmd, "label{")) {
+            t = SkipArgument(cmd + 5);
+            if (*(t - 1) == '}') {
+                cmd = my_strndup(cmd + 6, t - cmd - 7);
+                addBookmark(cmd);
+                free(cmd);
+            }
+        } else if (strstarts(cmd, "caption")) {
+            incrementCounter(figure_depth ? "figure" : "table");
+        } else if (strstarts(cmd, "appendix")) {
+            ConvertString("\\appendix");
+        } else if (strstarts(cmd, "newcounter")) {
+            t = SkipArgument(cmd + strlen("newcounter"));
+            cmd = my_strndup(s, t - s);
+            ConvertString(cmd);
+            free(cmd);
+        } else if (strstarts(cmd, "setcounter") || strstarts(cmd, "addtocounter")) {
+            t = cmd + (*cmd == 's' ? strlen("setcounter") : strlen("addtocounter"));
+            t = SkipArgument(SkipArgument(t));
+            cmd = my_strndup(s, t - s);
+            ConvertString(cmd);
+            free(cmd);
+        }
+        s++;
+    }
+}
+
+static void EstimateNextSection(sectionText *t)
+
+/******************************************************************************
+  purpose: the quick pass over a section, which leaves the parent with a
+           guess for the state the next section starts with.  Everything
+           this changes is restored before the next worker starts.
+ ******************************************************************************/
+{
+    static FILE *nowhere = NULL;
+    FILE *rtf = fRtf;
+    int level = g_verbosity_level;
+
+    if (nowhere == NULL)
+        nowhere = fopen("/dev/null", "wb");
+    if (nowhere == NULL)
+        diagnostics(ERROR, "Cannot open /dev/null");
+
+    fRtf = nowhere;
+    g_verbosity_level = 0;
+    safe_free(g_section_label);
+    g_section_label = t->label ? strdup(t->label) : NULL;
+    ConvertString(t->head);
+    EstimateSection(t->body);
+    fRtf = rtf;
+    g_verbosity_level = level;
+}
+
+static int CountLines(const char *s)
+{
+    int n = 0;
+
+    for (; s && *s; s++) {
+        if (*s == '\n')
+            n++;
+    }
+    return n;
+}
+
+static char *NextSection(char *sec_head, sectionText *t)
+
+/******************************************************************************
+  purpose: split off the body of the section that starts with sec_head
+  returns: the header of the section after it
+ ******************************************************************************/
+{
+    char *next_head, *label;
+
+    preParse(&t->body, &next_head, &g_section_label);
+    label = ExtractLabelTag(sec_head);
+    if (label) {
+        safe_free(g_section_label);
+        g_section_label = label;
+    }
+    diagnostics(2, "processing '%s' in a worker", sec_head);
+
+    t->head = sec_head;
+    t->label = g_section_label;
+
+    /* the line numbers of a sequential run, which counts the lines converted */
+    t->line = next_line;
+    next_line += CountLines(t->head) + CountLines(t->body);
+    g_section_label = NULL;
+    return next_head;
+}
+
+char *ConvertSectionsInParallel(char *sec_head)
+
+/******************************************************************************
+  purpose: converts every section from sec_head up to \end{document}
+  returns: the header that ended the document
+ ******************************************************************************/
+{
+    sectionJob *job;
+    sectionText next;
+    char *actual, *guess;
+    int njobs, running = 0, started = 0, done = 0;
+    int at_end, changes, i;
+
+    njobs = g_section_jobs;
+    if (njobs > MAX_SECTION_JOBS)
+        njobs = MAX_SECTION_JOBS;
+    window = 4 * njobs;
+    memset(jobs, 0, sizeof(jobs));
+    next.head = NULL;
+    next_line = CurrentLineNumber();
+
+    /* read the .aux file once, before forking the workers */
+    LoadAuxFile();
+
+    actual = SaveSectionState();
+    guess = strdup(actual);
+    at_end = (strcmp(sec_head, "\\end{document}") == 0);
+
+    while (!at_end || next.head || done < started) {
+
+        /* hand out the next sections */
+        while ((!at_end || next.head) && running < njobs && started - done < window) {
+            job = &jobs[started % window];
+
+            if (next.head == NULL) {
+                sec_head = NextSection(sec_head, &next);
+                at_end = (strcmp(sec_head, "\\end{document}") == 0);
+            }
+            job->text[0] = next;
+            job->sections = 1;
+            job->size = strlen(next.head) + strlen(next.body);
+            next.head = NULL;
+
+            /* the counters are guessed from the previous sections, the
+               rest is taken from the last section that is known.  The
+               guess misses counters that are created on the fly. */
+            RestoreSectionState(guess);
+            mergeCounters(strchr(RestoreLayout(actual), '\n') + 1);
+            free(guess);
+            job->start = SaveSectionState();
+            StartSection(job, started + 1);
+            EstimateNextSection(&job->text[0]);
+
+            /* short sections are handed to the same worker, unless a
+               definition changes because the worker does not see that */
+            while (!at_end && job->sections < MAX_JOB_SECTIONS && job->size < JOB_SIZE) {
+                changes = definitionChanges();
+                sec_head = NextSection(sec_head, &next);
+                at_end = (strcmp(sec_head, "\\end{document}") == 0);
+                if (changes != definitionChanges() ||
+                    job->size + strlen(next.head) + strlen(next.body) > JOB_SIZE)
+                    break;
+                AddSection(job, &next);
+                EstimateNextSection(&next);
+                next.head = NULL;
+            }
+
+            fclose(job->more);
+            job->more = NULL;
+            guess = SaveSectionState();
+            running++;
+            started++;
+        }
+
+        /* collect the next job in document order */
+        job = &jobs[done % window];
+        if (job->pid) {
+            if (WaitForSection())
+                running--;
+            continue;
+        }
+
+        if (job->spare && strcmp(job->start, actual) != 0) {
+            diagnostics(3, "converting '%s' again with the right counters", job->text[0].head);
+            ReleaseSpare(job, actual);
+            running++;
+            continue;
+        }
+        if (job->spare)
+            ReleaseSpare(job, NULL);
+
+        if (job->failed) {
+            RelayDiagnostics(job->err);
+            diagnostics(ERROR, "Conversion of '%s' failed", job->text[0].head);
+        }
+
+        CopyWholeFile(job->rtf, fRtf);
+        RelayDiagnostics(job->err);
+        free(actual);
+        actual = ReadWholeFile(job->state);
+
+        CloseSectionFiles(job);
+        for (i = 0; i < job->sections; i++)
+            FreeSection(&job->text[i]);
+        free(job->start);
+        memset(job, 0, sizeof(sectionJob));
+        done++;
+    }
+
+    RestoreSectionState(actual);
+    SetLineNumber(next_line);
+    free(actual);
+    free(guess);
+    return sec_head;
+}
+
+#else
+
+char *ConvertSectionsInParallel(char *sec_head)
+{
+    diagnostics(WARNING, "Sections can only be converted in parallel on Unix");
+    g_section_jobs = 0;
+    return sec_head;
+}
+
+#endif
@@ -0,0 +1,3 @@
+extern THREAD_LOCAL int g_section_jobs;
+
+char *ConvertSectionsInParallel(char *sec_head);
@@ -30,6 +30,15 @@ Authors:
 #include <ctype.h>
 
 #include "main.h"
+
+#ifdef UNIX
+#define HAS_MMAP
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
 #include "commands.h"
 #include "cfg.h"
 #include "stack.h"
@@ -47,27 +56,29 @@ typedef struct InputStackType {
     FILE *file;
     char *file_name;
     int file_line;
+    int is_file;                /* file contents, read via FILE* or string */
+    size_t map_size;            /* >0 when string_start is mmap'ed */
 } InputStackType;
 
 #define PARSER_SOURCE_MAX 100
 #define SCAN_BUFFER_SIZE   5000
 
-static InputStackType g_parser_stack[PARSER_SOURCE_MAX];
+static THREAD_LOCAL InputStackType g_parser_stack[PARSER_SOURCE_MAX];
 
-static int g_parser_depth = -1;
-static char *g_parser_string = "stdin";
-static FILE *g_parser_file = NULL;
-static int g_parser_line = 1;
-static int g_parser_include_level = 0;
+static THREAD_LOCAL int g_parser_depth = -1;
+static THREAD_LOCAL char *g_parser_string = "stdin";
+static THREAD_LOCAL FILE *g_parser_file = NULL;
+static THREAD_LOCAL int g_parser_line = 1;
+static THREAD_LOCAL int g_parser_include_level = 0;
 
-static char g_parser_currentChar;   /* Global current character */
-static char g_parser_lastChar;
-static char g_parser_penultimateChar;
-static int g_parser_backslashes;
+static THREAD_LOCAL char g_parser_currentChar;   /* Global current character */
+static THREAD_LOCAL char g_parser_lastChar;
+static THREAD_LOCAL char g_parser_penultimateChar;
+static THREAD_LOCAL int g_parser_backslashes;
 
 #define TRACK_LINE_NUMBER_MAX 10
-static int g_track_line_number_stack[TRACK_LINE_NUMBER_MAX];
-static int g_track_line_number = -1;
+static THREAD_LOCAL int g_track_line_number_stack[TRACK_LINE_NUMBER_MAX];
+static THREAD_LOCAL int g_track_line_number = -1;
 
 void PushTrackLineNumber(int flag)
 
@@ -94,6 +105,26 @@ void PopTrackLineNumber(void)
     g_track_line_number--;
 }
 
+void ResetParser(void)
+
+/***************************************************************************
+ purpose:    close every source still open and start over as for a new file
+****************************************************************************/
+{
+    while (g_parser_depth >= 0)
+        PopSource();
+
+    g_parser_string = "stdin";
+    g_parser_file = NULL;
+    g_parser_line = 1;
+    g_parser_include_level = 0;
+    g_parser_currentChar = '\0';
+    g_parser_lastChar = '\0';
+    g_parser_penultimateChar = '\0';
+    g_parser_backslashes = 0;
+    g_track_line_number = -1;
+}
+
 /***************************************************************************
  purpose:     returns the current line number of the text being processed
 ****************************************************************************/
@@ -102,6 +133,15 @@ int CurrentLineNumber(void)
     return g_parser_line;
 }
 
+/***************************************************************************
+ purpose:     sets the line number, for text that was split off the file
+              and is converted elsewhere
+****************************************************************************/
+void SetLineNumber(int line)
+{
+    g_parser_line = line;
+}
+
 void UpdateLineNumber(char *s)
 
 /***************************************************************************
@@ -138,7 +178,7 @@ char *CurrentFileName(void)
 {
     char *s = "(Not set)";
 
-    if (g_parser_stack[g_parser_depth].file_name)
+    if (g_parser_depth >= 0 && g_parser_stack[g_parser_depth].file_name)
         return g_parser_stack[g_parser_depth].file_name;
     else
         return s;
@@ -148,17 +188,71 @@ char *CurrentFileName(void)
     The following two routines allow parsing of multiple files and strings
 */
 
-int PushSource(const char *filename, const char *string)
+static char *ReadSourceFile(FILE *p, size_t *map_size)
+
+/***************************************************************************
+ purpose:     load the entire contents of an opened file so that it can be
+              parsed exactly like a string source.  Regular files are mapped
+              into memory (privately, so that ungetTexChar may write to it);
+              if the file length is a multiple of the page size there is no
+              room for the terminating '\0' and the file is read instead.
+              p is closed if the contents are returned.
+ returns:     NUL-terminated contents or NULL to fall back to stdio
+****************************************************************************/
+{
+#ifdef HAS_MMAP
+    struct stat sb;
+    char *s;
+    size_t size, n = 0;
+    ssize_t got;
+    int fd = fileno(p);
+
+    if (fstat(fd, &sb) != 0 || !S_ISREG(sb.st_mode))
+        return NULL;
+
+    size = (size_t) sb.st_size;
+    *map_size = 0;
+
+    if (size > 0 && size % (size_t) sysconf(_SC_PAGESIZE) != 0) {
+        s = (char *) mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+        if (s != (char *) MAP_FAILED) {
+            madvise(s, size, MADV_SEQUENTIAL);
+            diagnostics(5, "mapped %lu bytes of source file", (unsigned long) size);
+            *map_size = size;
+            fclose(p);
+            return s;
+        }
+    }
+
+    s = (char *) malloc(size + 1);
+    if (s == NULL)
+        return NULL;
+
+    while (n < size && (got = read(fd, s + n, size - n)) > 0)
+        n += (size_t) got;
+    s[n] = '\0';
+
+    fclose(p);
+    return s;
+#else
+    return NULL;
+#endif
+}
+
+static int PushSourceString(const char *filename, const char *string, int copy)
 
 /***************************************************************************
  purpose:     change the source used by getRawTexChar() to either file or string
               --> pass NULL for unused argument (both NULL means use stdin)
-              --> PushSource duplicates string
+              --> string is duplicated when copy is TRUE and otherwise
+                  becomes the property of the parser
 ****************************************************************************/
 {
     char s[50];
     FILE *p = NULL;
     char *name = NULL;
+    char *contents = NULL;
+    size_t map_size = 0;
     int i;
     int line = 1;
 
@@ -194,6 +288,9 @@ int PushSource(const char *filename, const char *string)
         p = my_fopen((char *)filename, "rb");
         if (p == NULL)
             return 1;
+        contents = ReadSourceFile(p, &map_size);
+        if (contents)
+            p = NULL;
         g_parser_include_level++;
         g_parser_line = 1;
         name = strdup(filename);
@@ -208,16 +305,23 @@ int PushSource(const char *filename, const char *string)
     if (g_parser_depth >= PARSER_SOURCE_MAX)
         diagnostics(ERROR, "More than %d PushSource() calls", (int) PARSER_SOURCE_MAX);
 
-    g_parser_string = (string) ? strdup(string) : NULL;
+    if (contents)
+        g_parser_string = contents;
+    else if (string && copy)
+        g_parser_string = strdup(string);
+    else
+        g_parser_string = (char *) string;
     g_parser_stack[g_parser_depth].string = g_parser_string;
     g_parser_stack[g_parser_depth].string_start = g_parser_string;
     g_parser_stack[g_parser_depth].file = p;
     g_parser_stack[g_parser_depth].file_line = line;
     g_parser_stack[g_parser_depth].file_name = name;
+    g_parser_stack[g_parser_depth].is_file = (p != NULL || contents != NULL);
+    g_parser_stack[g_parser_depth].map_size = map_size;
     g_parser_file = p;
     g_parser_string = g_parser_stack[g_parser_depth].string;
 
-    if (g_parser_file) {
+    if (g_parser_stack[g_parser_depth].is_file) {
         diagnostics(3, "Opening Source File %s", g_parser_stack[g_parser_depth].file_name);
     } else {
         diagnostics(4, "Opening Source string");
@@ -240,6 +344,25 @@ int PushSource(const char *filename, const char *string)
     return 0;
 }
 
+int PushSource(const char *filename, const char *string)
+
+/***************************************************************************
+ purpose:     change the source to a file or a copy of string
+****************************************************************************/
+{
+    return PushSourceString(filename, string, TRUE);
+}
+
+int PushOwnedSource(char *string)
+
+/***************************************************************************
+ purpose:     change the source to string without copying it; string must
+              have been malloc'ed and is freed by PopSource()
+****************************************************************************/
+{
+    return PushSourceString(NULL, string, FALSE);
+}
+
 int StillSource(void)
 
 /***************************************************************************
@@ -290,9 +413,10 @@ void PopSource(void)
         }
     }
 
-    if (g_parser_file) {
+    if (g_parser_stack[g_parser_depth].is_file) {
         diagnostics(3, "Closing Source File '%s'", g_parser_stack[g_parser_depth].file_name);
-        fclose(g_parser_file);
+        if (g_parser_file && g_parser_file != stdin)
+            fclose(g_parser_file);
         free(g_parser_stack[g_parser_depth].file_name);
         g_parser_stack[g_parser_depth].file_name = NULL;
         g_parser_include_level--;
@@ -307,8 +431,14 @@ void PopSource(void)
         }
 
         show_string(5, s, "closing");
+#ifdef HAS_MMAP
+        if (g_parser_stack[g_parser_depth].map_size)
+            munmap(g_parser_stack[g_parser_depth].string_start, g_parser_stack[g_parser_depth].map_size);
+        else
+#endif
         free(g_parser_stack[g_parser_depth].string_start);
         g_parser_stack[g_parser_depth].string_start = NULL;
+        g_parser_stack[g_parser_depth].map_size = 0;
     }
 
     g_parser_depth--;
@@ -322,7 +452,7 @@ void PopSource(void)
         g_parser_line = g_parser_stack[g_parser_depth].file_line;
     }
 
-    if (g_parser_file)
+    if (g_parser_depth >= 0 && g_parser_stack[g_parser_depth].is_file)
         diagnostics(4, "Resuming Source File '%s'", g_parser_stack[g_parser_depth].file_name);
     else {
         diagnostics(5, "Resuming Source string");
@@ -477,6 +607,13 @@ char getRawTexChar(void)
             g_parser_currentChar = thechar;
             g_parser_string++;
         } 
+        else if (g_parser_stack[g_parser_depth].is_file) {
+            if (g_parser_include_level > 1) {
+                PopSource();    /* go back to parsing parent */
+                g_parser_currentChar = getRawTexChar();  /* get next char from parent file */
+            } else
+                g_parser_currentChar = '\0';
+        }
         else if (g_parser_depth > 15) 
         {
              PopSource();    /* go back to parsing parent */
@@ -505,6 +642,39 @@ char getRawTexChar(void)
 #undef CR
 #undef LF
 
+int getPlainTexRun(char *buffer, int size)
+
+/****************************************************************************
+purpose: copies the ASCII letters and digits that follow in the current
+         string source to buffer and moves past them, exactly as if each
+         had been read with getTexChar().  At most size characters are
+         copied and buffer is not terminated.
+returns: the number of characters copied, always 0 for file sources
+ ****************************************************************************/
+{
+    int n = 0;
+    char c;
+
+    if (g_parser_file || g_parser_string == NULL)
+        return 0;
+
+    while (n < size) {
+        c = g_parser_string[n];
+        if (!((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9')))
+            break;
+        buffer[n++] = c;
+    }
+
+    if (n > 0) {
+        g_parser_string += n;
+        g_parser_penultimateChar = (n > 1) ? buffer[n - 2] : g_parser_lastChar;
+        g_parser_lastChar = buffer[n - 1];
+        g_parser_currentChar = buffer[n - 1];
+        g_parser_backslashes = 0;
+    }
+    return n;
+}
+
 void ungetTexChar(char c)
 
 /****************************************************************************
@@ -976,6 +1146,77 @@ char *getLeftRightParam(void)
 
 
 
+static char *getStringUntil(char *target, int raw)
+
+/**************************************************************************
+     purpose: fast path for getTexUntil() when the current source is a
+              string (or a mapped file).  The target is located with a
+              substring search and the text before it is copied out with
+              the same CR/LF/tab filtering that getRawTexChar() applies.
+              This is only valid if the filtering cannot create or hide
+              a match, i.e., the target has no whitespace in it.
+     returns: NULL if the target is not in the current string
+ **************************************************************************/
+{
+    char *start = g_parser_string;
+    char *end, *s, *t;
+    size_t len = strlen(target);
+    int n;
+
+    if (g_parser_file || start == NULL || len == 0)
+        return NULL;
+
+    if (strpbrk(target, " \t\r\n") != NULL)
+        return NULL;
+
+    end = strstr(start, target);
+    if (end == NULL)
+        return NULL;
+
+    /* getTexChar() may react to a UTF byte order mark, so let it */
+    if (!raw) {
+        for (t = start; t < end; t++)
+            if ((unsigned char) *t == 0xEF || (unsigned char) *t == 0xFE)
+                return NULL;
+    }
+
+    s = (char *) malloc(end - start + 1);
+    if (s == NULL)
+        diagnostics(ERROR, "Could not allocate %ld bytes in getTexUntil", (long) (end - start + 1));
+
+    for (t = s; start < end; start++) {
+        if (*start == '\r') {
+            if (start + 1 < end && start[1] == '\n')
+                start++;
+            *t++ = '\n';
+        } else if (*start == '\t')
+            *t++ = ' ';
+        else
+            *t++ = *start;
+    }
+    *t = '\0';
+
+    g_parser_string = end + len;
+
+    /* leave the parser state as if the target had been read one char at a time */
+    g_parser_currentChar = target[len - 1];
+    g_parser_lastChar = g_parser_currentChar;
+    if (len > 1)
+        g_parser_penultimateChar = target[len - 2];
+    else
+        g_parser_penultimateChar = (t > s) ? t[-1] : g_parser_penultimateChar;
+
+    if (!raw) {
+        for (n = 0; n < (int) len && target[len - 1 - n] == '\\'; n++);
+        if (n == (int) len)
+            for (; t > s && t[-1] == '\\'; t--)
+                n++;
+        g_parser_backslashes = n;
+    }
+
+    return s;
+}
+
 char *getTexUntil(char *target, int raw)
 
 /**************************************************************************
@@ -983,9 +1224,9 @@ char *getTexUntil(char *target, int raw)
      returns: NULL if not found
  **************************************************************************/
 {
-    enum { BUFFSIZE = 200000 };
     char *s;
-    char buffer[BUFFSIZE];
+    char *buffer;
+    int size = 1024;            /* grows as needed */
     int last_i = -1;
     int i = 0;                  /* size of string that has been read */
     int j = 0;               /* number of found characters */
@@ -996,9 +1237,26 @@ char *getTexUntil(char *target, int raw)
 
     diagnostics(5, "getTexUntil target = <%s> raw_search = %d ", target, raw);
 
-    while (j < len && i < BUFFSIZE) {
+    s = getStringUntil(target, raw);
+    if (s) {
+        PopTrackLineNumber();
+        diagnostics(6, "getTexUntil result = %s", s);
+        return s;
+    }
+
+    buffer = (char *) malloc(size);
+    if (buffer == NULL)
+        diagnostics(ERROR, "Could not allocate buffer in getTexUntil");
+
+    while (j < len) {
 
         if (i > last_i) {
+            if (i + 1 >= size) {
+                size *= 2;
+                buffer = (char *) realloc(buffer, size);
+                if (buffer == NULL)
+                    diagnostics(ERROR, "Could not grow buffer to %d bytes in getTexUntil", size);
+            }
             buffer[i] = (raw) ? getRawTexChar() : getTexChar();
             last_i = i;
             if (buffer[i] != '\n')
@@ -1026,10 +1284,6 @@ char *getTexUntil(char *target, int raw)
         i++;
     }
 
-    if (i == BUFFSIZE)
-        diagnostics(ERROR, "Could not find <%s> in %d characters \n\
-        Recompile with larger BUFFSIZE in getTexUntil() in parser.c", target, BUFFSIZE);
-
     if (!end_of_file_reached)   /* do not include target in returned string */
         buffer[i - len] = '\0';
     else {
@@ -1041,7 +1295,9 @@ char *getTexUntil(char *target, int raw)
 
     diagnostics(6, "buffer size =[%d], actual=[%d]", strlen(buffer), i - len);
 
-    s = strdup(buffer);
+    s = (char *) realloc(buffer, i - len + 1);
+    if (s == NULL)
+        s = buffer;
     diagnostics(6, "getTexUntil result = %s", s);
     return s;
 }
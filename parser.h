@@ -11,6 +11,7 @@
 
 char    *CurrentFileName(void);
 int     PushSource(const char * filename, const char * string);
+int     PushOwnedSource(char *string);
 int     StillSource(void);
 void    PopSource(void);
 
@@ -19,6 +20,7 @@ char    getTexChar(void);
 char    getNonSpace(void);
 char    getNonBlank(void);
 int     getSameChar(char c);
+int     getPlainTexRun(char *buffer, int size);
 
 void    ungetTexChar(char c);
 
@@ -41,8 +43,10 @@ void    parseBrace(void);
 char    *getDelimitedText(char left, char right, int raw);
 
 int     CurrentLineNumber(void);
+void    SetLineNumber(int line);
 void    PushTrackLineNumber(int flag);
 void    PopTrackLineNumber(void);
+void    ResetParser(void);
 void    UpdateLineNumber(char *s);
 void    EndSource(void);
 int     CurrentFileDescriptor(void);
@@ -0,0 +1,351 @@
+/* pool.c - convert the documents of a batch in a pool of worker processes
+
+Copyright (C) 2014 The Free Software Foundation
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+This file is available from http://sourceforge.net/projects/latex2rtf/
+
+    The parent reads the cfg files and then forks g_document_jobs
+    workers, so the tables are shared with the workers until one of
+    them writes to a page.  The documents are handed out one at a time
+    through a pipe to each worker, and a worker gets the next document
+    as soon as it reports on the last one.  Every document is converted
+    as in a batch run, starting from a clean state.
+
+    A worker sends its diagnostics for a document back with the report,
+    so the parent can print them together with the name of the document,
+    the exit status and the time taken.  A worker that dies is replaced
+    and its document counts as failed.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+#include "pool.h"
+
+int g_document_jobs = 0;
+
+#ifdef UNIX
+
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <unistd.h>
+#include "graphics.h"
+
+#define MAX_DOCUMENT_JOBS 256
+
+typedef struct {
+    pid_t pid;                  /* 0 if the slot is empty */
+    int job_fd;                 /* parent writes document numbers here */
+    int report_fd;              /* worker writes reports here */
+    int doc;                    /* document being converted, -1 if none */
+    double started;             /* when the document was handed out */
+} poolWorker;
+
+typedef struct {
+    int doc;
+    int status;                 /* returned by the converter */
+    double seconds;
+    unsigned long err_size;     /* bytes of diagnostics that follow */
+} documentReport;
+
+static poolWorker workers[MAX_DOCUMENT_JOBS];
+static int nworkers;
+
+static double WallTime(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static int ReadAll(int fd, void *buffer, size_t n)
+
+/******************************************************************************
+  purpose: read exactly n bytes from fd
+  returns: TRUE on success, FALSE at the end of the pipe
+ ******************************************************************************/
+{
+    char *s = (char *) buffer;
+    ssize_t got;
+
+    while (n > 0) {
+        got = read(fd, s, n);
+        if (got <= 0)
+            return FALSE;
+        s += got;
+        n -= (size_t) got;
+    }
+    return TRUE;
+}
+
+static int WriteAll(int fd, const void *buffer, size_t n)
+{
+    const char *s = (const char *) buffer;
+    ssize_t put;
+
+    while (n > 0) {
+        put = write(fd, s, n);
+        if (put <= 0)
+            return FALSE;
+        s += put;
+        n -= (size_t) put;
+    }
+    return TRUE;
+}
+
+static void SendReport(int fd, documentReport *report, FILE *err)
+
+/******************************************************************************
+  purpose: write the report for a document followed by its diagnostics
+ ******************************************************************************/
+{
+    char buffer[8192];
+    size_t n;
+
+    fseek(err, 0, SEEK_END);
+    report->err_size = (unsigned long) ftell(err);
+    rewind(err);
+
+    if (!WriteAll(fd, report, sizeof(documentReport)))
+        _exit(EXIT_FAILURE);
+    while ((n = fread(buffer, 1, sizeof(buffer), err)) > 0) {
+        if (!WriteAll(fd, buffer, n))
+            _exit(EXIT_FAILURE);
+    }
+}
+
+static void RunWorker(int number, char **names, documentConverter convert, int job_fd, int report_fd)
+
+/******************************************************************************
+  purpose: convert the documents whose numbers arrive on job_fd until the
+           parent closes the pipe
+ ******************************************************************************/
+{
+    documentReport report;
+    double start;
+    FILE *err;
+    int doc;
+
+    setEquationFileWorker(number);
+
+    while (ReadAll(job_fd, &doc, sizeof(doc))) {
+        err = tmpfile();
+        if (err == NULL)
+            _exit(EXIT_FAILURE);
+        fflush(stderr);
+        dup2(fileno(err), fileno(stderr));
+
+        start = WallTime();
+        report.doc = doc;
+        report.status = convert(names[doc]);
+        report.seconds = WallTime() - start;
+        fflush(NULL);
+
+        SendReport(report_fd, &report, err);
+        fclose(err);
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+static void StartWorker(int w, char **names, documentConverter convert)
+
+/******************************************************************************
+  purpose: fork worker w from the parent as it is now (cfg files read, no
+           document converted yet)
+ ******************************************************************************/
+{
+    int job[2], report[2], i;
+    poolWorker *worker = &workers[w];
+
+    if (pipe(job) != 0 || pipe(report) != 0)
+        diagnostics(ERROR, "Cannot create a pipe for worker %d", w + 1);
+
+    fflush(NULL);               /* or the worker writes these buffers too */
+    worker->pid = fork();
+    if (worker->pid < 0)
+        diagnostics(ERROR, "Cannot start worker %d", w + 1);
+
+    if (worker->pid == 0) {
+        g_recover_from_errors = FALSE;
+        close(job[1]);
+        close(report[0]);
+        for (i = 0; i < nworkers; i++) {
+            if (i != w && workers[i].job_fd > 0) {
+                close(workers[i].job_fd);
+                close(workers[i].report_fd);
+            }
+        }
+        RunWorker(w + 1, names, convert, job[0], report[1]);
+    }
+
+    close(job[0]);
+    close(report[1]);
+    worker->job_fd = job[1];
+    worker->report_fd = report[0];
+    worker->doc = -1;
+}
+
+static void GiveDocument(int w, int doc)
+{
+    workers[w].doc = doc;
+    workers[w].started = WallTime();
+    if (!WriteAll(workers[w].job_fd, &doc, sizeof(doc)))
+        diagnostics(ERROR, "Cannot hand a document to worker %d", w + 1);
+}
+
+static void StopWorker(int w)
+{
+    close(workers[w].job_fd);
+    close(workers[w].report_fd);
+    workers[w].job_fd = workers[w].report_fd = 0;
+    workers[w].doc = -1;
+}
+
+static void PrintReport(char *name, const char *result, double seconds, int fd, unsigned long err_size)
+
+/******************************************************************************
+  purpose: print one line about a document followed by its diagnostics
+ ******************************************************************************/
+{
+    char buffer[8192];
+    unsigned long n, skip;
+    int last = '\n', start = TRUE;
+
+    fprintf(stderr, "==> %s: %s in %.3f s\n", name, result, seconds);
+
+    while (err_size > 0) {
+        n = (err_size < sizeof(buffer)) ? err_size : sizeof(buffer);
+        if (!ReadAll(fd, buffer, n))
+            break;
+        skip = (start && buffer[0] == '\n') ? 1 : 0;   /* see diagnostics() */
+        fwrite(buffer + skip, 1, n - skip, stderr);
+        start = FALSE;
+        last = buffer[n - 1];
+        err_size -= n;
+    }
+    if (last != '\n')
+        fputc('\n', stderr);
+    fflush(stderr);
+}
+
+static int FinishDocument(int w, char **names)
+
+/******************************************************************************
+  purpose: read the report of worker w, or find out why the worker died
+  returns: 1 if the document failed and 0 otherwise
+ ******************************************************************************/
+{
+    documentReport report;
+    poolWorker *worker = &workers[w];
+    char result[64];
+    int status, doc = worker->doc;
+
+    if (ReadAll(worker->report_fd, &report, sizeof(report))) {
+        PrintReport(names[report.doc], (report.status == 0) ? "converted" : "failed",
+                    report.seconds, worker->report_fd, report.err_size);
+        worker->doc = -1;
+        return (report.status == 0) ? 0 : 1;
+    }
+
+    StopWorker(w);
+    waitpid(worker->pid, &status, 0);
+    worker->pid = 0;
+
+    if (WIFSIGNALED(status))
+        snprintf(result, sizeof(result), "worker killed by signal %d", WTERMSIG(status));
+    else
+        snprintf(result, sizeof(result), "worker exited with status %d", WEXITSTATUS(status));
+    PrintReport(names[doc], result, WallTime() - worker->started, -1, 0);
+    return 1;
+}
+
+int ConvertDocumentsInPool(char **names, int n, documentConverter convert)
+
+/******************************************************************************
+  purpose: convert names[0..n-1] with convert() in g_document_jobs workers
+  returns: the number of documents that could not be converted
+ ******************************************************************************/
+{
+    struct pollfd fds[MAX_DOCUMENT_JOBS];
+    int slot[MAX_DOCUMENT_JOBS];
+    int next = 0, done = 0, failed = 0, busy, w, i;
+
+    nworkers = (g_document_jobs < n) ? g_document_jobs : n;
+    if (nworkers > MAX_DOCUMENT_JOBS)
+        nworkers = MAX_DOCUMENT_JOBS;
+    memset(workers, 0, sizeof(workers));
+
+    for (w = 0; w < nworkers; w++) {
+        StartWorker(w, names, convert);
+        GiveDocument(w, next++);
+    }
+
+    while (done < n) {
+        busy = 0;
+        for (w = 0; w < nworkers; w++) {
+            if (workers[w].doc < 0)
+                continue;
+            fds[busy].fd = workers[w].report_fd;
+            fds[busy].events = POLLIN;
+            fds[busy].revents = 0;
+            slot[busy++] = w;
+        }
+
+        if (poll(fds, busy, -1) < 0)
+            continue;
+
+        for (i = 0; i < busy; i++) {
+            if (fds[i].revents == 0)
+                continue;
+            w = slot[i];
+            failed += FinishDocument(w, names);
+            done++;
+
+            if (next < n) {
+                if (workers[w].pid == 0)
+                    StartWorker(w, names, convert);
+                GiveDocument(w, next++);
+            } else if (workers[w].pid > 0) {
+                StopWorker(w);
+            }
+        }
+    }
+
+    for (w = 0; w < nworkers; w++) {
+        if (workers[w].pid > 0)
+            waitpid(workers[w].pid, NULL, 0);
+    }
+    return failed;
+}
+
+#else
+
+int ConvertDocumentsInPool(char **names, int n, documentConverter convert)
+{
+    int i, failed = 0;
+
+    diagnostics(WARNING, "Documents can only be converted by several workers on Unix");
+    for (i = 0; i < n; i++)
+        failed += convert(names[i]);
+    return failed;
+}
+
+#endif
@@ -0,0 +1,5 @@
+extern int g_document_jobs;
+
+typedef int (*documentConverter) (char *name);
+
+int ConvertDocumentsInPool(char **names, int n, documentConverter convert);
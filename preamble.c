@@ -49,32 +49,32 @@ Authors:
 
 extern char *Version;  /*storage and definition in version.h */
 
-static int g_preambleTwoside = FALSE;
-static int g_preambleTwocolumn = FALSE;
-static int g_preambleTitlepage = FALSE;
-static int g_preambleLandscape = FALSE;
-static int g_preambleGeometry = FALSE;
-
-static int g_geomMargl = 0;
-static int g_geomMargr = 0;
-static int g_geomMargt = 0;
-static int g_geomMargb = 0;
-
-static int gColorPackage = 0;
-
-static char *g_preambleTitle = NULL;
-static char *g_preambleAuthor = NULL;
-static char *g_preambleDate = NULL;
-static char *g_preambleAffiliation = NULL;
-static char *g_preambleAbstract = NULL;
-static char *g_preambleAck = NULL;
-
-static char *g_preambleCFOOT = NULL;
-static char *g_preambleLFOOT = NULL;
-static char *g_preambleRFOOT = NULL;
-static char *g_preambleCHEAD = NULL;
-static char *g_preambleLHEAD = NULL;
-static char *g_preambleRHEAD = NULL;
+static THREAD_LOCAL int g_preambleTwoside = FALSE;
+static THREAD_LOCAL int g_preambleTwocolumn = FALSE;
+static THREAD_LOCAL int g_preambleTitlepage = FALSE;
+static THREAD_LOCAL int g_preambleLandscape = FALSE;
+static THREAD_LOCAL int g_preambleGeometry = FALSE;
+
+static THREAD_LOCAL int g_geomMargl = 0;
+static THREAD_LOCAL int g_geomMargr = 0;
+static THREAD_LOCAL int g_geomMargt = 0;
+static THREAD_LOCAL int g_geomMargb = 0;
+
+static THREAD_LOCAL int gColorPackage = 0;
+
+static THREAD_LOCAL char *g_preambleTitle = NULL;
+static THREAD_LOCAL char *g_preambleAuthor = NULL;
+static THREAD_LOCAL char *g_preambleDate = NULL;
+static THREAD_LOCAL char *g_preambleAffiliation = NULL;
+static THREAD_LOCAL char *g_preambleAbstract = NULL;
+static THREAD_LOCAL char *g_preambleAck = NULL;
+
+static THREAD_LOCAL char *g_preambleCFOOT = NULL;
+static THREAD_LOCAL char *g_preambleLFOOT = NULL;
+static THREAD_LOCAL char *g_preambleRFOOT = NULL;
+static THREAD_LOCAL char *g_preambleCHEAD = NULL;
+static THREAD_LOCAL char *g_preambleLHEAD = NULL;
+static THREAD_LOCAL char *g_preambleRHEAD = NULL;
 
 static void setPaperSize(char *size);
 static void setDocumentOptions(char *optionlist);
@@ -84,6 +84,45 @@ static void WritePageSize(void);
 void ParseOptGeometry(char *options);
 void ExecGeomOptions (char *option, char *value1, char *value2);
 
+void ResetPreamble(void)
+
+/******************************************************************************
+  purpose: forget the document options, title and headers of the previous
+           document
+ ******************************************************************************/
+{
+    g_preambleTwoside = FALSE;
+    g_preambleTwocolumn = FALSE;
+    g_preambleTitlepage = FALSE;
+    g_preambleLandscape = FALSE;
+    g_preambleGeometry = FALSE;
+
+    g_geomMargl = 0;
+    g_geomMargr = 0;
+    g_geomMargt = 0;
+    g_geomMargb = 0;
+
+    gColorPackage = 0;
+
+    safe_free(g_preambleTitle);
+    safe_free(g_preambleAuthor);
+    safe_free(g_preambleDate);
+    safe_free(g_preambleAffiliation);
+    safe_free(g_preambleAbstract);
+    safe_free(g_preambleAck);
+    g_preambleTitle = g_preambleAuthor = g_preambleDate = NULL;
+    g_preambleAffiliation = g_preambleAbstract = g_preambleAck = NULL;
+
+    safe_free(g_preambleCFOOT);
+    safe_free(g_preambleLFOOT);
+    safe_free(g_preambleRFOOT);
+    safe_free(g_preambleCHEAD);
+    safe_free(g_preambleLHEAD);
+    safe_free(g_preambleRHEAD);
+    g_preambleCFOOT = g_preambleLFOOT = g_preambleRFOOT = NULL;
+    g_preambleCHEAD = g_preambleLHEAD = g_preambleRHEAD = NULL;
+}
+
 void setPackageBabel(char *option)
 {
    char *replica,*language,*comma;
@@ -103,6 +142,7 @@ void setPackageBabel(char *option)
 			GermanMode = TRUE;
 			PushEnvironment(GERMAN_MODE);
 			ReadLanguage("german");
+			safe_free(replica);
 			return;
 		}
 	
@@ -416,7 +456,7 @@ static void setDocumentOptions(char *optionlist)
 
     if (optionlist == NULL) return;
     
-    option = strtok(optionlist, ",");
+    option = my_strtok(optionlist, ",");
 
     while (option) {
 
@@ -546,7 +586,7 @@ static void setDocumentOptions(char *optionlist)
         } else {
             diagnostics(WARNING, "Package/option '%s' unknown.", option);
         }
-        option = strtok(NULL, ",");
+        option = my_strtok(NULL, ",");
     }
 }
 
@@ -744,15 +784,15 @@ void ParseOptGeometry(char *options)
             free(value1);
             value1 = getBraceParam();
             PopSource();
-            value1 = strtok(value1, comma);
-            value2 = strtok(NULL, comma);
+            value1 = my_strtok(value1, comma);
+            value2 = my_strtok(NULL, comma);
             diagnostics(2, "option=%s with values %s and %s", key, value1, value2);
             ExecGeomOptions (key, value1, value2);
             free(value1);
         }
         else if (strchr(value1, ':')) {
-            value1 = strtok(value1, colon);
-            value2 = strtok(NULL, colon);
+            value1 = my_strtok(value1, colon);
+            value2 = my_strtok(NULL, colon);
             diagnostics(2, "option=%s with ratio '%s:%s'", key, value1, value2);
             ExecGeomOptions (key, value1, value2);
             free(value1);
@@ -784,10 +824,10 @@ void ExecGeomOptions (char *key, char *value1, char *value2)
     
     if (strstr(key, "ratio")) {
         if (strchr(value1, ':')) { /* each value is a ratio */
-            value1 = strtok(value1, ": ");
-            value1b = strtok(NULL, ": ");
-            value2 = strtok(value2, ": ");
-            value2b = strtok(NULL, ": ");
+            value1 = my_strtok(value1, ": ");
+            value1b = my_strtok(NULL, ": ");
+            value2 = my_strtok(value2, ": ");
+            value2b = my_strtok(NULL, ": ");
         } else { /* each value is part of a single ratio */
             dist1 = atoi(value1);
             dist2 = atoi(value2);
@@ -1070,7 +1110,7 @@ Needs to be terminated for:
 - myheadings page nunmbering, combined with markboth, markright.
  ******************************************************************************/
 {
-    static char *style = "";
+    static THREAD_LOCAL char *style = "";
 
     style = getBraceParam();
     if (strcmp(style, "empty") == 0) {
@@ -1567,10 +1607,17 @@ static void WriteInfo(void)
 {
 /*  struct stat sb;*/
     time_t tm;
+#ifdef UNIX
+    char now[32];
+#endif
 
     fprintRTF("{\\info\n{\\title Original file was %s}\n",CurrentFileName());
     tm = time(NULL);
+#ifdef UNIX
+    fprintRTF("{\\doccomm Created using latex2rtf %s on %s}\n", Version, ctime_r(&tm, now));
+#else
     fprintRTF("{\\doccomm Created using latex2rtf %s on %s}\n", Version, ctime(&tm));
+#endif
 /*  if (fstat(CurrentFileDescriptor(),&sb)) {} */
 /*  fprintRTF("{\\creatim %s}\n", ctime(&tm)); */
     fprintRTF("}\n");
@@ -45,4 +45,5 @@ void CmdHeadFoot(int code);
 void CmdThePage(int code);
 void setPackageInputenc(char * option);
 void setPackageBabel(char * option);
+void ResetPreamble(void);
 void CmdGeometry(int code);
@@ -34,9 +34,155 @@ Authors:
 #include "funct1.h"
 
 #define SECTION_BUFFER_SIZE 2048
-static char *section_buffer = NULL;
-static long section_buffer_size = SECTION_BUFFER_SIZE;
-static long section_buffer_end = 0;
+static THREAD_LOCAL char *section_buffer = NULL;
+static THREAD_LOCAL long section_buffer_size = SECTION_BUFFER_SIZE;
+static THREAD_LOCAL long section_buffer_end = 0;
+
+/* Every command that preParse() has to notice is kept in a single
+   character trie.  The trie is walked one character at a time as the
+   section buffer is filled, so the cost per character does not depend
+   on the number of commands, \newcommands or \newenvironments.     */
+
+#define MATCH_COMMAND       1   /* one of the commands in preParse() */
+#define MATCH_DEFINITION    2   /* \name of a user definition */
+#define MATCH_ENVIRONMENT   4   /* \begin{name or \end{name of a user environment */
+
+typedef struct matchNodeTag {
+    char c;
+    unsigned char below;        /* kinds of pattern passing through this node */
+    unsigned char kind;         /* kinds of pattern ending at this node */
+    int item;                   /* index of preParse() command ending here */
+    struct matchNodeTag *child;
+    struct matchNodeTag *sibling;
+} matchNode;
+
+static THREAD_LOCAL matchNode match_root;
+static THREAD_LOCAL matchNode *bs_node = NULL;  /* the '\\' below match_root */
+
+static matchNode *nextMatchNode(matchNode *node, char c)
+
+/**************************************************************************
+    purpose: follow the edge labelled c, returns NULL if there is none
+**************************************************************************/
+{
+    if (node == NULL)
+        return NULL;
+
+    for (node = node->child; node; node = node->sibling) {
+        if (node->c == c)
+            return node;
+    }
+    return NULL;
+}
+
+static matchNode *addMatchPattern(const char *s, int kind, int item)
+
+/**************************************************************************
+    purpose: insert pattern s into the trie (nodes are kept until freePreParse())
+**************************************************************************/
+{
+    matchNode *node = &match_root, *next;
+
+    node->below |= kind;
+    for (; *s; s++) {
+        next = nextMatchNode(node, *s);
+        if (next == NULL) {
+            next = (matchNode *) calloc(1, sizeof(matchNode));
+            if (next == NULL)
+                diagnostics(ERROR, "Could not allocate memory for preparser. Sorry.");
+            next->c = *s;
+            next->sibling = node->child;
+            node->child = next;
+        }
+        node = next;
+        node->below |= kind;
+    }
+    node->kind |= kind;
+    if (item)
+        node->item = item;
+    return node;
+}
+
+void addPreParseDefinition(char *name)
+
+/**************************************************************************
+    purpose: let preParse() recognize the user definition \name
+**************************************************************************/
+{
+    char *s = strdup_together("\\", name);
+
+    addMatchPattern(s, MATCH_DEFINITION, 0);
+    free(s);
+}
+
+void addPreParseEnvironment(char *name)
+
+/**************************************************************************
+    purpose: let preParse() recognize \begin{name} and \end{name}
+**************************************************************************/
+{
+    char *s = strdup_together("\\begin{", name);
+
+    addMatchPattern(s, MATCH_ENVIRONMENT, 0);
+    free(s);
+    s = strdup_together("\\end{", name);
+    addMatchPattern(s, MATCH_ENVIRONMENT, 0);
+    free(s);
+}
+
+static unsigned char forgetUserPatterns(matchNode *node)
+
+/**************************************************************************
+    purpose: clear the user patterns below node, returns the kinds of
+             pattern that are still passing through it
+**************************************************************************/
+{
+    matchNode *child;
+
+    node->kind &= MATCH_COMMAND;
+    node->below = node->kind;
+    for (child = node->child; child; child = child->sibling)
+        node->below |= forgetUserPatterns(child);
+    return node->below;
+}
+
+void resetPreParse(void)
+
+/**************************************************************************
+    purpose: forget the user definitions and environments added by
+             addPreParseDefinition() and addPreParseEnvironment()
+**************************************************************************/
+{
+    forgetUserPatterns(&match_root);
+}
+
+static void freeMatchNodes(matchNode *node)
+{
+    matchNode *next;
+
+    for (; node; node = next) {
+        next = node->sibling;
+        freeMatchNodes(node->child);
+        free(node);
+    }
+}
+
+void freePreParse(void)
+
+/**************************************************************************
+    purpose: release the trie and the section buffer, the next call to
+             preParse() builds them again
+**************************************************************************/
+{
+    freeMatchNodes(match_root.child);
+    memset(&match_root, 0, sizeof(match_root));
+    bs_node = NULL;
+
+    free(section_buffer);
+    section_buffer = NULL;
+    section_buffer_size = SECTION_BUFFER_SIZE;
+    section_buffer_end = 0;
+}
 
 static void increase_buffer_size(void)
 {
@@ -161,10 +307,10 @@ void preParse(char **body, char **header, char **label)
     
 **************************************************************************/
 {
-    int any_possible_match, found;
+    int any_possible_match, found, def_possible, env_possible;
     char cNext, cThis, *s, *text, *next_header, *str, *p;
     int i;
-    int possible_match[43];
+    matchNode *cmd_node, *user_node, *last;
     char *command[43] = { "",   /* 0 entry is for user definitions */
         "",                     /* 1 entry is for user environments */
         "\\begin{verbatim}", 
@@ -228,7 +374,15 @@ void preParse(char **body, char **header, char **label)
     size_t cmd_pos = 0;        /* position of start of command relative to end of buffer */
     int label_depth = 0;
     int i_match = 0;
-    
+
+    if (bs_node == NULL) {
+        for (i = 2; i < ncommands; i++)
+            addMatchPattern(command[i], MATCH_COMMAND, i);
+        bs_node = nextMatchNode(&match_root, '\\');
+    }
+    cmd_node = user_node = NULL;
+    def_possible = env_possible = FALSE;
+
     text = NULL;
     next_header = NULL;         /* typically becomes \subsection{Cows eat grass} */
     *body = NULL;
@@ -246,7 +400,9 @@ void preParse(char **body, char **header, char **label)
             cThis = getRawTexChar();
         }
 
-        if (cThis == '\0')
+        if (g_verbosity_level < 6)
+            ;
+        else if (cThis == '\0')
             diagnostics(6, "[%ld] xchar=000 '\\0' (backslash count=%d)", section_buffer_end, bs_count);
         else if (cThis == '\n')
             diagnostics(6, "[%ld] xchar=012 '\\n' (backslash count=%d)", section_buffer_end, bs_count);
@@ -277,8 +433,8 @@ void preParse(char **body, char **header, char **label)
         if (cThis == '\\') {
             bs_count++;
             if (odd(bs_count)) {    /* avoid "\\section" and "\\\\section" */
-                for (i = 0; i < ncommands; i++)
-                    possible_match[i] = TRUE;
+                cmd_node = user_node = bs_node;
+                def_possible = env_possible = TRUE;
                 cmd_pos = 1;
                 continue;
             }
@@ -315,16 +471,22 @@ void preParse(char **body, char **header, char **label)
         any_possible_match = FALSE;
         found = FALSE;
 
+        /* user names are matched against the buffer, which lags one 
+           character behind cThis; user_node holds all but the last one */
+        if (cmd_pos > 1)
+            user_node = nextMatchNode(user_node, section_buffer[section_buffer_end - 1]);
+
         /* is is possibly a user defined command? */
-        if (possible_match[0]) {
-            possible_match[0] = maybeDefinition(section_buffer + section_buffer_end - cmd_pos + 1, cmd_pos - 1);
+        if (def_possible) {
+            def_possible = (cmd_pos == 1 || (user_node && (user_node->below & MATCH_DEFINITION)));
             
-            if (possible_match[0]) {        /* test to make sure \userdef is complete */
+            if (def_possible) {             /* test to make sure \userdef is complete */
                 any_possible_match = TRUE;
                 cNext = getRawTexChar();    /* wrong when cNext == '%' */
                 ungetTexChar(cNext);
                 
-                if (!isalpha((int) cNext)) {   /* is macro name complete? */
+                last = nextMatchNode(user_node, section_buffer[section_buffer_end]);
+                if (!isalpha((int) cNext) && last && (last->kind & MATCH_DEFINITION)) {
     
                     *(section_buffer + section_buffer_end + 1) = '\0';
                     i = existsDefinition(section_buffer + section_buffer_end - cmd_pos + 1);
@@ -338,8 +500,7 @@ void preParse(char **body, char **header, char **label)
                         move_end_of_buffer(-cmd_pos-1);  /* remove \userdef */
                         
                         str = expandDefinition(i);
-                        PushSource(NULL, str);
-                        free(str);
+                        PushOwnedSource(str);
                         cmd_pos = 0;
                         bs_count = 0;
                         continue;
@@ -349,17 +510,20 @@ void preParse(char **body, char **header, char **label)
         }
 
         /* is it a user defined environment? */
-        if (possible_match[1]) {
+        if (env_possible) {
             char *pp = section_buffer + section_buffer_end - cmd_pos;
-            possible_match[1] = maybeEnvironment(pp, cmd_pos);
+            env_possible = (user_node && (user_node->below & MATCH_ENVIRONMENT));
             
-            if (possible_match[1] == TRUE) {
+            if (env_possible) {
     
                 any_possible_match = TRUE;
                 cNext = getRawTexChar();    /* wrong when cNext == '%' */
     
-                /* \begin{name} or \end{name} will end with '}' */
-                if (cNext == '}') {
+                /* \begin{name} or \end{name} will end with '}', the
+                   command so far must be a whole pattern and not just
+                   the start of one such as \b or \begin{na */
+                last = nextMatchNode(user_node, section_buffer[section_buffer_end]);
+                if (cNext == '}' && last && (last->kind & MATCH_ENVIRONMENT)) {
                     char *ss = NULL;
                     
                     *(pp + cmd_pos + 1) = '\0';
@@ -375,10 +539,9 @@ void preParse(char **body, char **header, char **label)
                         diagnostics(5, "matched <%s}>", pp);
                         diagnostics(5, "expanded to <%s>", ss);
     
-                        PushSource(NULL, ss);
+                        PushOwnedSource(ss);
                         move_end_of_buffer(-cmd_pos-1); /* remove \begin{userenvironment} */
                         
-                        free(ss);
                         cmd_pos = 0;
                         continue;
                     }
@@ -389,49 +552,33 @@ void preParse(char **body, char **header, char **label)
         }
 
         /* is it one of the commands listed above? */
-        for (i = 2; i < ncommands; i++) {
-            if (possible_match[i]) {
-                if (cThis == command[i][cmd_pos])
-                    any_possible_match = TRUE;
-                else
-                    possible_match[i] = FALSE;
-
-                diagnostics(6,"cmd_pos = %d, char = %c, possible match %s, size=%d, possible=%d", \
-                    cmd_pos,cThis,command[i],strlen(command[i]),possible_match[i]);
-            }
-        }
-
-
+        cmd_node = nextMatchNode(cmd_node, cThis);
+        if (cmd_node && !(cmd_node->below & MATCH_COMMAND))
+            cmd_node = NULL;
 
         i_match = -1;
-        for (i = 2; i < ncommands; i++) {   /* discover any exact matches */
-            if (possible_match[i]) {
-                diagnostics(6, "testing for <%s>", command[i]);
-                
-                /* right length? */
-                
-                if (cmd_pos+1 == strlen(command[i])) {
-
-                    if (i<=e_comment_item || i==e_comment_item) { 
-                        /* these entries are complete matches */ 
+        if (cmd_node) {
+            any_possible_match = TRUE;
+
+            if (cmd_node->kind & MATCH_COMMAND) {   /* an exact match */
+                if (cmd_node->item <= e_comment_item) { 
+                    /* these entries are complete matches */ 
+                    found = TRUE;
+                } else {
+                    /* these entries we need to be a bit more careful and check next character */
+                    cNext = getRawTexChar();
+                    ungetTexChar(cNext);
+                    
+                    /* this test for the end of commands may still need tweaking */
+                    if (!isalpha(cNext) && cNext != '*') {
                         found = TRUE;
-                    } else {
-                        /* these entries we need to be a bit more careful and check next character */
-                        cNext = getRawTexChar();
-                        ungetTexChar(cNext);
-                        
-                        /* this test for the end of commands may still need tweaking */
-                        if (!isalpha(cNext) && cNext != '*') {
-                            found = TRUE;
-                        }
                     }
                 }
             }
             
             if (found == TRUE) {
-                diagnostics(6,"preparse matched '%s'",command[i]);
-                i_match = i;
-                break;
+                i_match = cmd_node->item;
+                diagnostics(6,"preparse matched '%s'",command[i_match]);
             }
         }
 
@@ -500,14 +647,14 @@ void preParse(char **body, char **header, char **label)
 
         if (i_match == include_item) {
             CmdInclude(0);
-            move_end_of_buffer(-strlen(command[i]));    
+            move_end_of_buffer(-strlen(command[i_match]));    
             cmd_pos = 0;                 /* reset the command position */
             continue;
         }
 
         if (i_match == input_item) {
             CmdInclude(1);
-            move_end_of_buffer(-strlen(command[i]));    
+            move_end_of_buffer(-strlen(command[i_match]));    
             cmd_pos = 0;                 /* reset the command position */
             continue;
         }
@@ -538,7 +685,7 @@ void preParse(char **body, char **header, char **label)
             if (isalpha((int) cNext))   /* is macro name complete? */
                 continue;
 
-            move_end_of_buffer(-strlen(command[i]));    /* do not include in buffer */
+            move_end_of_buffer(-strlen(command[i_match]));    /* do not include in buffer */
 
             if (i_match == def_item)
                 CmdNewDef(DEF_DEF);
@@ -599,10 +746,10 @@ void preParse(char **body, char **header, char **label)
         /* actually found command to end the section */
         diagnostics(4, "preParse() found command to end section");
         s = getBraceParam();
-        next_header = strdup_together4(command[i], "{", s, "}");
+        next_header = strdup_together4(command[i_match], "{", s, "}");
         free(s);
 
-        move_end_of_buffer(-strlen(command[i]));
+        move_end_of_buffer(-strlen(command[i_match]));
         add_chr_to_buffer('\0');
         break;
     }
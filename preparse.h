@@ -1 +1,5 @@
 void preParse(char **body, char **header, char **label);
+void addPreParseDefinition(char *name);
+void addPreParseEnvironment(char *name);
+void resetPreParse(void);
+void freePreParse(void);
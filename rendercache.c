@@ -0,0 +1,377 @@
+/* rendercache.c - keep the bitmaps made by latex2png from one run to the next
+
+Copyright (C) 2014 The Free Software Foundation
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+This file is available from http://sourceforge.net/projects/latex2rtf/
+
+    With -c dir every equation, picture or tabular that is rendered as
+    a bitmap is kept in dir under a key made from everything that goes
+    into the bitmap: the l2r_NNNN.tex file given to latex2png, the
+    resolution and the -H directory.  The next time the same LaTeX is
+    rendered the bitmap comes from dir and latex, dvips and convert are
+    not run at all.
+
+    An entry is two files, key.png and key.txt with the baseline of the
+    bitmap.  Both are written under a temporary name and renamed, so
+    several workers or threads may share the directory.  A hit touches
+    key.png, and when the directory grows beyond -K megabytes the entries
+    used least recently are removed until it is down to three quarters.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+#include "utils.h"
+#include "rendercache.h"
+
+#ifdef UNIX
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+
+THREAD_LOCAL char *g_render_cache_dir = NULL;
+THREAD_LOCAL long  g_render_cache_megabytes = 64;
+
+static THREAD_LOCAL long    cache_hits = 0;
+static THREAD_LOCAL long    cache_misses = 0;
+static THREAD_LOCAL long    cache_stores = 0;
+static THREAD_LOCAL long    cache_evicted = 0;
+static THREAD_LOCAL int64_t cache_bytes = -1;       /* -1 until the directory is scanned */
+
+void RenderHashInit(renderHash *h)
+{
+    h->a = 14695981039346656037ULL;
+    h->b = 0x9E3779B97F4A7C15ULL;
+}
+
+/******************************************************************************
+ purpose:  add the bytes of s to two independent 64 bit hashes, FNV-1a and
+           a multiply-xorshift, so that a key is 128 bits
+******************************************************************************/
+void RenderHashAdd(renderHash *h, const char *s)
+{
+    uint64_t c;
+
+    if (s == NULL)
+        return;
+    while (*s) {
+        c = (unsigned char) *s++;
+        h->a = (h->a ^ c) * 1099511628211ULL;
+        h->b = (h->b ^ c) * 0xFF51AFD7ED558CCDULL;
+        h->b ^= h->b >> 29;
+    }
+}
+
+void RenderHashAddInt(renderHash *h, long n)
+{
+    char number[32];
+
+    snprintf(number, sizeof(number), "\n%ld\n", n);
+    RenderHashAdd(h, number);
+}
+
+void RenderHashKey(renderHash *h, char *key)
+{
+    snprintf(key, RENDER_KEY_SIZE, "%08lx%08lx%08lx%08lx",
+             (unsigned long) (h->a >> 32), (unsigned long) (h->a & 0xFFFFFFFFUL),
+             (unsigned long) (h->b >> 32), (unsigned long) (h->b & 0xFFFFFFFFUL));
+}
+
+static char *CachePath(const char *key, const char *ext)
+{
+    return strdup_together4(g_render_cache_dir, "/", key, ext);
+}
+
+char *RenderCachePath(const char *name)
+
+/******************************************************************************
+ purpose:  the name of a file of its own kept in the cache directory, such
+           as the format of a preamble
+ returns:  NULL without -c
+******************************************************************************/
+{
+    if (g_render_cache_dir == NULL)
+        return NULL;
+#ifdef UNIX
+    mkdir(g_render_cache_dir, 0777);
+#endif
+    return strdup_together3(g_render_cache_dir, "/", name);
+}
+
+char *RenderCacheFind(const char *key, double *baseline)
+
+/******************************************************************************
+ purpose:  look for the bitmap with this key in the cache
+ returns:  the name of the cached PNG file, or NULL on a miss
+******************************************************************************/
+{
+    char *png, *txt;
+    FILE *f;
+    int found = FALSE;
+
+    if (g_render_cache_dir == NULL)
+        return NULL;
+
+    txt = CachePath(key, ".txt");
+    png = CachePath(key, ".png");
+    f = fopen(txt, "r");
+    if (f != NULL) {
+        found = (fscanf(f, "%lf", baseline) == 1 && file_exists(png));
+        fclose(f);
+    }
+    free(txt);
+
+    if (!found) {
+        cache_misses++;
+        free(png);
+        return NULL;
+    }
+
+#ifdef UNIX
+    utime(png, NULL);           /* most recently used */
+#endif
+    cache_hits++;
+    diagnostics(3, "render cache hit <%s>", png);
+    return png;
+}
+
+static int64_t CopyToCache(const char *from, const char *key, const char *ext)
+
+/******************************************************************************
+ purpose:  copy the file from into the cache as key.ext without anyone
+           seeing a partly written file
+ returns:  the number of bytes copied, or -1
+******************************************************************************/
+{
+    char buffer[8192], suffix[64], *name, *tmp;
+    FILE *in, *out;
+    int64_t bytes = 0;
+    size_t n;
+
+    in = fopen(from, "rb");
+    if (in == NULL)
+        return -1;
+
+    /* the address of a thread local variable tells the threads apart */
+#ifdef UNIX
+    snprintf(suffix, sizeof(suffix), ".%ld.%lx", (long) getpid(), (unsigned long) (size_t) &cache_bytes);
+#else
+    snprintf(suffix, sizeof(suffix), ".%lx", (unsigned long) (size_t) &cache_bytes);
+#endif
+    name = CachePath(key, ext);
+    tmp = strdup_together(name, suffix);
+
+    out = fopen(tmp, "wb");
+    if (out == NULL) {
+        diagnostics(WARNING, "Cannot write <%s> in the render cache", tmp);
+        bytes = -1;
+    } else {
+        while ((n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+            if (fwrite(buffer, 1, n, out) != n)
+                bytes = -1;
+            else if (bytes >= 0)
+                bytes += (int64_t) n;
+        }
+        if (fclose(out) != 0)
+            bytes = -1;
+        if (bytes >= 0) {
+            remove(name);       /* rename() does not replace files on Windows */
+            if (rename(tmp, name) != 0)
+                bytes = -1;
+        }
+        if (bytes < 0)
+            remove(tmp);
+    }
+
+    fclose(in);
+    free(tmp);
+    free(name);
+    return bytes;
+}
+
+#ifdef UNIX
+
+typedef struct {
+    char key[RENDER_KEY_SIZE];
+    int64_t bytes;              /* of key.png and key.txt */
+    time_t used;
+} cacheEntry;
+
+static int CompareUse(const void *x, const void *y)
+{
+    const cacheEntry *a = (const cacheEntry *) x;
+    const cacheEntry *b = (const cacheEntry *) y;
+
+    if (a->used != b->used)
+        return (a->used < b->used) ? -1 : 1;
+    return strcmp(a->key, b->key);
+}
+
+static int64_t ScanRenderCache(cacheEntry **list, int *count)
+
+/******************************************************************************
+ purpose:  list the entries of the cache directory
+ returns:  the bytes used by all of them
+******************************************************************************/
+{
+    DIR *dir;
+    struct dirent *d;
+    struct stat st;
+    cacheEntry *entries = NULL, *e;
+    int n = 0, reserved = 0;
+    int64_t total = 0;
+    char *name;
+
+    dir = opendir(g_render_cache_dir);
+    if (dir == NULL)
+        return 0;
+
+    while ((d = readdir(dir)) != NULL) {
+        if (strlen(d->d_name) != RENDER_KEY_SIZE - 1 + 4 || strcmp(d->d_name + RENDER_KEY_SIZE - 1, ".png") != 0)
+            continue;
+
+        name = strdup_together3(g_render_cache_dir, "/", d->d_name);
+        if (stat(name, &st) == 0) {
+            if (n == reserved) {
+                reserved = (reserved) ? 2 * reserved : 64;
+                entries = (cacheEntry *) realloc(entries, reserved * sizeof(cacheEntry));
+                if (entries == NULL)
+                    diagnostics(ERROR, "Cannot allocate memory to list the render cache");
+            }
+            e = &entries[n++];
+            memcpy(e->key, d->d_name, RENDER_KEY_SIZE - 1);
+            e->key[RENDER_KEY_SIZE - 1] = '\0';
+            e->bytes = (int64_t) st.st_size;
+            e->used = st.st_mtime;
+            strcpy(name + strlen(name) - 4, ".txt");
+            if (stat(name, &st) == 0)
+                e->bytes += (int64_t) st.st_size;
+            total += e->bytes;
+        }
+        free(name);
+    }
+    closedir(dir);
+
+    if (list) {
+        *list = entries;
+        *count = n;
+    } else
+        free(entries);
+    return total;
+}
+
+static void EvictRenderCache(void)
+
+/******************************************************************************
+ purpose:  remove the entries used least recently until the cache is down
+           to three quarters of its limit
+******************************************************************************/
+{
+    cacheEntry *entries = NULL;
+    int64_t limit = (int64_t) g_render_cache_megabytes * 1024 * 1024;
+    char *name;
+    int i, n = 0;
+
+    cache_bytes = ScanRenderCache(&entries, &n);
+    qsort(entries, n, sizeof(cacheEntry), CompareUse);
+
+    for (i = 0; i < n && cache_bytes > limit / 4 * 3; i++) {
+        name = CachePath(entries[i].key, ".png");
+        remove(name);
+        free(name);
+        name = CachePath(entries[i].key, ".txt");
+        remove(name);
+        free(name);
+        cache_bytes -= entries[i].bytes;
+        cache_evicted++;
+    }
+    free(entries);
+    diagnostics(3, "render cache evicted %d entries", i);
+}
+
+#endif
+
+void RenderCacheStore(const char *key, const char *png, double baseline)
+
+/******************************************************************************
+ purpose:  keep the bitmap png and its baseline in the cache under key
+******************************************************************************/
+{
+    char *txt;
+    FILE *f;
+    int64_t png_bytes, txt_bytes;
+
+    if (g_render_cache_dir == NULL || png == NULL)
+        return;
+
+    if (cache_bytes < 0) {
+#ifdef UNIX
+        mkdir(g_render_cache_dir, 0777);
+        cache_bytes = ScanRenderCache(NULL, NULL);
+#else
+        cache_bytes = 0;
+#endif
+    }
+
+    /* the baseline goes in first so that a key.png always has its key.txt */
+    txt = strdup_together(png, ".baseline");
+    f = fopen(txt, "w");
+    if (f == NULL) {
+        free(txt);
+        return;
+    }
+    fprintf(f, "%.17g\n", baseline);
+    fclose(f);
+    txt_bytes = CopyToCache(txt, key, ".txt");
+    remove(txt);
+    free(txt);
+    if (txt_bytes < 0)
+        return;
+
+    png_bytes = CopyToCache(png, key, ".png");
+    if (png_bytes < 0)
+        return;
+
+    cache_stores++;
+    cache_bytes += png_bytes + txt_bytes;
+
+#ifdef UNIX
+    if (cache_bytes > (int64_t) g_render_cache_megabytes * 1024 * 1024)
+        EvictRenderCache();
+#endif
+}
+
+void ReportRenderCacheStats(void)
+{
+    if (!g_lookup_stats || g_render_cache_dir == NULL)
+        return;
+    diagnostics(WARNING, "%-10s %6ld hits %8ld misses %8ld stored %8ld evicted",
+                "renders", cache_hits, cache_misses, cache_stores, cache_evicted);
+}
+
+void ResetRenderCache(void)
+{
+    cache_hits = 0;
+    cache_misses = 0;
+    cache_stores = 0;
+    cache_evicted = 0;
+    cache_bytes = -1;
+}
@@ -0,0 +1,25 @@
+#ifndef _RENDERCACHE_H_INCLUDED
+#define _RENDERCACHE_H_INCLUDED 1
+
+#define RENDER_KEY_SIZE 33          /* 32 hex digits and the '\0' */
+
+extern THREAD_LOCAL char *g_render_cache_dir;
+extern THREAD_LOCAL long  g_render_cache_megabytes;
+
+typedef struct {
+    uint64_t a;
+    uint64_t b;
+} renderHash;
+
+void   RenderHashInit(renderHash *h);
+void   RenderHashAdd(renderHash *h, const char *s);
+void   RenderHashAddInt(renderHash *h, long n);
+void   RenderHashKey(renderHash *h, char *key);
+
+char  *RenderCachePath(const char *name);
+char  *RenderCacheFind(const char *key, double *baseline);
+void   RenderCacheStore(const char *key, const char *png, double baseline);
+void   ReportRenderCacheStats(void);
+void   ResetRenderCache(void);
+
+#endif
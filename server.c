@@ -0,0 +1,357 @@
+/* server.c - convert documents for clients of a Unix domain socket
+
+Copyright (C) 2014 The Free Software Foundation
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+This file is available from http://sourceforge.net/projects/latex2rtf/
+
+    With -L socket latex2rtf reads the cfg files once and then waits
+    for requests on the socket.  Every request is handled by a fork of
+    the waiting process, so a request starts from the same clean state
+    as a fresh run and nothing it changes is seen by the next request.
+    The options given to the server apply to every request and the
+    options in the request are added to them.
+
+    A request is a few lines followed by an empty line
+
+        cwd /home/me/paper        directory the names are relative to
+        arg -M12                  one command line argument, repeated
+        file paper.tex            convert this file
+        source 1234               or convert the 1234 bytes of LaTeX
+                                  that follow the empty line
+        reply data                send the RTF back (default for source)
+        reply file                or leave it in the usual file and
+                                  send its name (default for file)
+
+    and the answer is
+
+        status ok                 or failed
+        file paper.rtf            for reply file
+        rtf 5678                  for reply data
+        diagnostics 90
+        <empty line>
+        the RTF bytes (reply data) and then the diagnostics
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "main.h"
+#include "server.h"
+
+char *g_server_socket = NULL;
+
+#ifdef UNIX
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "utils.h"
+
+#define MAX_REQUEST_ARGS 64
+#define MAX_REQUEST_LINE 4096
+
+typedef struct {
+    int argc;
+    char *argv[MAX_REQUEST_ARGS + 4];  /* room for progname, -o rtf and name */
+    char *name;
+    long source;                /* bytes of LaTeX that follow, -1 if none */
+    int reply_data;             /* -1 until a reply line is seen */
+} serverRequest;
+
+static long FileSize(FILE *f)
+{
+    if (f == NULL)
+        return 0;
+    fflush(f);
+    fseek(f, 0, SEEK_END);
+    return ftell(f);
+}
+
+static void CopyFile(FILE *from, FILE *to)
+{
+    char buffer[8192];
+    size_t n;
+
+    if (from == NULL)
+        return;
+    rewind(from);
+    while ((n = fread(buffer, 1, sizeof(buffer), from)) > 0)
+        fwrite(buffer, 1, n, to);
+}
+
+static char *AbsolutePaths(char *paths)
+
+/******************************************************************************
+  purpose: prefix the current directory to the relative directories in a
+           list like "cfg:../scripts" because requests change directory
+ ******************************************************************************/
+{
+    char cwd[MAX_REQUEST_LINE], *list, *s, *t, *u, sep[2] = { ENVSEP, '\0' };
+    char *result = NULL;
+
+    if (paths == NULL || getcwd(cwd, sizeof(cwd)) == NULL)
+        return paths;
+
+    list = strdup(paths);
+    for (s = list; s != NULL; s = t) {
+        t = strchr(s, ENVSEP);
+        if (t)
+            *t++ = '\0';
+        if (*s == PATHSEP || *s == '\0')
+            u = strdup(s);
+        else
+            u = strdup_together3(cwd, "/", s);
+        if (result == NULL)
+            result = u;
+        else {
+            s = strdup_together3(result, sep, u);
+            free(result);
+            free(u);
+            result = s;
+        }
+    }
+    free(list);
+    free(paths);
+    return result;
+}
+
+static int ReadRequest(FILE *in, serverRequest *r)
+
+/******************************************************************************
+  purpose: read the lines of a request up to the empty line
+  returns: FALSE if the request is incomplete or has an unknown line
+ ******************************************************************************/
+{
+    char line[MAX_REQUEST_LINE];
+    size_t n;
+
+    r->argc = 0;
+    r->argv[r->argc++] = progname;
+    r->name = NULL;
+    r->source = -1;
+    r->reply_data = -1;
+
+    while (fgets(line, MAX_REQUEST_LINE, in) != NULL) {
+        n = strlen(line);
+        while (n > 0 && (line[n - 1] == '\n' || line[n - 1] == '\r'))
+            line[--n] = '\0';
+
+        if (n == 0) {
+            if (r->reply_data < 0)
+                r->reply_data = (r->source >= 0);
+            return TRUE;
+        }
+
+        if (strstarts(line, "arg ")) {
+            if (r->argc == MAX_REQUEST_ARGS) {
+                diagnostics(WARNING, "More than %d arguments in request", MAX_REQUEST_ARGS);
+                return FALSE;
+            }
+            r->argv[r->argc++] = strdup(line + 4);
+        } else if (strstarts(line, "cwd ")) {
+            if (chdir(line + 4) != 0) {
+                diagnostics(WARNING, "Cannot change to directory <%s>", line + 4);
+                return FALSE;
+            }
+        } else if (strstarts(line, "file ")) {
+            r->name = strdup(line + 5);
+        } else if (strstarts(line, "source ")) {
+            r->source = atol(line + 7);
+        } else if (strstarts(line, "reply ")) {
+            r->reply_data = (strcmp(line + 6, "data") == 0);
+        } else {
+            diagnostics(WARNING, "Unknown request line <%s>", line);
+            return FALSE;
+        }
+    }
+
+    diagnostics(WARNING, "Incomplete request");
+    return FALSE;
+}
+
+static char *SaveSource(FILE *in, long size, char *name)
+
+/******************************************************************************
+  purpose: copy the LaTeX that follows the request to the file name
+ ******************************************************************************/
+{
+    char buffer[8192];
+    size_t n;
+    FILE *f;
+
+    f = fopen(name, "wb");
+    if (f == NULL) {
+        diagnostics(WARNING, "Cannot create <%s>", name);
+        return NULL;
+    }
+
+    while (size > 0) {
+        n = (size < (long) sizeof(buffer)) ? (size_t) size : sizeof(buffer);
+        n = fread(buffer, 1, n, in);
+        if (n == 0)
+            break;
+        fwrite(buffer, 1, n, f);
+        size -= (long) n;
+    }
+    fclose(f);
+
+    if (size > 0) {
+        diagnostics(WARNING, "Request ended %ld bytes before the end of the source", size);
+        return NULL;
+    }
+    return name;
+}
+
+static void HandleRequest(int fd, requestConverter convert)
+
+/******************************************************************************
+  purpose: read one request from fd, convert it and send the answer
+ ******************************************************************************/
+{
+    serverRequest r;
+    FILE *in, *out, *err, *rtf = NULL;
+    char *tmp_dir, *tex_name = NULL, *rtf_name = NULL, stem[32];
+    int status = 1, null_fd;
+
+    in = fdopen(fd, "rb");
+    out = fdopen(dup(fd), "wb");
+    err = tmpfile();
+    if (in == NULL || out == NULL || err == NULL)
+        _exit(EXIT_FAILURE);
+
+    /* diagnostics go back with the answer, the blank lines from stdout go nowhere */
+    fflush(NULL);
+    dup2(fileno(err), fileno(stderr));
+    null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd >= 0)
+        dup2(null_fd, fileno(stdout));
+
+    tmp_dir = getTmpPath();
+    snprintf(stem, sizeof(stem), "l2r_request_%ld", (long) getpid());
+
+    if (ReadRequest(in, &r)) {
+        if (r.source >= 0) {
+            tex_name = strdup_together3(tmp_dir, stem, ".tex");
+            r.name = SaveSource(in, r.source, tex_name);
+        }
+
+        if (r.name == NULL) {
+            diagnostics(WARNING, "Request has neither a file nor a source");
+        } else {
+            if (r.reply_data) {
+                rtf_name = strdup_together3(tmp_dir, stem, ".rtf");
+                r.argv[r.argc++] = "-o";
+                r.argv[r.argc++] = rtf_name;
+            }
+            r.argv[r.argc++] = r.name;
+            r.argv[r.argc] = NULL;
+            status = convert(r.argc, r.argv);
+        }
+    }
+
+    fflush(NULL);
+    if (rtf_name)
+        rtf = fopen(rtf_name, "rb");
+
+    fprintf(out, "status %s\n", (status == 0) ? "ok" : "failed");
+    if (r.reply_data > 0)
+        fprintf(out, "rtf %ld\n", FileSize(rtf));
+    else if (g_rtf_name)
+        fprintf(out, "file %s\n", g_rtf_name);
+    fprintf(out, "diagnostics %ld\n\n", FileSize(err));
+    CopyFile(rtf, out);
+    CopyFile(err, out);
+    fclose(out);
+
+    if (rtf)
+        fclose(rtf);
+    if (rtf_name)
+        remove(rtf_name);
+    if (tex_name)
+        remove(tex_name);
+    _exit(EXIT_SUCCESS);
+}
+
+int RunServer(char *path, requestConverter convert)
+
+/******************************************************************************
+  purpose: wait for requests on the Unix domain socket path, forever
+ ******************************************************************************/
+{
+    struct sockaddr_un addr;
+    int listener, fd;
+    pid_t pid;
+
+    if (strlen(path) >= sizeof(addr.sun_path))
+        diagnostics(ERROR, "Socket name <%s> is too long", path);
+
+    listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0)
+        diagnostics(ERROR, "Cannot create a socket");
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, path);
+    unlink(path);
+
+    if (bind(listener, (struct sockaddr *) &addr, sizeof(addr)) != 0 || listen(listener, 64) != 0)
+        diagnostics(ERROR, "Cannot listen on <%s>", path);
+
+    g_config_path = AbsolutePaths(g_config_path);
+    g_script_dir = AbsolutePaths(g_script_dir);
+    g_tmp_dir = AbsolutePaths(g_tmp_dir);
+
+    diagnostics(2, "Waiting for requests on <%s>", path);
+
+    while (TRUE) {
+        fd = accept(listener, NULL, NULL);
+        if (fd < 0) {
+            if (errno != EINTR)
+                diagnostics(WARNING, "accept() failed on <%s>", path);
+            continue;
+        }
+
+        fflush(NULL);           /* or the child writes these buffers too */
+        pid = fork();
+        if (pid == 0) {
+            close(listener);
+            HandleRequest(fd, convert);
+        }
+        if (pid < 0)
+            diagnostics(WARNING, "Cannot start a process for a request");
+        close(fd);
+
+        while (waitpid(-1, NULL, WNOHANG) > 0);
+    }
+
+    return 0;
+}
+
+#else
+
+int RunServer(char *path, requestConverter convert)
+{
+    diagnostics(WARNING, "The server (-L option) is only available on Unix");
+    return 1;
+}
+
+#endif
@@ -0,0 +1,5 @@
+extern char *g_server_socket;
+
+typedef int (*requestConverter) (int argc, char **argv);
+
+int RunServer(char *path, requestConverter convert);
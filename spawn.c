@@ -0,0 +1,324 @@
+/* spawn.c - run convert, gs, eps2eps and latex2png without a shell
+
+Copyright (C) 2014 The Free Software Foundation
+
+This program is free software; you can redistribute it and/or
+modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation; either version 2
+of the License, or (at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program; if not, write to the Free Software
+Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.
+
+This file is available from http://sourceforge.net/projects/latex2rtf/
+
+    A program is given as an argument vector and on Unix it is run with
+    fork() and execvp(), so file names need no quoting and have no
+    length limit.  The program runs in a process group of its own, with
+    stdin from /dev/null and stdout and stderr going to a temporary file
+    that is shown when the program fails.  With -w# a program that runs
+    longer than # seconds is killed together with everything it started,
+    and it may not use more than # seconds of CPU time either.
+
+    Elsewhere the arguments are quoted and run with system().
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include "main.h"
+#include "utils.h"
+#include "spawn.h"
+
+#ifdef UNIX
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#endif
+
+#define MAX_SHOWN_OUTPUT 2048
+
+THREAD_LOCAL int g_spawn_timeout = 600;
+
+void SpawnArgsInit(spawnArgs *a)
+{
+    a->argc = 0;
+    a->argv[0] = NULL;
+}
+
+void SpawnArg(spawnArgs *a, const char *arg)
+{
+    if (a->argc == MAX_SPAWN_ARGS)
+        diagnostics(ERROR, "More than %d arguments for <%s>", MAX_SPAWN_ARGS, a->argv[0]);
+    a->argv[a->argc++] = strdup(arg);
+    a->argv[a->argc] = NULL;
+}
+
+void SpawnArgf(spawnArgs *a, const char *format, ...)
+{
+    char *arg;
+    int n;
+    va_list ap;
+
+    /* measure first, a file name in the argument may be of any length */
+    va_start(ap, format);
+    n = vsnprintf(NULL, 0, format, ap);
+    va_end(ap);
+    arg = (n < 0) ? NULL : (char *) malloc(n + 1);
+    if (arg == NULL)
+        diagnostics(ERROR, "Cannot build an argument for <%s>", a->argv[0]);
+
+    va_start(ap, format);
+    vsnprintf(arg, n + 1, format, ap);
+    va_end(ap);
+    SpawnArg(a, arg);
+    free(arg);
+}
+
+void SpawnArgsFree(spawnArgs *a)
+{
+    int i;
+
+    for (i = 0; i < a->argc; i++)
+        free(a->argv[i]);
+    SpawnArgsInit(a);
+}
+
+char *SpawnArgsString(spawnArgs *a)
+
+/******************************************************************************
+ purpose:  the arguments as one command line, quoting the ones that need it
+******************************************************************************/
+{
+    char *s, *t;
+    size_t n = 1;
+    int i, quote;
+
+    for (i = 0; i < a->argc; i++)
+        n += strlen(a->argv[i]) + 3;
+
+    s = (char *) malloc(n);
+    if (s == NULL)
+        diagnostics(ERROR, "Cannot allocate memory for a command");
+
+    t = s;
+    for (i = 0; i < a->argc; i++) {
+        quote = (a->argv[i][0] == '\0' || strpbrk(a->argv[i], " \t'\"\\$&;|<>()*?") != NULL);
+        if (i > 0)
+            *t++ = ' ';
+        if (quote)
+            *t++ = '"';
+        strcpy(t, a->argv[i]);
+        t += strlen(t);
+        if (quote)
+            *t++ = '"';
+    }
+    *t = '\0';
+    return s;
+}
+
+#ifdef UNIX
+
+static double WallTime(void)
+{
+    struct timeval tv;
+
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static void ShowOutput(spawnProcess *p, int level)
+
+/******************************************************************************
+ purpose:  show the end of what the program wrote
+******************************************************************************/
+{
+    char buffer[MAX_SHOWN_OUTPUT + 1];
+    long size;
+    size_t n;
+
+    if (p->output == NULL)
+        return;
+    fseek(p->output, 0, SEEK_END);
+    size = ftell(p->output);
+    if (size <= 0)
+        return;
+
+    fseek(p->output, (size > MAX_SHOWN_OUTPUT) ? size - MAX_SHOWN_OUTPUT : 0, SEEK_SET);
+    n = fread(buffer, 1, MAX_SHOWN_OUTPUT, p->output);
+    while (n > 0 && (buffer[n - 1] == '\n' || buffer[n - 1] == '\r'))
+        n--;
+    buffer[n] = '\0';
+    diagnostics(level, "%s%s", (size > MAX_SHOWN_OUTPUT) ? "..." : "", buffer);
+}
+
+int SpawnStart(spawnProcess *p, spawnArgs *a)
+
+/******************************************************************************
+ purpose:  start the program a->argv[0] with the arguments a
+ returns:  FALSE if it could not be started
+******************************************************************************/
+{
+    struct rlimit limit;
+    pid_t pid;
+    int fd;
+
+    p->pid = 0;
+    p->status = -1;
+    p->command = SpawnArgsString(a);
+    p->output = tmpfile();
+    diagnostics(3, "`%s`", p->command);
+
+    pid = fork();
+    if (pid == 0) {
+        setpgid(0, 0);
+        fd = open("/dev/null", O_RDONLY);
+        if (fd >= 0)
+            dup2(fd, 0);
+        if (p->output) {
+            dup2(fileno(p->output), 1);
+            dup2(fileno(p->output), 2);
+        }
+        limit.rlim_cur = limit.rlim_max = 0;
+        setrlimit(RLIMIT_CORE, &limit);
+        if (g_spawn_timeout > 0) {
+            limit.rlim_cur = limit.rlim_max = (rlim_t) g_spawn_timeout;
+            setrlimit(RLIMIT_CPU, &limit);
+        }
+        execvp(a->argv[0], a->argv);
+        _exit(127);             /* like the shell when it cannot find it */
+    }
+
+    if (pid < 0) {
+        diagnostics(WARNING, "Cannot start <%s>", p->command);
+        if (p->output)
+            fclose(p->output);
+        free(p->command);
+        return FALSE;
+    }
+
+    setpgid(pid, pid);          /* so that kill() finds the group at once */
+    p->pid = (long) pid;
+    p->deadline = (g_spawn_timeout > 0) ? WallTime() + g_spawn_timeout : 0;
+    return TRUE;
+}
+
+int SpawnWait(spawnProcess *p)
+
+/******************************************************************************
+ purpose:  wait for a program started by SpawnStart(), stopping it if it
+           runs past its deadline
+ returns:  its exit status, or -1 if it was killed
+******************************************************************************/
+{
+    struct timespec pause;
+    pid_t pid = (pid_t) p->pid, r;
+    long delay = 1;             /* milliseconds */
+    int status = -1, stopped = FALSE;
+
+    if (pid == 0)
+        return p->status;
+
+    while (TRUE) {
+        r = waitpid(pid, &status, (p->deadline > 0) ? WNOHANG : 0);
+        if (r == pid)
+            break;
+        if (r < 0 && errno != EINTR) {
+            status = -1;
+            break;
+        }
+
+        if (r == 0 && WallTime() > p->deadline) {
+            diagnostics(WARNING, "Stopping `%s` after %d seconds", p->command, g_spawn_timeout);
+            kill(-pid, SIGKILL);
+            kill(pid, SIGKILL);
+            waitpid(pid, &status, 0);
+            stopped = TRUE;
+            break;
+        }
+
+        /* check often at first, programs run for a few hundred milliseconds */
+        if (r == 0) {
+            pause.tv_sec = 0;
+            pause.tv_nsec = delay * 1000000L;
+            nanosleep(&pause, NULL);
+            if (delay < 100)
+                delay *= 2;
+        }
+    }
+
+    if (!stopped && status != -1 && WIFEXITED(status))
+        p->status = WEXITSTATUS(status);
+    else {
+        if (!stopped && status != -1 && WIFSIGNALED(status))
+            diagnostics(WARNING, "`%s` was stopped by signal %d", p->command, WTERMSIG(status));
+        p->status = -1;
+    }
+
+    if (stopped)
+        ShowOutput(p, WARNING);
+    else if (p->status == 127)
+        diagnostics(WARNING, "Cannot run `%s`", p->command);
+    else if (p->status != 0) {
+        diagnostics(WARNING, "`%s` failed with status %d", p->command, p->status);
+        ShowOutput(p, WARNING);
+    } else
+        ShowOutput(p, 4);
+
+    if (p->output)
+        fclose(p->output);
+    free(p->command);
+    p->output = NULL;
+    p->command = NULL;
+    p->pid = 0;
+    return p->status;
+}
+
+#else
+
+int SpawnStart(spawnProcess *p, spawnArgs *a)
+{
+    p->pid = 0;
+    p->deadline = 0;
+    p->output = NULL;
+    p->command = SpawnArgsString(a);
+    diagnostics(3, "`%s`", p->command);
+    p->status = system(p->command);
+    free(p->command);
+    p->command = NULL;
+    return TRUE;
+}
+
+int SpawnWait(spawnProcess *p)
+{
+    return p->status;
+}
+
+#endif
+
+int SpawnRun(spawnArgs *a)
+
+/******************************************************************************
+ purpose:  run a program and wait for it
+ returns:  its exit status, -1 if it could not be run or was killed
+******************************************************************************/
+{
+    spawnProcess p;
+
+    if (!SpawnStart(&p, a))
+        return -1;
+    return SpawnWait(&p);
+}
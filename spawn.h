@@ -0,0 +1,31 @@
+#ifndef _SPAWN_H_INCLUDED
+#define _SPAWN_H_INCLUDED 1
+
+#define MAX_SPAWN_ARGS 32
+
+extern THREAD_LOCAL int g_spawn_timeout;
+
+typedef struct {
+    int argc;
+    char *argv[MAX_SPAWN_ARGS + 1];
+} spawnArgs;
+
+typedef struct {
+    long pid;                   /* 0 when not running */
+    double deadline;            /* 0 for no time limit */
+    FILE *output;               /* what it writes on stdout and stderr */
+    char *command;              /* for the diagnostics */
+    int status;
+} spawnProcess;
+
+void   SpawnArgsInit(spawnArgs *a);
+void   SpawnArg(spawnArgs *a, const char *arg);
+void   SpawnArgf(spawnArgs *a, const char *format, ...);
+void   SpawnArgsFree(spawnArgs *a);
+char  *SpawnArgsString(spawnArgs *a);
+
+int    SpawnStart(spawnProcess *p, spawnArgs *a);
+int    SpawnWait(spawnProcess *p);
+int    SpawnRun(spawnArgs *a);
+
+#endif
@@ -27,15 +27,16 @@ Authors:
 */
 
 #include <stdlib.h>
+#include <string.h>
 #include "main.h"
 #include "stack.h"
 #include "fonts.h"
 
 #define STACKSIZE 10000
 
-static int stack[STACKSIZE];
-static int top = 0;
-int BraceLevel = 0;
+static THREAD_LOCAL int stack[STACKSIZE];
+static THREAD_LOCAL int top = 0;
+THREAD_LOCAL int BraceLevel = 0;
 
 int BasicPush(int lev, int brack);
 int BasicPop(int *lev, int *brack);
@@ -62,12 +63,55 @@ void InitializeStack(void)
   purpose: pushes 0,1 and 1,1 on the stack to start things out
  ******************************************************************************/
 {
+    top = 0;
     BraceLevel = 0;
     RecursionLevel = 1;
     PushLevels();
     BraceLevel = 1;
 }
 
+char *saveStack(void)
+
+/******************************************************************************
+  purpose: returns BraceLevel, RecursionLevel and the whole stack as one
+           line of numbers, suitable for restoreStack()
+ ******************************************************************************/
+{
+    int i;
+    char *s, *t;
+
+    s = (char *) malloc(12 * (top + 4));
+    if (s == NULL)
+        diagnostics(ERROR, "Cannot allocate memory to save stack");
+
+    t = s;
+    sprintf(t, "%d %d %d", BraceLevel, RecursionLevel, top);
+    for (i = 1; i <= top; i++) {
+        t += strlen(t);
+        sprintf(t, " %d", stack[i]);
+    }
+    strcat(t, "\n");
+    return s;
+}
+
+void restoreStack(char *s)
+
+/******************************************************************************
+  purpose: restores the stack saved by saveStack()
+ ******************************************************************************/
+{
+    int i, n;
+
+    BraceLevel = (int) strtol(s, &s, 10);
+    RecursionLevel = (int) strtol(s, &s, 10);
+    n = (int) strtol(s, &s, 10);
+    if (n < 0 || n >= STACKSIZE)
+        return;
+    for (i = 1; i <= n; i++)
+        stack[i] = (int) strtol(s, &s, 10);
+    top = n;
+}
+
 int BasicPush(int lev, int brack)
 
 /******************************************************************************
@@ -1,4 +1,4 @@
-extern int BraceLevel;
+extern THREAD_LOCAL int BraceLevel;
 
 void InitializeStack(void);
 void PushLevels(void);
@@ -7,3 +7,5 @@ void CleanStack(void);
 void PushBrace(void);
 int  PopBrace(void);
 void myprintStack(void);
+char *saveStack(void);
+void restoreStack(char *s);
@@ -34,7 +34,7 @@ Authors:
 #include "styles.h"
 #include "vertical.h"
 
-static char *g_current_style = NULL;
+static THREAD_LOCAL char *g_current_style = NULL;
 
 void SetCurrentStyle(const char *style)
 {
@@ -43,6 +43,12 @@ void SetCurrentStyle(const char *style)
     g_current_style = strdup(style);
 }
 
+void ResetCurrentStyle(void)
+{
+    safe_free(g_current_style);
+    g_current_style = NULL;
+}
+
 char *GetCurrentStyle(void)
 {
     return g_current_style;
@@ -127,7 +133,7 @@ void InsertBasicStyle(const char *rtf, int how)
         else if (*style == '*') 
             WriteCFGFontNumber(&style);
         else
-            fprintRTF("%c", *style);
+            putRtfChar(*style);
 
         style++;
     }
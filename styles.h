@@ -11,6 +11,7 @@ void InsertBasicStyle(const char *rtf, int how);
 void InsertStyle(const char *the_style);
 
 void SetCurrentStyle(const char *style);
+void ResetCurrentStyle(void);
 char *GetCurrentStyle(void);
 int IsSameAsCurrentStyle(const char *s);
 void InsertCurrentStyle(void);
@@ -53,12 +53,12 @@ typedef struct TabularT {
 } TabularT;
 
 
-int g_tabbing_left_position = 0;
-int g_tabbing_current_position = 0;
-int *g_tabbing_locations  = NULL;
-int tabbing_return       = FALSE;
-int tabbing_on_itself    = FALSE;
-long pos_begin_kill;
+THREAD_LOCAL int g_tabbing_left_position = 0;
+THREAD_LOCAL int g_tabbing_current_position = 0;
+THREAD_LOCAL int *g_tabbing_locations  = NULL;
+THREAD_LOCAL int tabbing_return       = FALSE;
+THREAD_LOCAL int tabbing_on_itself    = FALSE;
+THREAD_LOCAL long pos_begin_kill;
 
 static TabularT* NewTabular(int size)
 {
@@ -178,7 +178,7 @@ static TabularT *NewTabularFromFormat(const char *format)
     char *t, *old, *s;
     TabularT *table;
     
-    static int warned_once = FALSE;
+    static THREAD_LOCAL int warned_once = FALSE;
     diagnostics(4, "Entering NewTabularFromFormat, format='%s'", format);
 
     table = NewTabular(countTabularColumns(format));
@@ -1423,7 +1423,7 @@ void CmdTable(int code)
  ******************************************************************************/
 {
     char *location, *table_contents;
-    static char     oldalignment;
+    static THREAD_LOCAL char     oldalignment;
     int true_code = code & ~ON;
         
     if (code & ON) {
@@ -1472,6 +1472,7 @@ void CmdTable(int code)
         g_processing_table = FALSE;
         CmdEndParagraph(0);
         safe_free(g_table_label);
+        g_table_label = NULL;
         setAlignment(oldalignment);
         CmdVspace(VSPACE_BIG_SKIP);
     }
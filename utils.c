@@ -126,6 +126,32 @@ char *my_strndup(const char *src, size_t n)
     return dst;
 }
 
+/******************************************************************************
+ purpose:  strtok() that keeps its place per thread
+******************************************************************************/
+char *my_strtok(char *s, const char *delim)
+{
+    static THREAD_LOCAL char *next = NULL;
+
+    if (s == NULL)
+        s = next;
+    if (s == NULL)
+        return NULL;
+
+    s += strspn(s, delim);
+    if (*s == '\0') {
+        next = NULL;
+        return NULL;
+    }
+
+    next = s + strcspn(s, delim);
+    if (*next == '\0')
+        next = NULL;
+    else
+        *next++ = '\0';
+    return s;
+}
+
 /******************************************************************************
  purpose:  returns a new string consisting of s+t
 ******************************************************************************/
@@ -201,6 +227,8 @@ char *strdup_nocomments(const char *s)
                 goto done;
             s++;                /* first char after comment */
         }
+        if (*s == '\0')
+            break;
         *p = *s;
         p++;
         s++;
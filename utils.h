@@ -33,6 +33,7 @@ int     strstr_count(const char *s, char *t);
 
 char *  my_strcpy(char *dest, const char *src);
 char *  my_strndup(const char *s, size_t n);
+char *  my_strtok(char *s, const char *delim);
 char *  strdup_together(const char *s, const char *t);
 char *  strdup_together3(const char *s, const char *t, const char *u);
 char *  strdup_together4(const char *s, const char *t, const char *u, const char *v);
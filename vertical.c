@@ -63,17 +63,23 @@ that affect these quantities
 #include "fields.h"
 #include "acronyms.h"
 
-static int g_TeX_mode = MODE_VERTICAL;
-static int g_line_spacing = 240;
-static int g_paragraph_no_indent = FALSE;
-static int g_paragraph_inhibit_indent = FALSE;
-static int g_vertical_space_to_add = 0;
-static int g_right_margin_indent;
-static int g_left_margin_indent;
-static int g_page_new = FALSE;
-static int g_column_new = FALSE;
-static int g_alignment = JUSTIFIED;
-static int g_par_brace = 0;
+static THREAD_LOCAL int g_TeX_mode = MODE_VERTICAL;
+static THREAD_LOCAL int g_line_spacing = 240;
+static THREAD_LOCAL int g_paragraph_no_indent = FALSE;
+static THREAD_LOCAL int g_paragraph_inhibit_indent = FALSE;
+static THREAD_LOCAL int g_vertical_space_to_add = 0;
+static THREAD_LOCAL int g_right_margin_indent;
+static THREAD_LOCAL int g_left_margin_indent;
+static THREAD_LOCAL int g_page_new = FALSE;
+static THREAD_LOCAL int g_column_new = FALSE;
+static THREAD_LOCAL int g_alignment = JUSTIFIED;
+static THREAD_LOCAL int g_par_brace = 0;
+
+/* remembered by startParagraph() from one paragraph to the next */
+static THREAD_LOCAL char g_last_style[50] = "Normal";
+static THREAD_LOCAL char g_the_style[50] = "Normal";
+static THREAD_LOCAL int g_last_indent = 0;
+static THREAD_LOCAL int g_after_section = TRUE;
 
 char TexModeName[7][25] = { "bad", "internal vertical", "horizontal",
     "restricted horizontal", "math", "displaymath", "vertical"
@@ -82,6 +88,65 @@ char TexModeName[7][25] = { "bad", "internal vertical", "horizontal",
 char ParOptionName[8][13] = { "bad", "FIRST", "GENERIC", "SECTION", 
                               "EQUATION", "SLASHSLASH", "LIST", "ENVIRONMENT"};
 
+/******************************************************************************
+     save and restore everything above, e.g., between sections that are
+     converted by different processes
+ ******************************************************************************/
+void getVerticalState(int *state)
+{
+    state[0] = g_TeX_mode;
+    state[1] = g_line_spacing;
+    state[2] = g_paragraph_no_indent;
+    state[3] = g_paragraph_inhibit_indent;
+    state[4] = g_vertical_space_to_add;
+    state[5] = g_right_margin_indent;
+    state[6] = g_left_margin_indent;
+    state[7] = g_page_new;
+    state[8] = g_column_new;
+    state[9] = g_alignment;
+    state[10] = g_par_brace;
+}
+
+void setVerticalState(const int *state)
+{
+    g_TeX_mode = state[0];
+    g_line_spacing = state[1];
+    g_paragraph_no_indent = state[2];
+    g_paragraph_inhibit_indent = state[3];
+    g_vertical_space_to_add = state[4];
+    g_right_margin_indent = state[5];
+    g_left_margin_indent = state[6];
+    g_page_new = state[7];
+    g_column_new = state[8];
+    g_alignment = state[9];
+    g_par_brace = state[10];
+}
+
+void ResetVerticalState(void)
+
+/******************************************************************************
+  purpose: vertical mode, single spacing and justified text, as at the start
+           of a document
+ ******************************************************************************/
+{
+    g_TeX_mode = MODE_VERTICAL;
+    g_line_spacing = 240;
+    g_paragraph_no_indent = FALSE;
+    g_paragraph_inhibit_indent = FALSE;
+    g_vertical_space_to_add = 0;
+    g_right_margin_indent = 0;
+    g_left_margin_indent = 0;
+    g_page_new = FALSE;
+    g_column_new = FALSE;
+    g_alignment = JUSTIFIED;
+    g_par_brace = 0;
+
+    strcpy(g_last_style, "Normal");
+    strcpy(g_the_style, "Normal");
+    g_last_indent = 0;
+    g_after_section = TRUE;
+}
+
 /******************************************************************************
      left and right margin accessor functions
  ******************************************************************************/
@@ -248,10 +313,6 @@ void startParagraph(const char *style, int indenting)
 {
     int width, a, b, c;
     int parindent,parskip;
-    static char last_style[50] = "Normal";
-    static char the_style[50] = "Normal";
-    static int last_indent = 0;
-    static int next_paragraph_after_section = TRUE;
     
     int orig_font_family = CurrentFontFamily();
     int orig_font_size = CurrentFontSize();
@@ -260,15 +321,15 @@ void startParagraph(const char *style, int indenting)
     
     /* special style "last" will just repeat previous */
     if (strcmp(style,"last")==0) {
-        diagnostics(4,"using last style = '%s'",last_style);
+        diagnostics(4,"using last style = '%s'",g_last_style);
         if (indenting != PARAGRAPH_SLASHSLASH)
-        	indenting = last_indent;
-        strcpy(the_style,last_style);
+        	indenting = g_last_indent;
+        strcpy(g_the_style,g_last_style);
     } else {
         diagnostics(4,"using style = '%s'",style);
-        last_indent = indenting;
-        strcpy(last_style,style);
-        strcpy(the_style,style);
+        g_last_indent = indenting;
+        strcpy(g_last_style,style);
+        strcpy(g_the_style,style);
     }
         
     parindent = getLength("parindent");
@@ -314,7 +375,7 @@ void startParagraph(const char *style, int indenting)
 
         default:                              /* Worry about not indenting */
             diagnostics(5, "PARAGRAPH_GENERIC");
-            if (next_paragraph_after_section || g_paragraph_no_indent || 
+            if (g_after_section || g_paragraph_no_indent || 
                 g_paragraph_inhibit_indent   || g_processing_list_environment)
                 parindent = 0;
             break;
@@ -337,7 +398,7 @@ void startParagraph(const char *style, int indenting)
     diagnostics(5, "right indent is   %d", g_right_margin_indent);
     diagnostics(5, "current parindent %d", getLength("parindent"));
     diagnostics(5, "this parindent    %d", parindent);
-    diagnostics(5, "current style is    %s", the_style);
+    diagnostics(5, "current style is    %s", g_the_style);
     diagnostics(6, "current family      %d", CurrentFontFamily());
     diagnostics(6, "current font size   %d", CurrentFontSize());
     diagnostics(6, "current font series %d", CurrentFontSeries());
@@ -355,25 +416,25 @@ void startParagraph(const char *style, int indenting)
     }
 
     fprintRTF("\\pard\\plain");
-    InsertStyle(the_style);
-    if (strcmp(the_style,"equation")==0)
+    InsertStyle(g_the_style);
+    if (strcmp(g_the_style,"equation")==0)
         fprintRTF("\\tqc\\tx%d", b);
-    if (strcmp(the_style,"equationNum")==0)
+    if (strcmp(g_the_style,"equationNum")==0)
         fprintRTF("\\tqc\\tx%d\\tqr\\tx%d", b, width);
-    if (strcmp(the_style,"equationAlign")==0)
+    if (strcmp(g_the_style,"equationAlign")==0)
         fprintRTF("\\tqr\\tx%d\\tql\\tx%d", a, b);
-    if (strcmp(the_style,"equationAlignNum")==0)
+    if (strcmp(g_the_style,"equationAlignNum")==0)
         fprintRTF("\\tqr\\tx%d\\tql\\tx%d\\tqr\\tx%d", a, b, width);
-    if (strcmp(the_style,"equationArray")==0)
+    if (strcmp(g_the_style,"equationArray")==0)
         fprintRTF("\\tqr\\tx%d\\tqc\\tx%d\\tql\\tx%d", a, b, c);
-    if (strcmp(the_style,"equationArrayNum")==0)
+    if (strcmp(g_the_style,"equationArrayNum")==0)
         fprintRTF("\\tqr\\tx%d\\tqc\\tx%d\\tql\\tx%d\\tqr\\tx%d", a, b, c, width);
 
-    if (strcmp(the_style,"bitmapCenter")==0)
+    if (strcmp(g_the_style,"bitmapCenter")==0)
         fprintRTF("\\tqc\\tx%d\\tqr\\tx%d", b, width);
 
     /* TODO change width/6 with hint */
-    if (strcmp(the_style,"acronym")==0)
+    if (strcmp(g_the_style,"acronym")==0)
         fprintRTF("\\tx%d\\tqr\\tldot\\tx%d", acronymHint(width), width);
         
     fprintRTF("\\sl%i\\slmult1 ", getLineSpacing());
@@ -391,10 +452,10 @@ void startParagraph(const char *style, int indenting)
     fprintRTF("\\fi%d ", parindent);
     
     /* these are strstr because might end in 0 */
-    if (strstr("part",the_style)    == NULL && 
-        strstr("title",the_style)   == NULL &&
-        strstr("chapter",the_style) == NULL &&
-        strstr("section",the_style) == NULL ) {
+    if (strstr("part",g_the_style)    == NULL && 
+        strstr("title",g_the_style)   == NULL &&
+        strstr("chapter",g_the_style) == NULL &&
+        strstr("section",g_the_style) == NULL ) {
         
         if (CurrentFontFamily() != orig_font_family)
             fprintRTF("\\f%d ", orig_font_family);
@@ -420,9 +481,9 @@ void startParagraph(const char *style, int indenting)
     }
      
     if (indenting == PARAGRAPH_SECTION_TITLE && !FrenchMode)
-    	next_paragraph_after_section = TRUE;
+    	g_after_section = TRUE;
     else
-    	next_paragraph_after_section = FALSE;
+    	g_after_section = FALSE;
 
 }
 
@@ -576,7 +637,7 @@ void CmdLineSpacing(int code)
 void CmdSpacingEnviron(int code)
 {
 	char *sizeParam;
-	static int originalSpacing=240;
+	static THREAD_LOCAL int originalSpacing=240;
 	float spacing;
     int true_code = code & ~ON;
 
@@ -609,10 +670,10 @@ void CmdAlign(int code)
  ********************************************************************************/
 {
     char *s;
-    static char old_alignment_before_center = JUSTIFIED;
-    static char old_alignment_before_right = JUSTIFIED;
-    static char old_alignment_before_left = JUSTIFIED;
-    static char old_alignment_before_centerline = JUSTIFIED;
+    static THREAD_LOCAL char old_alignment_before_center = JUSTIFIED;
+    static THREAD_LOCAL char old_alignment_before_right = JUSTIFIED;
+    static THREAD_LOCAL char old_alignment_before_left = JUSTIFIED;
+    static THREAD_LOCAL char old_alignment_before_centerline = JUSTIFIED;
 
     if (code == PAR_VCENTER) {
         int restart_field=0;
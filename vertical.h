@@ -19,6 +19,12 @@
 
 extern char TexModeName[7][25];
 
+#define VERTICAL_STATE_SIZE 11
+
+void getVerticalState(int *state);
+void setVerticalState(const int *state);
+void ResetVerticalState(void);
+
 
 #define VSPACE_VSPACE     -1
 #define VSPACE_VSKIP       0
@@ -47,15 +47,15 @@
 #include "labels.h"
 #include "acronyms.h"
 #include "biblio.h"
+#include "hash.h"
 
-char *g_figure_label = NULL;
-char *g_table_label = NULL;
-char *g_equation_label = NULL;
-char *g_section_label = NULL;
-int g_suppress_name = FALSE;
-static int g_warned_once = FALSE;
+THREAD_LOCAL char *g_figure_label = NULL;
+THREAD_LOCAL char *g_table_label = NULL;
+THREAD_LOCAL char *g_equation_label = NULL;
+THREAD_LOCAL char *g_section_label = NULL;
+THREAD_LOCAL int g_suppress_name = FALSE;
+static THREAD_LOCAL int g_warned_once = FALSE;
 
-#define MAX_LABELS 200
 #define MAX_CITATIONS 1000
 #define BIB_STYLE_ALPHA  0
 #define BIB_STYLE_SUPER  1
@@ -65,8 +65,14 @@ static int g_warned_once = FALSE;
 
 char *BIB_DASH_MARKER="%dash%";
 
-char *g_label_list[MAX_LABELS];
-int g_label_list_number = -1;
+/* the bookmarks written so far, in order, and a set of them for lookups */
+static THREAD_LOCAL char **g_label_list = NULL;
+static THREAD_LOCAL int g_label_list_number = -1;
+static THREAD_LOCAL int g_label_list_reserved = 0;
+static THREAD_LOCAL hashTable *g_label_index = NULL;
+static THREAD_LOCAL hashStats g_label_stats = { "bookmarks" };
+
+static void ForgetBookmarks(void);
 
 typedef struct citekey_type {
     char *key;
@@ -74,32 +80,72 @@ typedef struct citekey_type {
 } citekey_type;
 
 
-static char *g_all_citations[MAX_CITATIONS];
-static int g_last_citation = 0;
-static int g_current_cite_type = 0;
-static int g_current_cite_seen = 0;
-static int g_current_cite_paren = 0;
-static char g_last_author_cited[MAX_AUTHOR_SIZE];
-static char g_last_year_cited[MAX_YEAR_SIZE];
-static int g_citation_longnamesfirst = 0;
-static int g_current_cite_item = 0;
-static int g_sorted_citations = FALSE;
-static int g_compressed_citations = FALSE;
-
-static char *g_bibpunct_open = NULL;
-static char *g_bibpunct_close = NULL;
-static char *g_bibpunct_cite_sep = NULL;
-static char *g_bibpunct_author_date_sep = NULL;
-static char *g_bibpunct_numbers_sep = NULL;
-static char *g_bibpunct_postnote_sep = NULL;
-static char *g_bibstyle_punct[2] = {"[", "]"};
-static int g_bibpunct_cite_sep_touched = FALSE;
-static int g_bibpunct_style_paren_touched = FALSE;
-static int   g_bibpunct_style = BIB_STYLE_ALPHA;
-static int g_in_bibliography = FALSE;
+static THREAD_LOCAL char *g_all_citations[MAX_CITATIONS];
+static THREAD_LOCAL int g_last_citation = 0;
+static THREAD_LOCAL int g_current_cite_type = 0;
+static THREAD_LOCAL int g_current_cite_seen = 0;
+static THREAD_LOCAL int g_current_cite_paren = 0;
+static THREAD_LOCAL char g_last_author_cited[MAX_AUTHOR_SIZE];
+static THREAD_LOCAL char g_last_year_cited[MAX_YEAR_SIZE];
+static THREAD_LOCAL int g_citation_longnamesfirst = 0;
+static THREAD_LOCAL int g_current_cite_item = 0;
+static THREAD_LOCAL int g_sorted_citations = FALSE;
+static THREAD_LOCAL int g_compressed_citations = FALSE;
+
+static THREAD_LOCAL char *g_bibpunct_open = NULL;
+static THREAD_LOCAL char *g_bibpunct_close = NULL;
+static THREAD_LOCAL char *g_bibpunct_cite_sep = NULL;
+static THREAD_LOCAL char *g_bibpunct_author_date_sep = NULL;
+static THREAD_LOCAL char *g_bibpunct_numbers_sep = NULL;
+static THREAD_LOCAL char *g_bibpunct_postnote_sep = NULL;
+static THREAD_LOCAL char *g_bibstyle_punct[2] = {"[", "]"};
+static THREAD_LOCAL int g_bibpunct_cite_sep_touched = FALSE;
+static THREAD_LOCAL int g_bibpunct_style_paren_touched = FALSE;
+static THREAD_LOCAL int   g_bibpunct_style = BIB_STYLE_ALPHA;
+static THREAD_LOCAL int g_in_bibliography = FALSE;
+
+static THREAD_LOCAL hashTable *g_bbl_index = NULL;     /* key -> entry text */
+static THREAD_LOCAL hashStats g_bbl_stats = { "bibentries" };
+static THREAD_LOCAL char *baseurl = NULL;
+static THREAD_LOCAL char *urlstyle = NULL;
+static THREAD_LOCAL int g_thanks_number = 0;
 
 void InitializeBibliography(void)
+
+/******************************************************************************
+  purpose: sets the citation style to the defaults, forgets all citations
+           and the .bbl entries.  Called again before each document.
+ ******************************************************************************/
 {
+    int i;
+
+    for (i = 0; i < g_last_citation; i++)
+        free(g_all_citations[i]);
+    g_last_citation = 0;
+    g_current_cite_type = 0;
+    g_current_cite_seen = 0;
+    g_current_cite_paren = 0;
+    g_current_cite_item = 0;
+    g_last_author_cited[0] = '\0';
+    g_last_year_cited[0] = '\0';
+    g_citation_longnamesfirst = 0;
+    g_sorted_citations = FALSE;
+    g_compressed_citations = FALSE;
+    g_in_bibliography = FALSE;
+    g_warned_once = FALSE;
+    g_bibstyle_punct[0] = "[";
+    g_bibstyle_punct[1] = "]";
+
+    hashFree(g_bbl_index, free);
+    g_bbl_index = NULL;
+    hashStatsReset(&g_bbl_stats);
+
+    safe_free(g_bibpunct_open);
+    safe_free(g_bibpunct_close);
+    safe_free(g_bibpunct_cite_sep);
+    safe_free(g_bibpunct_author_date_sep);
+    safe_free(g_bibpunct_numbers_sep);
+    safe_free(g_bibpunct_postnote_sep);
     g_bibpunct_open = strdup("(");
     g_bibpunct_close = strdup(")");
     g_bibpunct_cite_sep = strdup(",");
@@ -111,6 +157,39 @@ void InitializeBibliography(void)
     g_bibpunct_style = BIB_STYLE_ALPHA;
 }
 
+void ResetCrossReferences(void)
+
+/******************************************************************************
+  purpose: forgets the labels, bookmarks, footnote marks and urls of the
+           previous document
+ ******************************************************************************/
+{
+    safe_free(g_figure_label);
+    safe_free(g_table_label);
+    safe_free(g_equation_label);
+    safe_free(g_section_label);
+    g_figure_label = g_table_label = g_equation_label = g_section_label = NULL;
+    g_suppress_name = FALSE;
+    g_thanks_number = 0;
+
+    ForgetBookmarks();
+    hashStatsReset(&g_label_stats);
+
+    safe_free(urlstyle);
+    safe_free(baseurl);
+    urlstyle = baseurl = NULL;
+
+    /* InitializeBibliography() sets them again for the next document */
+    safe_free(g_bibpunct_open);
+    safe_free(g_bibpunct_close);
+    safe_free(g_bibpunct_cite_sep);
+    safe_free(g_bibpunct_author_date_sep);
+    safe_free(g_bibpunct_numbers_sep);
+    safe_free(g_bibpunct_postnote_sep);
+    g_bibpunct_open = g_bibpunct_close = g_bibpunct_cite_sep = NULL;
+    g_bibpunct_author_date_sep = g_bibpunct_numbers_sep = g_bibpunct_postnote_sep = NULL;
+}
+
 void set_longnamesfirst(void)
 {
     g_citation_longnamesfirst = TRUE;
@@ -129,12 +208,15 @@ void set_bibpunct_style_number(void)
 void set_bibpunct_style_separator(char *s)
 {
     g_bibpunct_cite_sep_touched = TRUE;
+    safe_free(g_bibpunct_cite_sep);
     g_bibpunct_cite_sep=strdup(s);
 }
 
 void set_bibpunct_style_paren(char *open, char *close)
 {
     g_bibpunct_style_paren_touched = TRUE;
+    safe_free(g_bibpunct_open);
+    safe_free(g_bibpunct_close);
     g_bibpunct_open = strdup(open);
     g_bibpunct_close = strdup(close);
 }
@@ -222,61 +304,146 @@ static char *ScanAux(int token_id, char *reference, int code)
     }
     return NULL;
 }
+/*************************************************************************
+purpose: reads the whole .bbl file into memory, with the line ends and
+         tabs translated as my_fgetc() does
+ ************************************************************************/
+static char *ReadBbl(FILE *f)
+{
+    size_t n = 0, size = 16384;
+    char *text = (char *) malloc(size);
+    int c;
+
+    if (text == NULL)
+        diagnostics(ERROR, "Cannot allocate memory for the .bbl file");
+
+    while ((c = my_fgetc(f)) != '\0' || !feof(f)) {
+        if (n + 1 == size) {
+            size *= 2;
+            text = (char *) realloc(text, size);
+            if (text == NULL)
+                diagnostics(ERROR, "Cannot allocate memory for the .bbl file");
+        }
+        text[n++] = (char) c;
+    }
+    text[n] = '\0';
+    return text;
+}
+
+/*************************************************************************
+purpose: returns the key of the \bibitem[label]{key} that starts at s and
+         sets *end to the character after it, or NULL if there is no key
+ ************************************************************************/
+static char *BibitemKey(char *s, char **end)
+{
+    int depth = 0;
+    char *key;
+
+    s += strlen("\\bibitem");
+    while (*s == ' ' || *s == '\n')
+        s++;
+    if (*s == '[') {
+        for (s++; *s && (*s != ']' || depth > 0); s++) {
+            if (*s == '{')
+                depth++;
+            else if (*s == '}')
+                depth--;
+        }
+        if (*s == '\0')
+            return NULL;
+        s++;
+    }
+    while (*s == ' ' || *s == '\n')
+        s++;
+    if (*s != '{' || (key = strchr(s, '}')) == NULL)
+        return NULL;
+    *end = key + 1;
+    return my_strndup(s + 1, key - s - 1);
+}
+
+/*************************************************************************
+purpose: returns a copy of the entry that starts at s: all lines up to
+         two newlines in a row, without a '.' and spaces at the end
+ ************************************************************************/
+static char *BblEntry(char *s)
+{
+    char *t, *entry, *result;
+
+    t = s;
+    if (*t)
+        for (t++; *t && !(t[0] == '\n' && t[-1] == '\n'); t++);
+    while (t > s && (t[-1] == ' ' || t[-1] == '\n'))
+        t--;
+    if (t > s && t[-1] == '.')
+        t--;
+
+    entry = my_strndup(s, t - s);
+    result = strdup_nocomments(entry);
+    free(entry);
+    return result;
+}
+
+/*************************************************************************
+purpose: reads the .bbl file once and indexes the text of every entry
+         by the key of its \bibitem, so that each \bibentry is a lookup
+ ************************************************************************/
+static void IndexBbl(void)
+{
+    FILE *f;
+    char *text, *s, *key, *end;
+
+    g_bbl_index = hashNew(256);
+    f = my_fopen(g_bbl_name, "rb");
+    if (f == NULL) {
+        diagnostics(WARNING, "No .bbl file.  Run LaTeX to create one.");
+        g_bbl_file_missing = TRUE;
+        return;
+    }
+    text = ReadBbl(f);
+    fclose(f);
+
+    for (s = text; (s = strstr(s, "\\bibitem")) != NULL; s = end) {
+        end = s + 1;
+        key = BibitemKey(s, &end);
+        if (key == NULL)
+            continue;
+
+        /* the entry starts on the line after the key */
+        while (*end && *end != '\n')
+            end++;
+        if (*end)
+            end++;
+        if (hashLookup(g_bbl_index, key) == NULL)
+            hashInsert(g_bbl_index, key, BblEntry(end));
+        free(key);
+    }
+    free(text);
+    diagnostics(4, "%d entries in .bbl", g_bbl_index->count);
+}
+
 /*************************************************************************
 purpose: obtains a \bibentry{reference} from the .bbl file
-         this consists of all lines after \bibentry{reference} until two
+         this consists of all lines after \bibitem{reference} until two
          newlines in a row are found.  
          Finally, remove a '.' if at the end 
  ************************************************************************/
 static char *ScanBbl(char *reference)
 {
-    char line[512];
-    static FILE *f_bbl = NULL;
-    char *buffer, *target;
-    char *s=NULL;
-    char last_c;
-    int  i=1;
+    char *s;
+    double start;
     
     if (g_bbl_file_missing || strlen(reference) == 0) {
         return NULL;
     }
-    target = strdup_together3("{", reference,"}");
-    diagnostics(4, "seeking '%s' in .bbl", target);
+    diagnostics(4, "seeking '%s' in .bbl", reference);
     
-    if (f_bbl == NULL && (f_bbl = my_fopen(g_bbl_name, "rb")) == NULL) {
-        diagnostics(WARNING, "No .bbl file.  Run LaTeX to create one.");
-        g_bbl_file_missing = TRUE;
-        return NULL;
-    }
-    rewind(f_bbl);
+    if (g_bbl_index == NULL)
+        IndexBbl();
 
-    /* scan each line for \bibentry{reference} */
-    while (my_fgets(line, 511, f_bbl)) {
-        s = strstr(line,target);
-        if (s) break;
-    }
-    
-    safe_free(target);
-    if (s == NULL) return NULL;
-    buffer = (char *) malloc(4096);
-    
-    /* scan bbl file until we encounter \n\n */
-    last_c = '\0';
-    for (i=0; i<4096; i++) {        
-        buffer[i] = my_fgetc(f_bbl);
-        if (feof(f_bbl)) break;
-        if (buffer[i] == '\n' && last_c == '\n') break;     
-        last_c = buffer[i];
-    }
-        
-    /* strip trailing . and any spaces at the end */
-    while (buffer[i] ==' ' || buffer[i] == '\n') i--;
-    if (buffer[i] == '.') i--;
-    
-    buffer[i+1] = '\0';
-    s = strdup_nocomments(buffer);
-    safe_free(buffer);
-    return s;
+    start = hashStatsStart();
+    s = (char *) hashFind(g_bbl_index, reference);
+    hashStatsCount(&g_bbl_stats, s, start);
+    return (s) ? strdup(s) : NULL;
 }
 
 /******************************************************************************
@@ -303,7 +470,6 @@ void CmdTheEndNotes(int code)
 void CmdFootNote(int code)
 {
     char *number, *text;
-    static int thankno = 0; /*WH 2009-11-10: changed from 1 to 0*/
 
     diagnostics(4, "Entering ConvertFootNote");
     number = getBracketParam(); /* ignored by automatic footnumber * generation */
@@ -311,15 +477,15 @@ void CmdFootNote(int code)
 
     switch (code) {
         case FOOTNOTE_THANKS:
-            thankno++;
+            g_thanks_number++;
             fprintRTF("{");
             InsertStyle("footnote reference");
-            fprintRTF(" %d}\n", thankno);
+            fprintRTF(" %d}\n", g_thanks_number);
             fprintRTF("{\\*\\footnote\\pard ");
             InsertStyle("footnote text");
             fprintRTF("{");
             InsertStyle("footnote reference");
-            fprintRTF("%d} ", thankno);
+            fprintRTF("%d} ", g_thanks_number);
            break;
 
         case FOOTNOTE:
@@ -504,6 +670,13 @@ void CmdBibliography(int code)
     s = getBraceParam();        /* throw away bibliography name */
     safe_free(s);
 
+    /* LaTeX from stdin or l2r_convert() has no .bbl unless -b names one,
+       and PushSource(NULL, NULL) would read stdin */
+    if (g_bbl_name == NULL) {
+        diagnostics(WARNING, "No .bbl file for \\bibliography, use -b to name one");
+        return;
+    }
+
     err = PushSource(g_bbl_name, NULL);
     g_in_bibliography = TRUE;
     
@@ -699,29 +872,115 @@ void CmdPrintIndex(int code)
 
 static int ExistsBookmark(char *s)
 {
-    int i;
+    hashEntry *e;
+    double start;
 
     if (!s)
         return FALSE;
-    for (i = 0; i <= g_label_list_number; i++) {
-        if (strcmp(s, g_label_list[i]) == 0)
-            return TRUE;
-    }
-    return FALSE;
+    start = hashStatsStart();
+    e = hashLookup(g_label_index, s);
+    hashStatsCount(&g_label_stats, e, start);
+    return (e != NULL);
 }
 
 static void RecordBookmark(char *s)
 {
+    char **list;
+    int reserve;
+
     if (!s)
         return;
-    if (g_label_list_number >= MAX_LABELS)
-        diagnostics(WARNING, "Too many labels...some cross-references will fail");
-    else {
-        g_label_list_number++;
-        g_label_list[g_label_list_number] = strdup(s);
+
+    if (g_label_list_number + 1 == g_label_list_reserved) {
+        reserve = (g_label_list_reserved) ? 2 * g_label_list_reserved : 64;
+        list = (char **) realloc(g_label_list, reserve * sizeof(char *));
+        if (list == NULL) {
+            diagnostics(WARNING, "Too many labels...some cross-references will fail");
+            return;
+        }
+        g_label_list = list;
+        g_label_list_reserved = reserve;
+    }
+
+    if (g_label_index == NULL)
+        g_label_index = hashNew(256);
+    g_label_list_number++;
+    g_label_list[g_label_list_number] = strdup(s);
+    hashInsert(g_label_index, s, g_label_list[g_label_list_number]);
+}
+
+static void ForgetBookmarks(void)
+{
+    for (; g_label_list_number >= 0; g_label_list_number--)
+        free(g_label_list[g_label_list_number]);
+    free(g_label_list);
+    g_label_list = NULL;
+    g_label_list_reserved = 0;
+    hashFree(g_label_index, NULL);
+    g_label_index = NULL;
+}
+
+void ReportCrossReferenceStats(void)
+{
+    hashStatsReport(&g_label_stats, g_label_list_number + 1);
+    hashStatsReport(&g_bbl_stats, (g_bbl_index) ? g_bbl_index->count : 0);
+}
+
+/******************************************************************************
+purpose: returns the names of all bookmarks on one line for restoreBookmarks()
+******************************************************************************/
+char *saveBookmarks(void)
+{
+    int i;
+    size_t n = 2;
+    char *s, *t;
+
+    for (i = 0; i <= g_label_list_number; i++)
+        n += strlen(g_label_list[i]) + 1;
+
+    s = (char *) malloc(n);
+    if (s == NULL)
+        diagnostics(ERROR, "Cannot allocate memory to save bookmarks");
+
+    t = s;
+    for (i = 0; i <= g_label_list_number; i++) {
+        strcpy(t, g_label_list[i]);
+        t += strlen(t);
+        *t++ = ' ';
+    }
+    strcpy(t, "\n");
+    return s;
+}
+
+/******************************************************************************
+purpose: replaces all bookmarks by those returned from saveBookmarks()
+******************************************************************************/
+void restoreBookmarks(char *s)
+{
+    char *t, *name;
+
+    ForgetBookmarks();
+
+    while (s && *s != '\n' && (t = strchr(s, ' ')) != NULL) {
+        name = my_strndup(s, t - s);
+        RecordBookmark(name);
+        free(name);
+        s = t + 1;
     }
 }
 
+/******************************************************************************
+purpose: remember a bookmark for name without writing it
+******************************************************************************/
+void addBookmark(char *name)
+{
+    char *signet = strdup_nobadchars(name);
+
+    if (!ExistsBookmark(signet))
+        RecordBookmark(signet);
+    free(signet);
+}
+
 void InsertBookmark(char *name, char *text)
 {
     char *signet;
@@ -780,6 +1039,7 @@ void CmdLabel(int code)
             if (g_processing_figure || g_processing_table)
                 break;
             if (mode == MODE_DISPLAYMATH) {
+                safe_free(g_equation_label);
                 g_equation_label = strdup_nobadchars(text);
                 diagnostics(4, "equation label is <%s>", text);
             } else
@@ -1881,13 +2141,43 @@ static void InsertRtfHyperlink(const char *text,    const char *url,
     safe_free(fullurl);
 }
 
+/******************************************************************************
+purpose: returns \urlstyle and \baseurl as two lines for restoreUrlState()
+******************************************************************************/
+char *saveUrlState(void)
+{
+    return strdup_together4(urlstyle ? urlstyle : "", "\n", 
+                            baseurl ? baseurl : "", "\n");
+}
+
+static char *restoreUrlLine(char **s)
+{
+    char *eol = strchr(*s, '\n');
+    char *line;
+
+    if (eol == NULL)
+        return NULL;
+    line = (eol == *s) ? NULL : my_strndup(*s, eol - *s);
+    *s = eol + 1;
+    return line;
+}
+
+/******************************************************************************
+purpose: sets \urlstyle and \baseurl from the lines returned by saveUrlState()
+******************************************************************************/
+void restoreUrlState(char *s)
+{
+    safe_free(urlstyle);
+    safe_free(baseurl);
+    urlstyle = restoreUrlLine(&s);
+    baseurl = restoreUrlLine(&s);
+}
+
 /******************************************************************************
 purpose: handles \htmladdnormallink{text}{link}
 ******************************************************************************/
 void CmdHtml(int code)
 {
-    static char *baseurl = NULL;
-    static char *urlstyle = NULL;
     char *text=NULL;
     char *url=NULL;
     char *s = NULL;
@@ -109,6 +109,7 @@
 #define TABLE_OF_CONTENTS   3
 
 void InitializeBibliography(void);
+void ResetCrossReferences(void);
 void CmdTheEndNotes(int code);
 void CmdFootNote(int code);
 void CmdLabel(int code);
@@ -122,7 +123,13 @@ void CmdNewblock(int code);
 void CmdIndex(int code);
 void CmdPrintIndex(int code);
 void CmdHtml(int code);
+char *saveUrlState(void);
+void restoreUrlState(char *s);
 void InsertBookmark(char *name, char *text);
+void addBookmark(char *name);
+char *saveBookmarks(void);
+void restoreBookmarks(char *s);
+void ReportCrossReferenceStats(void);
 void InsertContentMark(char marker, char *s1, char *s2, char *s3);
 void CmdCite(int code);
 void CmdHarvardCite(int code);